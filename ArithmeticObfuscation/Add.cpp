@@ -8,7 +8,10 @@ using namespace llvm;
 
 namespace {
 
-bool obfuscateInteger(Instruction *I) {
+// Rewrites of an integer add, one is chosen at random for every add
+const unsigned int NUM_REWRITES = 3;
+
+bool obfuscateInteger(Instruction *I, ObfuscationRandom *random) {
     Type* type = I->getType();
     if(!type->isIntegerTy())
         return false;
@@ -17,15 +20,35 @@ bool obfuscateInteger(Instruction *I) {
     Value* b = I->getOperand(1);
 
     IRBuilder<> Builder(I);
-    // a ^ b
-    Value* v_xor = Builder.CreateXor(a, b);
-    // a & b
-    Value* v_and = Builder.CreateAnd(a, b);
     Value* two = ConstantInt::get(type, 2);
-    // 2 * (a & b)
-    Value* v_mul = Builder.CreateMul(two, v_and);
-    // (a ^ b) + 2 * (a & b)
-    Value* final = Builder.CreateAdd(v_xor, v_mul);
+    Value* final;
+    unsigned int rewrite = random != nullptr? random->next() % NUM_REWRITES: 0;
+    if(rewrite == 0) {
+        // a ^ b
+        Value* v_xor = Builder.CreateXor(a, b);
+        // a & b
+        Value* v_and = Builder.CreateAnd(a, b);
+        // 2 * (a & b)
+        Value* v_mul = Builder.CreateMul(two, v_and);
+        // (a ^ b) + 2 * (a & b)
+        final = Builder.CreateAdd(v_xor, v_mul);
+    } else if(rewrite == 1) {
+        // a | b
+        Value* v_or = Builder.CreateOr(a, b);
+        // a & b
+        Value* v_and = Builder.CreateAnd(a, b);
+        // (a | b) + (a & b)
+        final = Builder.CreateAdd(v_or, v_and);
+    } else {
+        // a | b
+        Value* v_or = Builder.CreateOr(a, b);
+        // a ^ b
+        Value* v_xor = Builder.CreateXor(a, b);
+        // 2 * (a | b)
+        Value* v_mul = Builder.CreateMul(two, v_or);
+        // 2 * (a | b) - (a ^ b)
+        final = Builder.CreateSub(v_mul, v_xor);
+    }
 
     I->replaceAllUsesWith(final);
 
@@ -57,12 +80,30 @@ bool obfuscateFloat(Instruction *I) {
 
 } /* namespace */
 
-bool AddObfuscator::obfuscate(Instruction *I) {
+bool AddObfuscator::obfuscate(Instruction *I, ObfuscationRandom *random) {
     if(I->getOpcode() == Instruction::Add) {
-        return obfuscateInteger(I);
+        return obfuscateInteger(I, random);
     } else if (I->getOpcode() == Instruction::FAdd) {
         return obfuscateFloat(I);
     } else {
         return false;
     }
 }
+
+ObfuscationCost AddObfuscator::estimate(Instruction *I, const TargetTransformInfo *TTI) {
+    if(I->getOpcode() == Instruction::Add) {
+        // (a ^ b) + 2 * (a & b), (a | b) + (a & b) or 2 * (a | b) - (a ^ b)
+        return ArithmeticObfuscationUtils::getCostliest({
+            ObfuscationUtils::getReplacementCost({Instruction::Xor, Instruction::And, Instruction::Mul, Instruction::Add}, 
+                {Instruction::Add}, I->getType(), TTI),
+            ObfuscationUtils::getReplacementCost({Instruction::Or, Instruction::And, Instruction::Add}, 
+                {Instruction::Add}, I->getType(), TTI),
+            ObfuscationUtils::getReplacementCost({Instruction::Or, Instruction::Xor, Instruction::Mul, Instruction::Sub}, 
+                {Instruction::Add}, I->getType(), TTI)});
+    } else if (I->getOpcode() == Instruction::FAdd) {
+        return ArithmeticObfuscationUtils::estimateFloat(I, 
+            {Instruction::Add, Instruction::SIToFP, Instruction::FAdd, Instruction::FAdd}, TTI);
+    } else {
+        return ObfuscationCost();
+    }
+}
@@ -1,53 +1,330 @@
 #include "llvm/Pass.h"
 #include "llvm/IR/Function.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/PostOrderIterator.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/Analysis/ScalarEvolutionExpressions.h"
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Support/Debug.h"
-#include "llvm/Support/CommandLine.h"
+#include "llvm/Analysis/TargetTransformInfo.h"
+#include "llvm/Analysis/OptimizationRemarkEmitter.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Support/Timer.h"
+#include "ObfuscationUtils/ObfuscationUtils.h"
 #include "ArithmeticObfuscation/ArithmeticObfuscation.h"
 using namespace llvm;
 
 #define DEBUG_TYPE "arith-obfus"
 
+STATISTIC(NumObfuscated, "Instructions obfuscated (in all iterations)");
+STATISTIC(NumFloatObfuscated, "Floating point instructions obfuscated");
+STATISTIC(NumOverBudget, "Instructions not obfuscated, over the budget");
+STATISTIC(NumRolledBack, "Functions restored, over the obfuscation budget");
+STATISTIC(NumKeptForSCEV, "Instructions not obfuscated, induction variables or address computations");
+STATISTIC(NumHoisted, "Loop invariant instructions moved to a preheader before obfuscation");
+STATISTIC(NumAlreadyObfuscated, "Functions skipped, obfuscated by a previous run (-obf-max-layers)");
+
 cl::opt<int> numIterations("arith-obfus-iter", cl::desc("<number of iterations (>0 and <=3) >"), cl::init(1));
 cl::opt<bool> obfuscateFloat("obfus-float", cl::desc("Enable obfuscation of floating point binary operations"), cl::init(false));
+cl::opt<bool> keepSCEV("arith-obfus-keep-scev", 
+    cl::desc("Do not obfuscate the induction variables and the address computations, seen through by ScalarEvolution"), 
+    cl::init(false));
+cl::opt<bool> hoistInvariants("arith-obfus-hoist", 
+    cl::desc("Move the loop invariant instructions to the preheader of the loop before obfuscating them"), 
+    cl::init(true));
 
-bool ArithmeticObfuscation::obfuscate(Instruction *I) {
+bool ArithmeticObfuscation::obfuscate(Instruction *I, ObfuscationRandom *random) {
     switch(I->getOpcode()) {
         case (Instruction::Add):
-            return AddObfuscator::obfuscate(I);
+            return AddObfuscator::obfuscate(I, random);
         case (Instruction::Sub):
-            return SubObfuscator::obfuscate(I);
+            return SubObfuscator::obfuscate(I, random);
         case (Instruction::SDiv):
         case (Instruction::UDiv):
-            return DivObfuscator::obfuscate(I);
+            return DivObfuscator::obfuscate(I, random);
         case (Instruction::Mul):
-            return MulObfuscator::obfuscate(I);
+            return MulObfuscator::obfuscate(I, random);
         default:
             return false;
     }
 }
 
-bool ArithmeticObfuscation::obfuscateWithFloat(Instruction *I) {
+bool ArithmeticObfuscation::obfuscateWithFloat(Instruction *I, ObfuscationRandom *random) {
     switch(I->getOpcode()) {
         case (Instruction::Add):
         case (Instruction::FAdd):
-            return AddObfuscator::obfuscate(I);
+            return AddObfuscator::obfuscate(I, random);
+        case (Instruction::Sub):
+        case (Instruction::FSub):
+            return SubObfuscator::obfuscate(I, random);
+        case (Instruction::SDiv):
+        case (Instruction::UDiv):
+            return DivObfuscator::obfuscate(I, random);
+        case (Instruction::Mul):
+        case (Instruction::FMul):
+            return MulObfuscator::obfuscate(I, random);
+        default:
+            return false;
+    }
+}
+
+ObfuscationCost ArithmeticObfuscation::estimate(Instruction *I, bool oFloat, const TargetTransformInfo *TTI) {
+    switch(I->getOpcode()) {
+        case (Instruction::Add):
+            return AddObfuscator::estimate(I, TTI);
         case (Instruction::Sub):
+            return SubObfuscator::estimate(I, TTI);
+        case (Instruction::SDiv):
+        case (Instruction::UDiv):
+            return DivObfuscator::estimate(I, TTI);
+        case (Instruction::Mul):
+            return MulObfuscator::estimate(I, TTI);
+        case (Instruction::FAdd):
+            return oFloat? AddObfuscator::estimate(I, TTI): ObfuscationCost();
         case (Instruction::FSub):
-            return SubObfuscator::obfuscate(I);
+            return oFloat? SubObfuscator::estimate(I, TTI): ObfuscationCost();
+        case (Instruction::FMul):
+            return oFloat? MulObfuscator::estimate(I, TTI): ObfuscationCost();
+        default:
+            return ObfuscationCost();
+    }
+}
+
+namespace {
+
+// Obfuscates I, and tags the emitted code as a site with the opcode of I
+bool obfuscateSite(Instruction *I, bool oFloat, ObfuscationSiteMap *siteMap, ObfuscationRandom *random) {
+    ObfuscationSiteMap::Marker marker = ObfuscationSiteMap::mark(I);
+    std::string kind = I->getOpcodeName();
+    if(!(oFloat? ArithmeticObfuscation::obfuscateWithFloat(I, random): ArithmeticObfuscation::obfuscate(I, random)))
+        return false;
+    siteMap->tagSince(marker, DEBUG_TYPE, kind);
+    NumObfuscated++;
+    if(I->getType()->isFPOrFPVectorTy()) {
+        NumFloatObfuscated++;
+    }
+    return true;
+}
+
+// true if the instruction is handled by obfuscate (or obfuscateWithFloat)
+bool isObfuscated(Instruction *I, bool oFloat) {
+    switch(I->getOpcode()) {
+        case (Instruction::Add):
+        case (Instruction::Sub):
         case (Instruction::SDiv):
         case (Instruction::UDiv):
-            return DivObfuscator::obfuscate(I);
         case (Instruction::Mul):
+            return true;
+        case (Instruction::FAdd):
+        case (Instruction::FSub):
         case (Instruction::FMul):
-            return MulObfuscator::obfuscate(I);
+            return oFloat;
         default:
             return false;
     }
 }
 
-bool ArithmeticObfuscation::obfuscate(BasicBlock *BB, bool oFloat) {
-    bool modified = false;
+// true if obfuscate (or obfuscateWithFloat) changes I, the
+// vector operations are left as they are
+bool willObfuscate(Instruction *I, bool oFloat) {
+    Type *type = I->getType();
+    return isObfuscated(I, oFloat) && (type->isIntegerTy() || type->isFloatingPointTy());
+}
+
+/*____________________________________________________
+ *
+ * Instructions kept as they are with -arith-obfus-keep-scev:
+ * the add recurrences of the loops (induction variables,
+ * and the values derived from them, e.g. i*4+base) and
+ * the arithmetic computing the indices of the GEPs.
+ * Obfuscated, ScalarEvolution sees them as unknown values,
+ * and the trip counts, LSR, the vectorizer and the unroller
+ * give up on the loop. Found before the first iteration,
+ * the code emitted for the other instructions does not
+ * compute any of them.
+ *
+ * @return unsigned int, number of instructions kept
+ *____________________________________________________*/
+unsigned int findSCEVInstructions(Function &F, bool oFloat, ScalarEvolution &SE, 
+    OptimizationRemarkEmitter &ORE, SmallPtrSetImpl<Instruction*> &kept) {
+
+    auto emitKept = [&](Instruction *I, const char *reason) {
+        ORE.emit([&]() {
+            return OptimizationRemarkMissed(DEBUG_TYPE, "KeptForScalarEvolution", I)
+                << ore::NV("Opcode", I->getOpcodeName()) << " not obfuscated, " 
+                << reason << ", see -arith-obfus-keep-scev";
+        });
+    };
+
+    std::vector<Instruction*> worklist;
+    for(Instruction &I : instructions(F)) {
+        if(isObfuscated(&I, oFloat) && SE.isSCEVable(I.getType()) && 
+            SCEVExprContains(SE.getSCEV(&I), [](const SCEV *S) { return isa<SCEVAddRecExpr>(S); })) {
+            kept.insert(&I);
+            emitKept(&I, "part of an induction variable");
+        }
+        if(GetElementPtrInst *GEP = dyn_cast<GetElementPtrInst>(&I)) {
+            for(Value *index : GEP->indices()) {
+                if(Instruction *II = dyn_cast<Instruction>(index))
+                    worklist.push_back(II);
+            }
+        }
+    }
+
+    // Operands of the indices, through the integer arithmetic and
+    // casts, but not through the phis and loads
+    SmallPtrSet<Instruction*, 32> visited;
+    while(!worklist.empty()) {
+        Instruction *I = worklist.back();
+        worklist.pop_back();
+        if(!I->getType()->isIntegerTy() || !(isa<BinaryOperator>(I) || isa<SExtInst>(I) || 
+            isa<ZExtInst>(I) || isa<TruncInst>(I)) || !visited.insert(I).second)
+            continue;
+        if(isObfuscated(I, oFloat) && kept.insert(I).second) {
+            emitKept(I, "computes an address");
+        }
+        for(Value *operand : I->operands()) {
+            if(Instruction *OI = dyn_cast<Instruction>(operand))
+                worklist.push_back(OI);
+        }
+    }
+    NumKeptForSCEV += kept.size();
+    return kept.size();
+}
+
+/*____________________________________________________
+ *
+ * Moves the instructions about to be obfuscated whose
+ * operands are invariant in their loop to the preheader of the
+ * outermost loop in which they are invariant, so that the
+ * code emitted for them runs once per entry of the loop
+ * instead of every iteration. LICM cannot hoist it after,
+ * as it has blocks, loops (Mul) and allocas of its own.
+ * Only the instructions safe to speculate are moved, not
+ * a division by a value which can be zero. The blocks are
+ * visited in reverse post order, hence an instruction
+ * using only moved instructions is moved too. The other
+ * instructions are left to LICM.
+ *
+ * @param SmallPtrSetImpl<Instruction*> &toObfuscate, the
+ *        instructions which will be obfuscated
+ * @return unsigned int, number of instructions moved
+ *____________________________________________________*/
+unsigned int hoistLoopInvariants(Function &F, LoopInfo &LI, OptimizationRemarkEmitter &ORE, 
+    const SmallPtrSetImpl<Instruction*> &toObfuscate) {
+
+    unsigned int hoisted = 0;
+    ReversePostOrderTraversal<Function*> RPOT(&F);
+    for(BasicBlock *BB : RPOT) {
+        Loop *L = LI.getLoopFor(BB);
+        if(L == nullptr)
+            continue;
+        std::vector<Instruction*> candidates;
+        for(Instruction &I : *BB) {
+            if(toObfuscate.count(&I) && isSafeToSpeculativelyExecute(&I))
+                candidates.push_back(&I);
+        }
+        for(Instruction *I : candidates) {
+            Loop *target = nullptr;
+            unsigned int loops = 0;
+            for(Loop *outer = L; outer != nullptr && outer->hasLoopInvariantOperands(I); 
+                outer = outer->getParentLoop()) {
+                loops++;
+                if(outer->getLoopPreheader() != nullptr)
+                    target = outer;
+            }
+            if(target == nullptr)
+                continue;
+            I->moveBefore(target->getLoopPreheader()->getTerminator());
+            hoisted++;
+            ORE.emit([&]() {
+                return OptimizationRemark(DEBUG_TYPE, "Hoisted", I)
+                    << ore::NV("Opcode", I->getOpcodeName()) 
+                    << " moved out of " << ore::NV("Loops", loops) << " loops before obfuscation";
+            });
+        }
+    }
+    NumHoisted += hoisted;
+    return hoisted;
+}
+
+/*____________________________________________________
+ *
+ * Same as ArithmeticObfuscation::obfuscate on every block, but
+ * obfuscates only the instructions selected by the cost model.
+ * With LI (first iteration, -arith-obfus-hoist) the selected
+ * ones are moved out of their loops first, their latency is
+ * estimated in the loop, hence over estimated.
+ *
+ * @return unsigned int, number of instructions obfuscated
+ *____________________________________________________*/
+unsigned int obfuscateInBudget(Function &F, std::vector<BasicBlock*> &blocks, bool oFloat, 
+    ObfuscationCostModel &costModel, ObfuscationSiteMap *siteMap, const TargetTransformInfo *TTI, 
+    OptimizationRemarkEmitter &ORE, const SmallPtrSetImpl<Instruction*> &kept, 
+    LoopInfo *LI, unsigned int &hoisted, ObfuscationRandom &random) {
+
+    // Frequencies of the function as it is now, as 
+    // previous iterations have added blocks
+    ObfuscationUtils::FunctionFrequency frequencies(F);
+    BlockFrequencyInfo *BFI = &frequencies.BFI;
+    costModel.addFunction(F, TTI, BFI);
+
+    std::vector<Instruction*> toObfuscate;
+    std::vector<ObfuscationCandidate> candidates;
+    for(BasicBlock *BB : blocks) {
+        double frequency = ObfuscationUtils::getRelativeFrequency(BB, BFI);
+        for(Instruction &I : *BB) {
+            if(isObfuscated(&I, oFloat) && !kept.count(&I)) {
+                ObfuscationCost cost = ArithmeticObfuscation::estimate(&I, oFloat, TTI);
+                cost.latency *= frequency;
+                toObfuscate.push_back(&I);
+                candidates.push_back(ObfuscationCandidate(cost, &F));
+            }
+        }
+    }
+    std::vector<bool> selected = costModel.select(DEBUG_TYPE, candidates);
+    if(costModel.isDryRun()) {
+        return 0;
+    }
+
+    if(LI != nullptr) {
+        SmallPtrSet<Instruction*, 32> toHoist;
+        for(unsigned int i=0; i<toObfuscate.size(); i++) {
+            if(selected[i] && willObfuscate(toObfuscate[i], oFloat))
+                toHoist.insert(toObfuscate[i]);
+        }
+        hoisted += hoistLoopInvariants(F, *LI, ORE, toHoist);
+    }
+
+    std::vector<Instruction *> toErase;
+    for(unsigned int i=0; i<toObfuscate.size(); i++) {
+        Instruction *I = toObfuscate[i];
+        if(!selected[i]) {
+            NumOverBudget++;
+            ORE.emit([&]() {
+                return OptimizationRemarkMissed(DEBUG_TYPE, "OverObfuscationBudget", I)
+                    << ore::NV("Opcode", I->getOpcodeName()) 
+                    << " not obfuscated, over the budget of -obf-size-budget/-obf-latency-budget";
+            });
+            continue;
+        }
+        if(obfuscateSite(I, oFloat, siteMap, &random)) {
+            toErase.push_back(I);
+        }
+    }
+    for(Instruction *I: toErase) {
+        I->eraseFromParent();
+    }
+    return toErase.size();
+}
+
+} /* namespace */
+
+unsigned int ArithmeticObfuscation::obfuscate(BasicBlock *BB, bool oFloat, ObfuscationSiteMap *siteMap, 
+    const SmallPtrSetImpl<Instruction*> *kept, ObfuscationRandom *random) {
     std::vector<Instruction *> toIterateInst;
     std::vector<Instruction *> toErase;
     // Instructions after this will get moved from the block for
@@ -55,25 +332,17 @@ bool ArithmeticObfuscation::obfuscate(BasicBlock *BB, bool oFloat) {
     for(Instruction &I : *BB) {
         toIterateInst.push_back(&I);
     }
-    if(oFloat) {
-        for(Instruction *I : toIterateInst) {
-            if(obfuscateWithFloat(I)) {
-                modified = true;
-                toErase.push_back(I);
-            }
-        }
-    } else {
-        for(Instruction *I : toIterateInst) {
-            if(obfuscate(I)) {
-                modified = true;
-                toErase.push_back(I);
-            }
+    for(Instruction *I : toIterateInst) {
+        if(kept != nullptr && kept->count(I))
+            continue;
+        if(obfuscateSite(I, oFloat, siteMap, random)) {
+            toErase.push_back(I);
         }
     }
     for(Instruction *I: toErase) {
         I->eraseFromParent();
     }
-    return modified;
+    return toErase.size();
 }
 
 bool ArithmeticObfuscation::runOnFunction(Function &F) {
@@ -91,9 +360,57 @@ bool ArithmeticObfuscation::runOnFunction(Function &F) {
         nIter = 3;
     }
 
-    bool modified = false;
+    // Budget shared with the other obfuscation passes
+    ObfuscationCostModel &costModel = getAnalysis<ObfuscationCostModel>();
+    ObfuscationSiteMap *siteMap = &getAnalysis<ObfuscationSiteMap>();
+    const TargetTransformInfo &TTI = getAnalysis<TargetTransformInfoWrapperPass>().getTTI(F);
+    OptimizationRemarkEmitter &ORE = getAnalysis<OptimizationRemarkEmitterWrapperPass>().getORE();
+
+    // Output of a previous run of the pass (e.g. before LTO)
+    unsigned int layers = ObfuscationUtils::getLayers(&F, DEBUG_TYPE);
+    if(!ObfuscationUtils::isSelected(&F))
+        return false;
+    if(!ObfuscationUtils::canObfuscate(&F, DEBUG_TYPE)) {
+        NumAlreadyObfuscated++;
+        ORE.emit(OptimizationRemarkMissed(DEBUG_TYPE, "AlreadyObfuscated", F.getSubprogram(), &F.getEntryBlock())
+            << "function already obfuscated " << ore::NV("Layers", layers) << " times, see -obf-max-layers");
+        return false;
+    }
+    Function *backup = costModel.hasBudget()? costModel.checkpoint(F): nullptr;
+
+    // The result depends only on F without a budget and the site map
+    std::string cacheKey;
+    if(ObfuscationCache::isEnabled() && !costModel.needsEstimates() && !siteMap->isEnabled()) {
+        cacheKey = ObfuscationCache::getKey(F, DEBUG_TYPE, 
+            ("iter=" + Twine(nIter) + " float=" + (obfusFloat? "1": "0") + " layers=" + Twine(layers) + 
+             " keep-scev=" + (keepSCEV? "1": "0") + " hoist=" + (hoistInvariants? "1": "0")).str());
+        if(!cacheKey.empty() && ObfuscationCache::load(F, cacheKey)) {
+            ORE.emit(OptimizationRemark(DEBUG_TYPE, "Cached", F.getSubprogram(), &F.getEntryBlock())
+                << "obfuscated function loaded from -obf-cache-dir");
+            return true;
+        }
+    }
+
+    // Induction variables and addresses, before the CFG changes
+    SmallPtrSet<Instruction*, 32> kept;
+    if(keepSCEV) {
+        ScalarEvolution &SE = getAnalysis<ScalarEvolutionWrapperPass>().getSE();
+        findSCEVInstructions(F, obfusFloat, SE, ORE, kept);
+    }
+    // Loops of F, valid till the code emitted by the first iteration
+    // changes the CFG, hence invariants are moved in the first one only
+    LoopInfo *LI = hoistInvariants? &getAnalysis<LoopInfoWrapperPass>().getLoopInfo(): nullptr;
+    unsigned int hoisted = 0;
+
+    // Chooses among the rewrites of every add and sub, seeded from
+    // -obf-seed, the variant and F, hence in the cache key
+    ObfuscationRandom random(DEBUG_TYPE, F.getName());
+
+    unsigned int obfuscated = 0;
     for(int i=0; i<nIter; i++) {
-        bool iterModified = false;
+        NamedRegionTimer T("iteration", "ArithmeticObfuscation iteration", 
+            ObfuscationUtils::TIMER_GROUP, ObfuscationUtils::TIMER_GROUP_DESCRIPTION, TimePassesIsEnabled);
+        unsigned int iterObfuscated = 0;
         // original instruction which got obfuscated
         std::vector<BasicBlock*> toIterate;
         for(BasicBlock &BB : F) {
@@ -101,22 +418,69 @@ bool ArithmeticObfuscation::runOnFunction(Function &F) {
         }
         // Consider only existing basic blocks
         // Ignore basic blocks which have been created due to obfuscate call
-        for(BasicBlock *BB : toIterate) {
-            iterModified = obfuscate(BB, obfusFloat) || iterModified; 
+        // With dry run only the first iteration is estimated, 
+        // as nothing is obfuscated for the next one
+        if(costModel.needsEstimates()) {
+            iterObfuscated = obfuscateInBudget(F, toIterate, obfusFloat, costModel, siteMap, &TTI, ORE, kept, 
+                i == 0? LI: nullptr, hoisted, random);
+        } else {
+            if(i == 0 && LI != nullptr) {
+                SmallPtrSet<Instruction*, 32> toHoist;
+                for(Instruction &I : instructions(F)) {
+                    if(willObfuscate(&I, obfusFloat) && !kept.count(&I))
+                        toHoist.insert(&I);
+                }
+                hoisted = hoistLoopInvariants(F, *LI, ORE, toHoist);
+            }
+            for(BasicBlock *BB : toIterate) {
+                iterObfuscated += obfuscate(BB, obfusFloat, siteMap, &kept, &random); 
+            }
         }
-        if(iterModified) {
-            modified = true;
+        if(iterObfuscated > 0) {
+            obfuscated += iterObfuscated;
+            ORE.emit(OptimizationRemark(DEBUG_TYPE, "Obfuscated", F.getSubprogram(), &F.getEntryBlock())
+                << ore::NV("Instructions", iterObfuscated) << " instructions obfuscated in iteration " 
+                << ore::NV("Iteration", i+1));
         } else {
             // if nothing was modified in this iteration
             // then no use of going to next iteration
             break;
         }
     }
-    return modified;
+
+    // Rolled back if the function is over the size budget
+    if(!costModel.commit(F, backup)) {
+        NumRolledBack++;
+        ORE.emit(OptimizationRemarkMissed(DEBUG_TYPE, "RolledBack", F.getSubprogram(), &F.getEntryBlock())
+            << ore::NV("Instructions", obfuscated) 
+            << " obfuscated instructions restored, function over the budget of -obf-size-budget/-obf-latency-budget");
+    } else if(obfuscated > 0) {
+        ObfuscationUtils::setLayers(&F, DEBUG_TYPE, layers+1);
+    }
+    if(!cacheKey.empty()) {
+        ObfuscationCache::store(F, cacheKey);
+    }
+    return obfuscated > 0 || hoisted > 0;
+}
+
+void ArithmeticObfuscation::getAnalysisUsage(AnalysisUsage &AU) const {
+    AU.addRequired<TargetTransformInfoWrapperPass>();
+    AU.addRequired<OptimizationRemarkEmitterWrapperPass>();
+    AU.addRequired<ObfuscationCostModel>();
+    AU.addRequired<ObfuscationSiteMap>();
+    if(hoistInvariants) {
+        AU.addRequired<LoopInfoWrapperPass>();
+    }
+    if(keepSCEV) {
+        AU.addRequired<ScalarEvolutionWrapperPass>();
+    }
 }
 
 // Registering the pass
 char ArithmeticObfuscation::ID = 0;
 static RegisterPass<ArithmeticObfuscation> X("arith-obfus", "Obfuscates arithmetic operations");
+// Added to the standard pipeline with -obf-extension-point
+static ObfuscationPipeline::Registration Y(ObfuscationPipeline::ArithmeticObfuscationOrder, 
+    []() -> Pass* { return new ArithmeticObfuscation(); });
 
 #undef DEBUG_TYPE
@@ -10,7 +10,7 @@ void ArithmeticObfuscationUtils::floatObfuscator(
 
     Value* a = I->getOperand(0);
     Value* b = I->getOperand(1);
-    static LLVMContext& context = I->getParent()->getContext();
+    LLVMContext& context = I->getParent()->getContext();
 
     // type of float of this instruction
     Type* floatType = a->getType();
@@ -44,8 +44,10 @@ void ArithmeticObfuscationUtils::floatObfuscator(
     Value* ifcond1 = conditionBuilder.CreateAnd(aCond1, aCond2);
     Value* ifcond2 = conditionBuilder.CreateAnd(bCond1, bCond2);
     Value* ifcond = conditionBuilder.CreateAnd(ifcond1, ifcond2);
-    Value* result = conditionBuilder.CreateAlloca(floatType);
-    conditionBuilder.CreateCondBr(ifcond, ifThenBB, ifElseBB);
+    // if.else is the slow path, taken only for large values
+    BranchInst *guard = conditionBuilder.CreateCondBr(ifcond, ifThenBB, ifElseBB);
+    ObfuscationUtils::setBranchWeights(guard, 
+        ObfuscationUtils::LIKELY_WEIGHT, ObfuscationUtils::UNLIKELY_WEIGHT);
 
     /** if.then **/
     IRBuilder<> ifThenBuilder(ifThenBB);
@@ -64,22 +66,24 @@ void ArithmeticObfuscationUtils::floatObfuscator(
     Value *bYY = ifThenBuilder.CreateFSub(b,bXXFloat);
     
     Value *ifThenResult = ifThenCaller(&ifThenBuilder, floatType, aXX, bXX, aYY, bYY, aXXFloat, bXXFloat);
-    ifThenBuilder.CreateStore(ifThenResult, result);
     ifThenBuilder.CreateBr(ifEndBB);
     
     /** if.else **/
     IRBuilder<> ifElseBuilder(ifElseBB);
     Value* ifElseResult = ifElseCaller(&ifElseBuilder, a, b);
-    ifElseBuilder.CreateStore(ifElseResult, result);
     ifElseBuilder.CreateBr(ifEndBB);
 
     /** if.end **/
+    // result of either branch, in a register, as an alloca 
+    // here would grow the frame if I is in a loop
     IRBuilder<> ifEndBuilder(ifEndBB);
-    Value *resultLoad = ifEndBuilder.CreateLoad(result);
+    PHINode *resultPhi = ifEndBuilder.CreatePHI(floatType, 2);
+    resultPhi->addIncoming(ifThenResult, ifThenBuilder.GetInsertBlock());
+    resultPhi->addIncoming(ifElseResult, ifElseBuilder.GetInsertBlock());
 
     // moving all instruction after I from original block
     // to if.end, after the phi instruction
-    Instruction* next = dyn_cast<Instruction>(resultLoad);
+    Instruction* next = dyn_cast<Instruction>(resultPhi);
     std::vector<Instruction *> toMove;
     while(toMoveInst != nullptr) {
         toMove.push_back(toMoveInst);
@@ -91,6 +95,38 @@ void ArithmeticObfuscationUtils::floatObfuscator(
             next = II;
     }
 
-    I->replaceAllUsesWith(resultLoad);
+    I->replaceAllUsesWith(resultPhi);
 
 }
+
+ObfuscationCost ArithmeticObfuscationUtils::estimateFloat(Instruction *I, 
+    ArrayRef<unsigned int> ifThenOpcodes, const TargetTransformInfo *TTI) {
+    Type *floatType = I->getType();
+    if(!floatType->isFloatingPointTy())
+        return ObfuscationCost();
+    // range check of a and b and the branch
+    ObfuscationCost cost = ObfuscationUtils::getReplacementCost({Instruction::FCmp, Instruction::FCmp, 
+        Instruction::FCmp, Instruction::FCmp, Instruction::And, Instruction::And, Instruction::And, 
+        Instruction::Br}, {I->getOpcode()}, floatType, TTI);
+    // if.then, int64(a), float(int64(a)), a - float(int64(a)), same for b
+    cost += ObfuscationUtils::getReplacementCost({Instruction::FPToSI, Instruction::SIToFP, 
+        Instruction::FSub, Instruction::FPToSI, Instruction::SIToFP, Instruction::FSub, 
+        Instruction::Br}, {}, floatType, TTI);
+    cost += ObfuscationUtils::getReplacementCost(ifThenOpcodes, {}, floatType, TTI);
+    // if.end, the phi of the result
+    cost.size += 1;
+    // if.else is taken only for large values, hence only its size is added
+    cost.size += 2;
+    // if.then, if.else and if.end
+    cost.blocks = 3;
+    return cost;
+}
+
+ObfuscationCost ArithmeticObfuscationUtils::getCostliest(ArrayRef<ObfuscationCost> costs) {
+    ObfuscationCost costliest = costs.front();
+    for(const ObfuscationCost &cost : costs) {
+        if(cost.cycles > costliest.cycles)
+            costliest = cost;
+    }
+    return costliest;
+}
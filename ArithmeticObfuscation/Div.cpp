@@ -3,7 +3,7 @@
 #include "ArithmeticObfuscation/ArithmeticObfuscation.h"
 using namespace llvm;
 
-bool DivObfuscator::obfuscate(Instruction *I) {
+bool DivObfuscator::obfuscate(Instruction *I, ObfuscationRandom *random) {
     if(I->getOpcode() != Instruction::SDiv && I->getOpcode() != Instruction::UDiv)
         return false;
 
@@ -40,3 +40,12 @@ bool DivObfuscator::obfuscate(Instruction *I) {
     I->replaceAllUsesWith(final);
     return true;
 }
+
+ObfuscationCost DivObfuscator::estimate(Instruction *I, const TargetTransformInfo *TTI) {
+    if(I->getOpcode() != Instruction::SDiv && I->getOpcode() != Instruction::UDiv)
+        return ObfuscationCost();
+    // (Dividend - Remainder)/Divisor
+    unsigned int rem = I->getOpcode() == Instruction::SDiv? Instruction::SRem: Instruction::URem;
+    return ObfuscationUtils::getReplacementCost({rem, Instruction::Mul, Instruction::Add, I->getOpcode()}, 
+        {I->getOpcode()}, I->getType(), TTI);
+}
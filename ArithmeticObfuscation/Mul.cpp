@@ -4,6 +4,16 @@
 
 namespace {
 
+// The loop runs log2(multiplier) times, 
+// half the bits if the multiplier is not known
+double estimateIterations(Instruction *I) {
+	double iterations = I->getType()->getIntegerBitWidth() / 2;
+	if(ConstantInt *CI = dyn_cast<ConstantInt>(I->getOperand(1))) {
+		iterations = CI->getValue().isStrictlyPositive()? CI->getValue().logBase2(): 0;
+	}
+	return iterations;
+}
+
 bool obfuscateInteger(Instruction *I) {
 	if(I->getOpcode() != Instruction::Mul)
 			return false;
@@ -25,14 +35,16 @@ bool obfuscateInteger(Instruction *I) {
 		vmultiplier = (dyn_cast<LoadInst>(vmultiplier)->getOperand(0));
 		isMultiplierLoad = true;
 	}
-	static LLVMContext& Context = I->getParent()->getContext();
+	LLVMContext& Context = I->getParent()->getContext();
 
 	IRBuilder<> Builder(I);
 	//i=1; j=0; temp=multiplier;
-	auto* allocaj = Builder.CreateAlloca(type);
-	auto* allocai = Builder.CreateAlloca(type);
-	auto* allocaTemp = Builder.CreateAlloca(type);
-	auto* allocak = Builder.CreateAlloca(type);
+	//allocated in the entry block, the multiply can be in a loop
+	Function *F = I->getParent()->getParent();
+	auto* allocaj = ObfuscationUtils::createEntryBlockAlloca(F, type);
+	auto* allocai = ObfuscationUtils::createEntryBlockAlloca(F, type);
+	auto* allocaTemp = ObfuscationUtils::createEntryBlockAlloca(F, type);
+	auto* allocak = ObfuscationUtils::createEntryBlockAlloca(F, type);
 	Builder.CreateStore(ConstantInt::get(type,0),allocaj);
 	Builder.CreateStore(ConstantInt::get(type,1),allocai);
 	Builder.CreateStore(vmultiplierLoad,allocaTemp);
@@ -51,7 +63,9 @@ bool obfuscateInteger(Instruction *I) {
 	auto* icmpgt1 = BuilderHeader.CreateICmpSGT(loadMultiplier,ConstantInt::get(type,1));
 	auto* bbTrue = BasicBlock::Create(Context,"true",I->getParent()->getParent());
 	auto* bbFalse = BasicBlock::Create(Context,"false",I->getParent()->getParent());
-	BuilderHeader.CreateCondBr(icmpgt1,bbTrue,bbFalse);
+	auto* loopBranch = BuilderHeader.CreateCondBr(icmpgt1,bbTrue,bbFalse);
+	//the loop is left once
+	ObfuscationUtils::setBranchWeights(loopBranch, estimateIterations(I), 1);
 	//True block
 	//temp = temp>>1
 	IRBuilder<> BuilderTrue(bbTrue);
@@ -154,7 +168,7 @@ bool obfuscateFloat(Instruction *I) {
 } /* namespace */
 
 
-bool MulObfuscator::obfuscate(Instruction *I) {
+bool MulObfuscator::obfuscate(Instruction *I, ObfuscationRandom *random) {
     if(I->getOpcode() == Instruction::Mul) {
         return obfuscateInteger(I);
     } else if (I->getOpcode() == Instruction::FMul) {
@@ -162,4 +176,41 @@ bool MulObfuscator::obfuscate(Instruction *I) {
     } else {
         return false;
     }
-}
\ No newline at end of file
+}
+
+ObfuscationCost MulObfuscator::estimate(Instruction *I, const TargetTransformInfo *TTI) {
+	if(I->getOpcode() == Instruction::FMul) {
+		return ArithmeticObfuscationUtils::estimateFloat(I, 
+			{Instruction::Mul, Instruction::SIToFP, Instruction::FMul, Instruction::FAdd, 
+			 Instruction::FMul, Instruction::FMul, Instruction::FAdd, Instruction::FAdd}, TTI);
+	}
+	if(I->getOpcode() != Instruction::Mul || !I->getType()->isIntegerTy())
+		return ObfuscationCost();
+	Type *type = I->getType();
+
+	// initial values of i, j and temp
+	ObfuscationCost cost = ObfuscationUtils::getReplacementCost({Instruction::Store, Instruction::Store, 
+		Instruction::Store, Instruction::Br}, {Instruction::Mul}, type, TTI);
+	// i, j, temp and k, allocated in the entry block, not run per multiply
+	cost.size += 4;
+	// while(temp > 1), once more than the loop body
+	ObfuscationCost header = ObfuscationUtils::getReplacementCost({Instruction::Load, 
+		Instruction::ICmp, Instruction::Br}, {}, type, TTI);
+	// temp = temp>>1, j = j+1, i = i<<1
+	ObfuscationCost body = ObfuscationUtils::getReplacementCost({Instruction::Load, Instruction::AShr, 
+		Instruction::Store, Instruction::Load, Instruction::Add, Instruction::Store, Instruction::Load, 
+		Instruction::Shl, Instruction::Store, Instruction::Br}, {}, type, TTI);
+	// i = multiplier - i, k = i*multiplicand, (multiplicand<<j) + k
+	cost += ObfuscationUtils::getReplacementCost({Instruction::Load, Instruction::Sub, Instruction::Store, 
+		Instruction::Load, Instruction::Mul, Instruction::Store, Instruction::Load, Instruction::Shl, 
+		Instruction::Load, Instruction::Add}, {}, type, TTI);
+
+	double iterations = estimateIterations(I);
+	cost.size += header.size + body.size;
+	cost.memoryOps += header.memoryOps + body.memoryOps;
+	cost.cycles += header.cycles * (iterations + 1) + body.cycles * iterations;
+	cost.latency = cost.cycles;
+	// header, true and false blocks
+	cost.blocks = 3;
+	return cost;
+}
@@ -0,0 +1,390 @@
+#include "llvm/Pass.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/CFG.h"
+#include "llvm/ADT/MapVector.h"
+#include "llvm/ADT/SetVector.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/TargetTransformInfo.h"
+#include "llvm/Analysis/OptimizationRemarkEmitter.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/CodeExtractor.h"
+#include "llvm/Transforms/Utils/FunctionComparator.h"
+#include "ObfuscationUtils/ObfuscationUtils.h"
+#include "ArithmeticObfuscation/ArithmeticObfuscation.h"
+using namespace llvm;
+
+#define DEBUG_TYPE "obf-outline"
+
+STATISTIC(NumOutlined, "Sequences outlined");
+STATISTIC(NumHot, "Sequences kept inline, in a hot block");
+STATISTIC(NumTooSmall, "Sequences kept inline, cheaper than a call");
+STATISTIC(NumNotOutlinable, "Sequences kept inline, not a single entry and exit region");
+STATISTIC(NumShared, "Outlined functions shared by many sequences");
+STATISTIC(NumInlinedBack, "Outlined functions inlined back, with a single call");
+
+cl::opt<double> hotFrequency("obf-outline-hot-frequency",
+    cl::desc("Relative frequency of the blocks whose obfuscated code is kept inline (default 4)"),
+    cl::init(4.0));
+cl::opt<int> minSaving("obf-outline-min-saving",
+    cl::desc("Min TTI size saved by the call for a sequence to be outlined (default 2)"),
+    cl::init(2));
+
+namespace {
+
+// Pass whose code is outlined
+const char *PASS = "arith-obfus";
+
+/*____________________________________________________
+ *
+ * Code emitted for one instruction of the input, by all
+ * the iterations of -arith-obfus, and its region:
+ *
+ * in one block, [first, last], split in a block of its own
+ *
+ * in many blocks (float guards, multiplication loops),
+ * the tail of head from first to its terminator, the
+ * blocks with only code of the sequence, and the exit,
+ * where the region is left, whose phis get a block of
+ * their own in the region
+ *____________________________________________________*/
+struct Sequence {
+    unsigned int site;
+    std::vector<Instruction*> instructions;
+    BasicBlock *head = nullptr;
+    Instruction *first = nullptr;
+    Instruction *last = nullptr;
+    std::vector<BasicBlock*> blocks;
+    BasicBlock *exit = nullptr;
+};
+
+// Site of the first iteration, whose code has the code of the later ones
+unsigned int getRootSite(ObfuscationSiteMap &siteMap, unsigned int site) {
+    while(siteMap.getParent(site) != 0 && siteMap.getPass(siteMap.getParent(site)) == PASS) {
+        site = siteMap.getParent(site);
+    }
+    return site;
+}
+
+// false if the sequence is not a region with a single entry and exit
+bool findRegion(Sequence &sequence) {
+    SmallPtrSet<Instruction*, 32> inSequence(sequence.instructions.begin(), sequence.instructions.end());
+    MapVector<BasicBlock*, unsigned int> counts;
+    for(Instruction *I : sequence.instructions) {
+        counts[I->getParent()]++;
+    }
+    std::vector<BasicBlock*> partial;
+    for(auto &it : counts) {
+        if(it.second == it.first->size()) {
+            sequence.blocks.push_back(it.first);
+        } else {
+            partial.push_back(it.first);
+        }
+    }
+
+    if(sequence.blocks.empty()) {
+        // In one block, without the terminator
+        if(partial.size() != 1)
+            return false;
+        BasicBlock *BB = partial[0];
+        unsigned int inRange = 0;
+        for(Instruction &I : *BB) {
+            if(inSequence.count(&I) == 0)
+                continue;
+            if(sequence.first == nullptr)
+                sequence.first = &I;
+            sequence.last = &I;
+        }
+        for(Instruction *I = sequence.first; I != sequence.last->getNextNode(); I = I->getNextNode()) {
+            if(inSequence.count(I) == 0 || isa<PHINode>(I) || I->isEHPad() || isa<TerminatorInst>(I))
+                return false;
+            inRange++;
+        }
+        sequence.head = BB;
+        return inRange == counts[BB];
+    }
+
+    for(BasicBlock *BB : partial) {
+        if(inSequence.count(BB->getTerminator())) {
+            if(sequence.head != nullptr)
+                return false;
+            sequence.head = BB;
+        } else {
+            if(sequence.exit != nullptr)
+                return false;
+            sequence.exit = BB;
+        }
+    }
+    if(sequence.head == nullptr)
+        return false;
+    // A tail of the head, split before its first instruction
+    unsigned int tail = 0;
+    for(Instruction *I = sequence.head->getTerminator(); I != nullptr && inSequence.count(I); I = I->getPrevNode()) {
+        sequence.first = I;
+        tail++;
+    }
+    if(tail != counts[sequence.head] || isa<PHINode>(sequence.first) || sequence.first->isEHPad())
+        return false;
+    // A prefix of the exit, the phis of the result
+    if(sequence.exit != nullptr) {
+        unsigned int prefix = 0;
+        for(Instruction &I : *sequence.exit) {
+            if(inSequence.count(&I) == 0)
+                break;
+            prefix++;
+        }
+        if(prefix != counts[sequence.exit])
+            return false;
+    }
+
+    // Single entry, the head, and single exit block
+    SmallPtrSet<BasicBlock*, 8> region(sequence.blocks.begin(), sequence.blocks.end());
+    region.insert(sequence.head);
+    BasicBlock *exit = nullptr;
+    for(BasicBlock *BB : region) {
+        if(BB != sequence.head) {
+            for(BasicBlock *pred : predecessors(BB)) {
+                if(region.count(pred) == 0)
+                    return false;
+            }
+        }
+        for(BasicBlock *succ : successors(BB)) {
+            if(region.count(succ) == 0) {
+                if(exit != nullptr && exit != succ)
+                    return false;
+                exit = succ;
+            }
+        }
+    }
+    if(exit == nullptr || (sequence.exit != nullptr && exit != sequence.exit))
+        return false;
+    sequence.exit = exit;
+    return true;
+}
+
+/*____________________________________________________
+ *
+ * TTI size saved by outlining the sequence: the size of
+ * its code less the call, its arguments, and the store
+ * and load of every result
+ *____________________________________________________*/
+int getSaving(Sequence &sequence, const TargetTransformInfo *TTI) {
+    SmallPtrSet<Instruction*, 32> inSequence(sequence.instructions.begin(), sequence.instructions.end());
+    SetVector<Value*> inputs;
+    unsigned int outputs = 0;
+    int size = 0;
+    for(Instruction *I : sequence.instructions) {
+        // phis of the exit are results, they stay in the caller
+        if(I->getParent() == sequence.exit) {
+            outputs++;
+            continue;
+        }
+        size += TTI->getUserCost(I);
+        for(Value *operand : I->operands()) {
+            Instruction *operandI = dyn_cast<Instruction>(operand);
+            if((operandI != nullptr && inSequence.count(operandI) == 0) || isa<Argument>(operand))
+                inputs.insert(operand);
+        }
+        for(User *user : I->users()) {
+            if(inSequence.count(cast<Instruction>(user)) == 0) {
+                outputs++;
+                break;
+            }
+        }
+    }
+    int call = TargetTransformInfo::TCC_Basic * (1 + inputs.size() + 2*outputs);
+    return size - call;
+}
+
+// Replaces the region of the sequence with a call, nullptr if it cannot.
+// The head is split at first where it is now: outlining an earlier
+// sequence of the same block moves the rest of the block, with first,
+// to a new block
+Function *outline(Sequence &sequence) {
+    std::vector<BasicBlock*> region;
+    BasicBlock *head = sequence.first->getParent();
+    if(sequence.blocks.empty()) {
+        BasicBlock *BB = SplitBlock(head, sequence.first);
+        SplitBlock(BB, sequence.last->getNextNode());
+        region.push_back(BB);
+    } else {
+        // The first block is the entry of the region
+        region.push_back(SplitBlock(head, sequence.first));
+        region.insert(region.end(), sequence.blocks.begin(), sequence.blocks.end());
+        // The result comes from many blocks, merged in the region
+        SmallPtrSet<BasicBlock*, 8> inRegion(region.begin(), region.end());
+        SetVector<BasicBlock*> preds;
+        for(BasicBlock *pred : predecessors(sequence.exit)) {
+            if(inRegion.count(pred))
+                preds.insert(pred);
+        }
+        region.push_back(SplitBlockPredecessors(sequence.exit, preds.getArrayRef(), ".obf.outline"));
+    }
+    CodeExtractor extractor(region);
+    if(!extractor.isEligible())
+        return nullptr;
+    return extractor.extractCodeRegion();
+}
+
+// Body shared by many sites, hence in none, and without the
+// locations of the caller, whose subprogram it is not in
+void prepareShared(Function *outlined, StringRef kind) {
+    std::vector<Instruction*> toErase;
+    for(BasicBlock &BB : *outlined) {
+        for(Instruction &I : BB) {
+            if(isa<DbgInfoIntrinsic>(&I)) {
+                toErase.push_back(&I);
+                continue;
+            }
+            I.setDebugLoc(DebugLoc());
+            I.setMetadata("obf.site", nullptr);
+        }
+    }
+    for(Instruction *I : toErase) {
+        I->eraseFromParent();
+    }
+    outlined->setName("obf.outlined." + kind);
+    // Else inlined again by the optimizations after
+    outlined->addFnAttr(Attribute::NoInline);
+}
+
+} /* namespace */
+
+ObfuscationOutliner::ObfuscationOutliner(): ModulePass(ID) {}
+
+bool ObfuscationOutliner::runOnModule(Module &M) {
+    ObfuscationSiteMap &siteMap = getAnalysis<ObfuscationSiteMap>();
+    std::vector<Function*> functions;
+    for(Function &F : M) {
+        if(!F.isDeclaration())
+            functions.push_back(&F);
+    }
+
+    // With the root site of their sequence
+    std::vector<std::pair<Function*, unsigned int>> outlinedFunctions;
+    for(Function *F : functions) {
+        // Sequences by the site of their first iteration, in order
+        MapVector<unsigned int, Sequence> sequences;
+        for(BasicBlock &BB : *F) {
+            for(Instruction &I : BB) {
+                unsigned int site = ObfuscationSiteMap::getSite(&I);
+                // Sites of an earlier run, kept in the bitcode, are not in the map
+                if(site == 0 || site > siteMap.getNumSites() || siteMap.getPass(site) != PASS)
+                    continue;
+                Sequence &sequence = sequences[getRootSite(siteMap, site)];
+                sequence.site = getRootSite(siteMap, site);
+                sequence.instructions.push_back(&I);
+            }
+        }
+        if(sequences.empty())
+            continue;
+
+        // Selected before the CFG is changed by outlining
+        const TargetTransformInfo &TTI = getAnalysis<TargetTransformInfoWrapperPass>().getTTI(*F);
+        ObfuscationUtils::FunctionFrequency frequencies(*F);
+        std::vector<Sequence*> selected;
+        for(auto &it : sequences) {
+            Sequence &sequence = it.second;
+            if(!findRegion(sequence)) {
+                NumNotOutlinable++;
+            } else if(ObfuscationUtils::getRelativeFrequency(sequence.head, &frequencies.BFI) > hotFrequency) {
+                NumHot++;
+            } else if(getSaving(sequence, &TTI) < minSaving) {
+                NumTooSmall++;
+            } else {
+                selected.push_back(&sequence);
+            }
+        }
+
+        unsigned int outlined = 0;
+        for(Sequence *sequence : selected) {
+            Function *function = outline(*sequence);
+            if(function == nullptr) {
+                NumNotOutlinable++;
+                continue;
+            }
+            // The call stands for the site in the caller
+            siteMap.tag(sequence->site, cast<Instruction>(function->user_back()));
+            outlinedFunctions.push_back(std::make_pair(function, sequence->site));
+            outlined++;
+        }
+        NumOutlined += outlined;
+        if(outlined > 0) {
+            OptimizationRemarkEmitter ORE(F);
+            ORE.emit(OptimizationRemark(DEBUG_TYPE, "Outlined", F->getSubprogram(), &F->getEntryBlock())
+                << ore::NV("Sequences", outlined) << " of " << ore::NV("Candidates", (unsigned int)sequences.size())
+                << " obfuscated sequences outlined");
+        }
+        DEBUG(dbgs() << "obf-outline: " << F->getName() << ": " << outlined << " of "
+            << sequences.size() << " sequences outlined\n");
+    }
+
+    // Functions of the same shape are merged. FunctionComparator
+    // ignores the tags and the locations, which are still those of
+    // the sequences, hence a function inlined back gets them again
+    GlobalNumberState numbers;
+    std::map<FunctionComparator::FunctionHash, std::vector<Function*>> shapes;
+    MapVector<Function*, std::vector<Function*>> same;
+    std::map<Function*, unsigned int> sites;
+    for(auto &it : outlinedFunctions) {
+        Function *function = it.first;
+        sites[function] = it.second;
+        std::vector<Function*> &candidates = shapes[FunctionComparator::functionHash(*function)];
+        Function *first = nullptr;
+        for(Function *candidate : candidates) {
+            if(FunctionComparator(function, candidate, &numbers).compare() == 0) {
+                first = candidate;
+                break;
+            }
+        }
+        if(first != nullptr) {
+            same[first].push_back(function);
+        } else {
+            candidates.push_back(function);
+            same[function];
+        }
+    }
+    for(auto &it : same) {
+        Function *function = it.first;
+        // A single call saves nothing, it only adds the call
+        if(it.second.empty() && function->hasOneUse()) {
+            CallInst *call = cast<CallInst>(function->user_back());
+            // Without the location of the call, the inlined code
+            // keeps its own locations as they were
+            DebugLoc location = call->getDebugLoc();
+            call->setDebugLoc(DebugLoc());
+            InlineFunctionInfo IFI;
+            if(InlineFunction(call, IFI)) {
+                function->eraseFromParent();
+                NumInlinedBack++;
+                continue;
+            }
+            call->setDebugLoc(location);
+        }
+        for(Function *duplicate : it.second) {
+            duplicate->replaceAllUsesWith(function);
+            duplicate->eraseFromParent();
+        }
+        prepareShared(function, siteMap.getKind(sites[function]));
+        NumShared++;
+    }
+    return !outlinedFunctions.empty();
+}
+
+void ObfuscationOutliner::getAnalysisUsage(AnalysisUsage &AU) const {
+    AU.addRequired<TargetTransformInfoWrapperPass>();
+    AU.addRequired<ObfuscationSiteMap>();
+    // The sites are recorded for this pass
+    AU.addRequired<ObfuscationSiteRequest>();
+}
+
+// Registering the pass
+char ObfuscationOutliner::ID = 0;
+static RegisterPass<ObfuscationOutliner> X("obf-outline", "Outlines the code emitted by -arith-obfus into shared functions");
+
+#undef DEBUG_TYPE
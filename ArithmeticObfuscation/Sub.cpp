@@ -7,7 +7,10 @@ using namespace llvm;
 
 namespace {
 
-bool obfuscateInteger(Instruction *I) {
+// Rewrites of an integer sub, one is chosen at random for every sub
+const unsigned int NUM_REWRITES = 3;
+
+bool obfuscateInteger(Instruction *I, ObfuscationRandom *random) {
     Type* type = I->getType();
     if(!type->isIntegerTy())
         return false;
@@ -16,13 +19,34 @@ bool obfuscateInteger(Instruction *I) {
     Value* b = I->getOperand(1);
 
     IRBuilder<> Builder(I);
-    // ~b
-    Value* v_not = Builder.CreateNot(b);
-    Value* one = ConstantInt::get(type, 1);
-    // ~b + 1
-    Value* v_add = Builder.CreateAdd(one, v_not);
-    // a + ~b + 1
-    Value* final = Builder.CreateAdd(v_add, a);
+    Value* final;
+    unsigned int rewrite = random != nullptr? random->next() % NUM_REWRITES: 0;
+    if(rewrite == 0) {
+        // ~b
+        Value* v_not = Builder.CreateNot(b);
+        Value* one = ConstantInt::get(type, 1);
+        // ~b + 1
+        Value* v_add = Builder.CreateAdd(one, v_not);
+        // a + ~b + 1
+        final = Builder.CreateAdd(v_add, a);
+    } else if(rewrite == 1) {
+        // a ^ b
+        Value* v_xor = Builder.CreateXor(a, b);
+        // ~a & b
+        Value* v_and = Builder.CreateAnd(Builder.CreateNot(a), b);
+        Value* two = ConstantInt::get(type, 2);
+        // 2 * (~a & b)
+        Value* v_mul = Builder.CreateMul(two, v_and);
+        // (a ^ b) - 2 * (~a & b)
+        final = Builder.CreateSub(v_xor, v_mul);
+    } else {
+        // a & ~b
+        Value* v_andA = Builder.CreateAnd(a, Builder.CreateNot(b));
+        // ~a & b
+        Value* v_andB = Builder.CreateAnd(Builder.CreateNot(a), b);
+        // (a & ~b) - (~a & b)
+        final = Builder.CreateSub(v_andA, v_andB);
+    }
 
     I->replaceAllUsesWith(final);
 
@@ -54,12 +78,30 @@ bool obfuscateFloat(Instruction *I) {
 
 } /* namespace */
 
-bool SubObfuscator::obfuscate(Instruction *I) {
+bool SubObfuscator::obfuscate(Instruction *I, ObfuscationRandom *random) {
     if(I->getOpcode() == Instruction::Sub) {
-        return obfuscateInteger(I);
+        return obfuscateInteger(I, random);
     } else if (I->getOpcode() == Instruction::FSub) {
         return obfuscateFloat(I);
     } else {
         return false;
     }
 }
+
+ObfuscationCost SubObfuscator::estimate(Instruction *I, const TargetTransformInfo *TTI) {
+    if(I->getOpcode() == Instruction::Sub) {
+        // a + ~b + 1, (a ^ b) - 2 * (~a & b) or (a & ~b) - (~a & b)
+        return ArithmeticObfuscationUtils::getCostliest({
+            ObfuscationUtils::getReplacementCost({Instruction::Xor, Instruction::Add, Instruction::Add}, 
+                {Instruction::Sub}, I->getType(), TTI),
+            ObfuscationUtils::getReplacementCost({Instruction::Xor, Instruction::Xor, Instruction::And, 
+                Instruction::Mul, Instruction::Sub}, {Instruction::Sub}, I->getType(), TTI),
+            ObfuscationUtils::getReplacementCost({Instruction::Xor, Instruction::And, Instruction::Xor, 
+                Instruction::And, Instruction::Sub}, {Instruction::Sub}, I->getType(), TTI)});
+    } else if (I->getOpcode() == Instruction::FSub) {
+        return ArithmeticObfuscationUtils::estimateFloat(I, 
+            {Instruction::Sub, Instruction::SIToFP, Instruction::FSub, Instruction::FAdd}, TTI);
+    } else {
+        return ObfuscationCost();
+    }
+}
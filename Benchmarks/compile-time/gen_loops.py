@@ -0,0 +1,52 @@
+#!/usr/bin/env python3
+# Generates a module with many innermost loops, to measure the compile
+# time of -indirect-access on functions with a lot of loops. The trip
+# counts are constants, as -indirect-access only transforms those loops.
+#
+# usage: gen_loops.py [--loops N] [--loops-per-function M] [--trip-count T] > loops.ll
+
+import argparse
+
+
+def emit_function(out, idx, loops, trip_count):
+    out.write("define void @f%d(i32* %%a) {\n" % idx)
+    out.write("entry:\n")
+    out.write("  br label %l0.ph\n")
+    for l in range(loops):
+        nxt = "l%d.ph" % (l + 1) if l + 1 < loops else "exit"
+        out.write("l%d.ph:\n" % l)
+        out.write("  br label %%l%d.body\n" % l)
+        out.write("l%d.body:\n" % l)
+        out.write("  %%l%d.i = phi i32 [ 0, %%l%d.ph ], [ %%l%d.next, %%l%d.body ]\n" % (l, l, l, l))
+        out.write("  %%l%d.idx = sext i32 %%l%d.i to i64\n" % (l, l))
+        out.write("  %%l%d.p = getelementptr inbounds i32, i32* %%a, i64 %%l%d.idx\n" % (l, l))
+        out.write("  %%l%d.v = load i32, i32* %%l%d.p, align 4\n" % (l, l))
+        out.write("  %%l%d.w = add nsw i32 %%l%d.v, %d\n" % (l, l, l + 1))
+        out.write("  store i32 %%l%d.w, i32* %%l%d.p, align 4\n" % (l, l))
+        out.write("  %%l%d.next = add nsw i32 %%l%d.i, 1\n" % (l, l))
+        out.write("  %%l%d.cond = icmp slt i32 %%l%d.next, %d\n" % (l, l, trip_count))
+        out.write("  br i1 %%l%d.cond, label %%l%d.body, label %%%s\n" % (l, l, nxt))
+    out.write("exit:\n")
+    out.write("  ret void\n")
+    out.write("}\n\n")
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--loops", type=int, default=10000)
+    parser.add_argument("--loops-per-function", type=int, default=1000)
+    parser.add_argument("--trip-count", type=int, default=100)
+    args = parser.parse_args()
+
+    import sys
+    out = sys.stdout
+    remaining, idx = args.loops, 0
+    while remaining > 0:
+        loops = min(remaining, args.loops_per_function)
+        emit_function(out, idx, loops, max(args.trip_count, 1))
+        remaining -= loops
+        idx += 1
+
+
+if __name__ == "__main__":
+    main()
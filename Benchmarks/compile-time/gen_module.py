@@ -0,0 +1,117 @@
+#!/usr/bin/env python3
+# Generates a synthetic module to measure how the compile time of the
+# passes scales with the size of the module. Every function has a chain
+# of blocks with integer arithmetic on constants (for -arith-obfus and
+# -const-encoding), calls to puts with string constants (-const-encoding)
+# and nests of loops with a constant trip count (-indirect-access only
+# transforms those).
+#
+# usage: gen_module.py [--functions N] [--blocks B] [--arith A]
+#                      [--strings S] [--loops L] [--loop-depth D]
+#                      [--trip-count T] > module.ll
+#
+# The number of instructions is about
+#   N * (B * (A + 4) + L * (D * 7 + 6) + S + 2)
+# e.g. --functions 10000 --blocks 10 --arith 10 gives about 1.5M.
+
+import argparse
+import sys
+
+OPS = ["add", "sub", "mul", "xor", "and", "or", "shl"]
+
+
+def emit_strings(out, count):
+    for s in range(count):
+        text = "string constant number %d" % s
+        out.write("@.str%d = private unnamed_addr constant [%d x i8] c\"%s\\00\", align 1\n"
+                  % (s, len(text) + 1, text))
+    out.write("\ndeclare i32 @puts(i8*)\n\n")
+
+
+def emit_loop_nest(out, name, depth, trip_count, after):
+    # for(i0 = 0; i0 < T; i0++) ... for(iD = 0; iD < T; iD++) a[iD] += i0
+    for d in range(depth):
+        out.write("  br label %%%s.%d.ph\n" % (name, d))
+        out.write("%s.%d.ph:\n" % (name, d))
+        out.write("  br label %%%s.%d.header\n" % (name, d))
+        out.write("%s.%d.header:\n" % (name, d))
+        out.write("  %%%s.%d.i = phi i32 [ 0, %%%s.%d.ph ], [ %%%s.%d.next, %%%s.%d.latch ]\n"
+                  % (name, d, name, d, name, d, name, d))
+    inner = depth - 1
+    out.write("  %%%s.idx = sext i32 %%%s.%d.i to i64\n" % (name, name, inner))
+    out.write("  %%%s.p = getelementptr inbounds i32, i32* %%a, i64 %%%s.idx\n" % (name, name))
+    out.write("  %%%s.v = load i32, i32* %%%s.p, align 4\n" % (name, name))
+    out.write("  %%%s.w = add nsw i32 %%%s.v, %%%s.0.i\n" % (name, name, name))
+    out.write("  store i32 %%%s.w, i32* %%%s.p, align 4\n" % (name, name))
+    for d in reversed(range(depth)):
+        out.write("  br label %%%s.%d.latch\n" % (name, d))
+        out.write("%s.%d.latch:\n" % (name, d))
+        out.write("  %%%s.%d.next = add nsw i32 %%%s.%d.i, 1\n" % (name, d, name, d))
+        out.write("  %%%s.%d.cond = icmp slt i32 %%%s.%d.next, %d\n" % (name, d, name, d, trip_count))
+        out.write("  br i1 %%%s.%d.cond, label %%%s.%d.header, label %%%s.%d.exit\n"
+                  % (name, d, name, d, name, d))
+        out.write("%s.%d.exit:\n" % (name, d))
+    out.write("  br label %%%s\n" % after)
+
+
+def emit_function(out, idx, args):
+    out.write("define i32 @f%d(i32* %%a, i32 %%n, i32 %%x) {\n" % idx)
+    out.write("entry:\n")
+    out.write("  br label %b0\n")
+    for b in range(args.blocks):
+        out.write("b%d:\n" % b)
+        prev = "%x"
+        for k in range(args.arith):
+            value = "%%b%d.v%d" % (b, k)
+            op = OPS[(idx + b + k) % len(OPS)]
+            constant = (idx * 31 + b * 7 + k) % 29 + 1
+            out.write("  %s = %s i32 %s, %d\n" % (value, op, prev, constant))
+            prev = value
+        # values do not cross blocks, so the branches need no phi nodes
+        out.write("  %%b%d.p = getelementptr inbounds i32, i32* %%a, i64 %d\n" % (b, b % 16))
+        out.write("  store i32 %s, i32* %%b%d.p, align 4\n" % (prev, b))
+        nxt = "b%d" % (b + 1) if b + 1 < args.blocks else "loops"
+        skip = "b%d" % (b + 2) if b + 2 < args.blocks else "loops"
+        out.write("  %%b%d.c = icmp slt i32 %s, %%n\n" % (b, prev))
+        out.write("  br i1 %%b%d.c, label %%%s, label %%%s\n" % (b, nxt, skip))
+    out.write("loops:\n")
+    for s in range(args.strings):
+        string = (idx + s) % args.string_pool
+        length = len("string constant number %d" % string) + 1
+        out.write("  %%s%d = call i32 @puts(i8* getelementptr inbounds ([%d x i8], "
+                  "[%d x i8]* @.str%d, i32 0, i32 0))\n" % (s, length, length, string))
+    for l in range(args.loops):
+        after = "nest%d" % (l + 1) if l + 1 < args.loops else "exit"
+        emit_loop_nest(out, "nest%d" % l, args.loop_depth, args.trip_count, after)
+        out.write("%s:\n" % after)
+    if args.loops == 0:
+        out.write("  br label %exit\n")
+        out.write("exit:\n")
+    out.write("  ret i32 %x\n")
+    out.write("}\n\n")
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--functions", type=int, default=100)
+    parser.add_argument("--blocks", type=int, default=10)
+    parser.add_argument("--arith", type=int, default=10, help="arithmetic ops per block")
+    parser.add_argument("--strings", type=int, default=2, help="puts calls per function")
+    parser.add_argument("--string-pool", type=int, default=100, help="distinct strings")
+    parser.add_argument("--loops", type=int, default=2, help="loop nests per function")
+    parser.add_argument("--loop-depth", type=int, default=2)
+    parser.add_argument("--trip-count", type=int, default=16, help="iterations of every loop")
+    args = parser.parse_args()
+    args.blocks = max(args.blocks, 1)
+    args.loop_depth = max(args.loop_depth, 1)
+    args.string_pool = max(args.string_pool, 1)
+    args.trip_count = max(args.trip_count, 1)
+
+    out = sys.stdout
+    emit_strings(out, args.string_pool if args.strings > 0 else 0)
+    for idx in range(args.functions):
+        emit_function(out, idx, args)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,24 @@
+#!/bin/sh
+# Compile time of -indirect-access on a module with many loops.
+#
+# usage: run.sh $LLVM_BUILD [LOOPS] [LOOPS_PER_FUNCTION]
+
+set -e
+
+LLVM_BUILD=${1:?usage: run.sh LLVM_BUILD [LOOPS] [LOOPS_PER_FUNCTION]}
+LOOPS=${2:-10000}
+PER_FUNCTION=${3:-1000}
+DIR=$(dirname "$0")
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+python3 "$DIR/gen_loops.py" --loops "$LOOPS" --loops-per-function "$PER_FUNCTION" > "$TMP/loops.ll"
+
+echo "== $LOOPS loops, $PER_FUNCTION per function"
+echo "-- baseline (-loop-rotate)"
+"$LLVM_BUILD/bin/opt" -loop-rotate -time-passes \
+    "$TMP/loops.ll" -o /dev/null 2>&1 | grep -E "Total Execution Time|Loop Pass Manager" || true
+echo "-- -loop-rotate -indirect-access"
+"$LLVM_BUILD/bin/opt" -load "$LLVM_BUILD/lib/ObfuscationUtils.so" -load "$LLVM_BUILD/lib/IndirectAccess.so" \
+    -loop-rotate -indirect-access -time-passes \
+    "$TMP/loops.ll" -o /dev/null 2>&1 | grep -E "Total Execution Time|Indirect|Dominator Tree|Loop Simplify|Scalar Evolution" || true
@@ -0,0 +1,115 @@
+#!/usr/bin/env python3
+# Compile time and peak memory of the passes for growing module sizes.
+#
+# For every size point a module is generated by gen_module.py with that
+# many functions, and opt is run on it without an obfuscation pass
+# (parsing, -mem2reg and writing, the baseline) and with each of the
+# passes. The table has the
+# time and the peak RSS of every run, and the time of the pass itself
+# (minus the baseline). Between two size points the growth exponent of
+# the pass time is printed, about 1 for linear. A larger exponent shows
+# superlinear behaviour of the pass.
+#
+# usage: scale.py LLVM_BUILD [--functions 100 1000 10000] [--runs N]
+#                 [gen_module.py options, e.g. --blocks 10 --arith 10]
+
+import argparse
+import math
+import os
+import subprocess
+import sys
+import tempfile
+import time
+
+# name, plugin, flags of opt
+PASSES = [
+    ("arith-obfus", "ArithmeticObfuscation", ["-arith-obfus"]),
+    ("const-encoding", "ConstantEncoding", ["-const-encoding"]),
+    ("indirect-access", "IndirectAccess", ["-loop-rotate", "-indirect-access"]),
+]
+
+# Exponent over which the growth is reported as superlinear
+SUPERLINEAR = 1.2
+
+
+def run_opt(command, runs):
+    best_time, peak = None, 0
+    for _ in range(runs):
+        start = time.perf_counter()
+        process = subprocess.Popen(command, stdout=subprocess.DEVNULL)
+        # wait4 gives the peak RSS of this child alone
+        _, status, usage = os.wait4(process.pid, 0)
+        elapsed = time.perf_counter() - start
+        # already reaped by wait4
+        process.returncode = 0
+        if not os.WIFEXITED(status) or os.WEXITSTATUS(status) != 0:
+            raise subprocess.CalledProcessError(status, " ".join(command))
+        best_time = elapsed if best_time is None else min(best_time, elapsed)
+        peak = max(peak, usage.ru_maxrss)
+    return best_time, peak
+
+
+def count_instructions(path):
+    with open(path) as f:
+        return sum(1 for line in f if line.startswith("  "))
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("llvm_build")
+    parser.add_argument("--functions", type=int, nargs="+", default=[100, 1000, 10000])
+    parser.add_argument("--runs", type=int, default=3, help="the fastest run is taken")
+    parser.add_argument("--only", nargs="*", help="passes to run")
+    args, generator_args = parser.parse_known_args()
+
+    opt = os.path.join(args.llvm_build, "bin", "opt")
+    lib = os.path.join(args.llvm_build, "lib")
+    generator = os.path.join(os.path.dirname(os.path.abspath(__file__)), "gen_module.py")
+    passes = [p for p in PASSES if not args.only or p[0] in args.only]
+
+    # results[pass] = [(instructions, pass time)] for every size point
+    results = {name: [] for name, _, _ in passes}
+    header = "%-16s %10s %10s %10s %10s" % ("pass", "insts", "time(s)", "pass(s)", "rss(MB)")
+    print(header)
+    print("-" * len(header))
+    with tempfile.TemporaryDirectory() as work:
+        for functions in sorted(args.functions):
+            module = os.path.join(work, "module%d.ll" % functions)
+            with open(module, "w") as out:
+                subprocess.check_call([sys.executable, generator, "--functions", str(functions)]
+                                      + generator_args, stdout=out)
+            instructions = count_instructions(module)
+            # same -mem2reg as the runs of the passes, the delta is the pass alone
+            base_time, base_rss = run_opt([opt, "-mem2reg", module, "-o", os.devnull], args.runs)
+            print("%-16s %10d %10.3f %10s %10.1f" % (
+                "(none)", instructions, base_time, "-", base_rss / 1024.0))
+            for name, plugin, flags in passes:
+                loads = ["-load=" + os.path.join(lib, p + ".so")
+                         for p in ("ObfuscationUtils", plugin)]
+                try:
+                    elapsed, rss = run_opt([opt] + loads + ["-mem2reg"] + flags
+                                           + [module, "-o", os.devnull], args.runs)
+                except subprocess.CalledProcessError as error:
+                    print("%-16s %10d failed: %s" % (name, instructions, error))
+                    continue
+                pass_time = max(elapsed - base_time, 1e-6)
+                results[name].append((instructions, pass_time))
+                print("%-16s %10d %10.3f %10.3f %10.1f" % (
+                    name, instructions, elapsed, pass_time, rss / 1024.0))
+            sys.stdout.flush()
+
+    print()
+    superlinear = False
+    for name, points in results.items():
+        for (n1, t1), (n2, t2) in zip(points, points[1:]):
+            exponent = math.log(t2 / t1) / math.log(float(n2) / n1)
+            flag = ""
+            if exponent > SUPERLINEAR:
+                flag = "  superlinear"
+                superlinear = True
+            print("%-16s %d -> %d insts: time ~ n^%.2f%s" % (name, n1, n2, exponent, flag))
+    return 1 if superlinear else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
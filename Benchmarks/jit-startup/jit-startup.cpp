@@ -0,0 +1,189 @@
+/*______________________________________________________________________
+ *
+ * obf-jit-startup, startup latency of the obfuscation in the ORC JIT:
+ * the time from adding a module to the JIT to the return of the first
+ * call of its entry function, with
+ *
+ * baseline, the module compiled eagerly without any pass
+ * eager, every pass run on the whole module, then compiled eagerly
+ * lazy, ObfuscationLayer below CompileOnDemandLayer, only the functions
+ *       called are transformed and compiled
+ *
+ * Every mode is run -runs times, each in a new context and JIT, the
+ * median is printed. The result of the entry has to be the same.
+ *
+ * usage: obf-jit-startup -passes=const-encoding,arith-obfus startup.bc
+ *______________________________________________________________________*/
+
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/ExecutionEngine/ExecutionEngine.h"
+#include "llvm/ExecutionEngine/JITSymbol.h"
+#include "llvm/ExecutionEngine/RTDyldMemoryManager.h"
+#include "llvm/ExecutionEngine/SectionMemoryManager.h"
+#include "llvm/ExecutionEngine/Orc/CompileOnDemandLayer.h"
+#include "llvm/ExecutionEngine/Orc/CompileUtils.h"
+#include "llvm/ExecutionEngine/Orc/IRCompileLayer.h"
+#include "llvm/ExecutionEngine/Orc/IndirectionUtils.h"
+#include "llvm/ExecutionEngine/Orc/LambdaResolver.h"
+#include "llvm/ExecutionEngine/Orc/RTDyldObjectLinkingLayer.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Mangler.h"
+#include "llvm/InitializePasses.h"
+#include "llvm/PassRegistry.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/DynamicLibrary.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/ManagedStatic.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/TargetSelect.h"
+#include "ObfuscationJIT/ObfuscationJIT.h"
+#include <algorithm>
+#include <chrono>
+using namespace llvm;
+using namespace llvm::orc;
+
+static cl::opt<std::string> inputFilename(cl::Positional, cl::Required,
+    cl::desc("<input bitcode file>"));
+
+static cl::list<std::string> passNames("passes", cl::CommaSeparated,
+    cl::desc("Obfuscation passes to run, in order (arith-obfus, const-encoding, indirect-access)"),
+    cl::value_desc("pass,..."));
+
+static cl::opt<std::string> entryName("entry",
+    cl::desc("Function called once, int (void)"), cl::init("startup"));
+
+static cl::opt<unsigned int> numRuns("runs",
+    cl::desc("Runs of every mode, the median is printed"), cl::init(5));
+
+namespace {
+
+enum Mode { Baseline, Eager, Lazy };
+
+/*______________________________________________________________________
+ *
+ * The JIT of the Kaleidoscope tutorial, with ObfuscationLayer between
+ * the compile layer and CompileOnDemandLayer. Eager modules are added
+ * to the compile layer, below the obfuscation.
+ *______________________________________________________________________*/
+class StartupJIT {
+
+public:
+    StartupJIT(TargetMachine &TM, ObfuscationTransform transform)
+        : TM(TM), DL(TM.createDataLayout()),
+          objectLayer([]() { return std::make_shared<SectionMemoryManager>(); }),
+          compileLayer(objectLayer, SimpleCompiler(TM)),
+          obfuscationLayer(compileLayer, std::move(transform)),
+          callbackManager(createLocalCompileCallbackManager(TM.getTargetTriple(), 0)),
+          CODLayer(obfuscationLayer,
+              [](Function &F) { return std::set<Function*>({&F}); },
+              *callbackManager, createLocalIndirectStubsManagerBuilder(TM.getTargetTriple())) {}
+
+    void addModule(std::unique_ptr<Module> M, Mode mode) {
+        M->setDataLayout(DL);
+        lazy = mode == Lazy;
+        auto resolver = createLambdaResolver(
+            [this](const std::string &name) {
+                if(auto symbol = findMangledSymbol(name))
+                    return symbol;
+                return JITSymbol(nullptr);
+            },
+            [](const std::string &name) {
+                if(auto address = RTDyldMemoryManager::getSymbolAddressInProcess(name))
+                    return JITSymbol(address, JITSymbolFlags::Exported);
+                return JITSymbol(nullptr);
+            });
+        if(mode == Lazy) {
+            obfuscationLayer.getTransform().prepareModule(*M);
+            cantFail(CODLayer.addModule(std::move(M), std::move(resolver)));
+        } else {
+            if(mode == Eager)
+                obfuscationLayer.getTransform().runAll(*M);
+            cantFail(compileLayer.addModule(std::move(M), std::move(resolver)));
+        }
+    }
+
+    JITTargetAddress getAddress(StringRef name) {
+        std::string mangled;
+        raw_string_ostream OS(mangled);
+        Mangler::getNameWithPrefix(OS, name, DL);
+        return cantFail(findMangledSymbol(OS.str()).getAddress());
+    }
+
+private:
+    JITSymbol findMangledSymbol(const std::string &name) {
+        return lazy? CODLayer.findSymbol(name, false): compileLayer.findSymbol(name, false);
+    }
+
+    TargetMachine &TM;
+    const DataLayout DL;
+    RTDyldObjectLinkingLayer objectLayer;
+    IRCompileLayer<decltype(objectLayer), SimpleCompiler> compileLayer;
+    ObfuscationLayer<decltype(compileLayer)> obfuscationLayer;
+    std::unique_ptr<JITCompileCallbackManager> callbackManager;
+    CompileOnDemandLayer<decltype(obfuscationLayer)> CODLayer;
+    bool lazy = false;
+
+};
+
+// Milliseconds to the return of the entry, and its result
+std::pair<double, int> runOnce(MemoryBufferRef buffer, Mode mode, TargetMachine &TM) {
+    LLVMContext context;
+    std::unique_ptr<Module> M = cantFail(parseBitcodeFile(buffer, context));
+    std::unique_ptr<StartupJIT> JIT(new StartupJIT(TM,
+        cantFail(ObfuscationTransform::create(TM, passNames))));
+
+    auto start = std::chrono::steady_clock::now();
+    JIT->addModule(std::move(M), mode);
+    auto entry = (int (*)())JIT->getAddress(entryName);
+    int result = entry();
+    auto end = std::chrono::steady_clock::now();
+    return std::make_pair(std::chrono::duration<double, std::milli>(end - start).count(), result);
+}
+
+} /* namespace */
+
+int main(int argc, char **argv) {
+    llvm_shutdown_obj Y;
+    InitializeNativeTarget();
+    InitializeNativeTargetAsmPrinter();
+    PassRegistry &registry = *PassRegistry::getPassRegistry();
+    initializeCore(registry);
+    initializeAnalysis(registry);
+    initializeTransformUtils(registry);
+    initializeScalarOpts(registry);
+    initializeTarget(registry);
+    cl::ParseCommandLineOptions(argc, argv, "Startup latency of the obfuscation in the ORC JIT\n");
+
+    ErrorOr<std::unique_ptr<MemoryBuffer>> buffer = MemoryBuffer::getFile(inputFilename);
+    if(!buffer) {
+        errs() << "obf-jit-startup: cannot read " << inputFilename << ": " << buffer.getError().message() << "\n";
+        return 1;
+    }
+    std::unique_ptr<TargetMachine> TM(EngineBuilder().selectTarget());
+    if(Error error = ObfuscationTransform::create(*TM, passNames).takeError()) {
+        errs() << "obf-jit-startup: " << toString(std::move(error)) << "\n";
+        return 1;
+    }
+    sys::DynamicLibrary::LoadLibraryPermanently(nullptr);
+
+    bool failed = false;
+    int baseline = 0;
+    outs() << format("%-10s %14s %s\n", "mode", "startup(ms)", "result");
+    for(Mode mode : {Baseline, Eager, Lazy}) {
+        std::vector<double> times;
+        int result = 0;
+        for(unsigned int i=0; i<std::max(1u, (unsigned int)numRuns); i++) {
+            std::pair<double, int> run = runOnce((*buffer)->getMemBufferRef(), mode, *TM);
+            times.push_back(run.first);
+            result = run.second;
+        }
+        std::sort(times.begin(), times.end());
+        if(mode == Baseline)
+            baseline = result;
+        bool matches = result == baseline;
+        failed |= !matches;
+        const char *name = mode == Baseline? "baseline": mode == Eager? "eager": "lazy";
+        outs() << format("%-10s %14.2f %s\n", name, times[times.size()/2], matches? "ok": "MISMATCH");
+    }
+    return failed? 1: 0;
+}
@@ -0,0 +1,29 @@
+/*
+ * Module of 1000 functions, of which startup() calls only two, as the
+ * code run at the start of a program in a JIT: a loop over an array,
+ * arithmetic and a string in every function.
+ */
+
+#define FUNCTION(n)                                                  \
+    int function_##n(int x) {                                        \
+        static const char name[] = "function " #n;                   \
+        int data[16];                                                \
+        int sum = 0;                                                 \
+        for(int i = 0; i < 16; i++)                                  \
+            data[i] = x * i + n;                                     \
+        for(int i = 0; i < 16; i++)                                  \
+            sum += data[i] * 3 - name[i % (sizeof(name) - 1)] / 7;   \
+        return sum;                                                  \
+    }
+
+#define TEN(n) FUNCTION(n##0) FUNCTION(n##1) FUNCTION(n##2) FUNCTION(n##3) FUNCTION(n##4) \
+    FUNCTION(n##5) FUNCTION(n##6) FUNCTION(n##7) FUNCTION(n##8) FUNCTION(n##9)
+#define HUNDRED(n) TEN(n##0) TEN(n##1) TEN(n##2) TEN(n##3) TEN(n##4) \
+    TEN(n##5) TEN(n##6) TEN(n##7) TEN(n##8) TEN(n##9)
+
+HUNDRED(1) HUNDRED(2) HUNDRED(3) HUNDRED(4) HUNDRED(5)
+HUNDRED(6) HUNDRED(7) HUNDRED(8) HUNDRED(9) HUNDRED(10)
+
+int startup(void) {
+    return function_100(7) + function_999(11);
+}
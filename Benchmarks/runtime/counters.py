@@ -0,0 +1,140 @@
+#!/usr/bin/env python3
+# Hardware counters of the kernels in kernels/, for the baseline and for
+# every configuration of the passes in run.py.
+#
+# Every executable is run under obf-perfcount (perfcount.c, built here
+# with --cc if not given), which counts with perf_event_open. Without a
+# hardware PMU only the software counters (task-clock, page faults) are
+# available, and the hardware columns are shown as '-'.
+#
+# The stack memory traffic is counted statically: the instructions of
+# the executable with a memory operand relative to the stack or frame
+# pointer (spills, allocas), from llvm-objdump.
+#
+# usage: counters.py --opt OPT --cc CLANG --lib-dir DIR [--perfcount EXE]
+#                   [--objdump LLVM_OBJDUMP] [--only CONFIG ...]
+
+import argparse
+import os
+import re
+import subprocess
+import sys
+import tempfile
+
+import run
+
+# column, function of the counters
+METRICS = [
+    ("instructions", lambda c: c.get("instructions")),
+    ("IPC", lambda c: div(c.get("instructions"), c.get("cycles"))),
+    ("branch-misses", lambda c: c.get("branch-misses")),
+    ("L1i-misses", lambda c: c.get("L1i-misses")),
+    ("L1d-misses", lambda c: c.get("L1d-misses")),
+    ("L1d-accesses", lambda c: add(c.get("L1d-loads"), c.get("L1d-stores"))),
+    ("stack-ops", lambda c: c.get("stack-ops")),
+    ("task-clock(ms)", lambda c: div(c.get("task-clock"), 1e6)),
+]
+
+STACK_OPERAND = re.compile(r"\(%[re]?[sb]p\)|\[[re]?[sb]p[^\]]*\]")
+
+
+def div(a, b):
+    return a / b if a is not None and b else None
+
+
+def add(a, b):
+    return a + b if a is not None and b is not None else None
+
+
+def count_events(perfcount, executable):
+    process = subprocess.run([perfcount, executable], stdout=subprocess.DEVNULL,
+                             stderr=subprocess.PIPE, universal_newlines=True, check=True)
+    counters = {}
+    for line in process.stderr.splitlines():
+        fields = line.split()
+        if len(fields) == 2 and not line.startswith("#"):
+            counters[fields[0]] = None if fields[1] == "-" else float(fields[1])
+    return counters
+
+
+def count_stack_ops(objdump, executable):
+    output = subprocess.check_output([objdump, "-d", "--no-show-raw-insn", executable],
+                                     universal_newlines=True)
+    return sum(1 for line in output.splitlines() if STACK_OPERAND.search(line))
+
+
+def show(value):
+    if value is None:
+        return "-"
+    if isinstance(value, int):
+        return "%d" % value
+    if value >= 1000:
+        return "%.4g" % value
+    return "%.2f" % value
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--opt", required=True)
+    parser.add_argument("--cc", required=True, help="clang, to compile C and bitcode")
+    parser.add_argument("--lib-dir", required=True, help="directory with the pass plugins")
+    parser.add_argument("--plugin-ext", default=".so")
+    parser.add_argument("--perfcount", help="obf-perfcount, built from perfcount.c if not given")
+    parser.add_argument("--objdump", default="llvm-objdump")
+    parser.add_argument("--only", nargs="*", help="configurations to run, besides baseline")
+    args = parser.parse_args()
+
+    configs = [c for c in run.CONFIGS
+               if c[0] == "baseline" or not args.only or c[0] in args.only]
+    here = os.path.dirname(os.path.abspath(__file__))
+    kernels_dir = os.path.join(here, "kernels")
+    kernels = sorted(os.path.join(kernels_dir, f)
+                     for f in os.listdir(kernels_dir) if f.endswith(".c"))
+
+    rows = []
+    with tempfile.TemporaryDirectory() as work:
+        perfcount = args.perfcount
+        if perfcount is None:
+            perfcount = os.path.join(work, "obf-perfcount")
+            subprocess.check_call([args.cc, "-O2", os.path.join(here, "perfcount.c"),
+                                   "-o", perfcount])
+        for source in kernels:
+            kernel = os.path.splitext(os.path.basename(source))[0]
+            baseline = None
+            for config in configs:
+                name = config[0]
+                try:
+                    executable = run.compile_kernel(args, source, config, work)
+                    counters = count_events(perfcount, executable)
+                except subprocess.CalledProcessError as error:
+                    print("%s %s: failed: %s" % (kernel, name, error), file=sys.stderr)
+                    if name == "baseline":
+                        break
+                    continue
+                counters["stack-ops"] = count_stack_ops(args.objdump, executable)
+                values = [metric(counters) for _, metric in METRICS]
+                if baseline is None:
+                    baseline = values
+                rows.append((kernel, name, values, baseline))
+
+    columns = "".join(" %14s" % column for column, _ in METRICS)
+    header = "%-10s %-18s" % ("kernel", "config") + columns
+    print(header)
+    print("-" * len(header))
+    for kernel, name, values, _ in rows:
+        print("%-10s %-18s" % (kernel, name) + "".join(" %14s" % show(v) for v in values))
+
+    # Same relative to the baseline, to see which counter grew with which pass
+    print()
+    print("%-10s %-18s" % ("kernel", "x baseline") + columns)
+    print("-" * len(header))
+    for kernel, name, values, baseline in rows:
+        if name == "baseline":
+            continue
+        ratios = [div(v, b) for v, b in zip(values, baseline)]
+        print("%-10s %-18s" % (kernel, name) + "".join(" %14s" % show(r) for r in ratios))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
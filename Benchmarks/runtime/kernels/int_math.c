@@ -0,0 +1,57 @@
+/* Integer math: hashing, gcd and modular exponentiation over an array. */
+#include <stdio.h>
+#include <stdlib.h>
+
+#define N 4096
+
+static unsigned int values[N];
+
+static unsigned int mix(unsigned int x) {
+    x ^= x >> 16;
+    x *= 0x7feb352d;
+    x ^= x >> 15;
+    x *= 0x846ca68b;
+    x ^= x >> 16;
+    return x;
+}
+
+static unsigned int gcd(unsigned int a, unsigned int b) {
+    while(b != 0) {
+        unsigned int t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+static unsigned long long powmod(unsigned long long base, unsigned long long exp,
+    unsigned long long mod) {
+    unsigned long long result = 1;
+    base %= mod;
+    while(exp > 0) {
+        if(exp & 1)
+            result = result * base % mod;
+        base = base * base % mod;
+        exp >>= 1;
+    }
+    return result;
+}
+
+int main(int argc, char **argv) {
+    int reps = argc > 1? atoi(argv[1]): 400;
+    unsigned long long checksum = 0;
+    for(int i = 0; i < N; i++)
+        values[i] = mix(i + 1);
+    for(int r = 0; r < reps; r++) {
+        for(int i = 0; i < N; i++) {
+            unsigned int a = values[i];
+            unsigned int b = values[(i * 7 + r) % N];
+            values[i] = mix(a + r);
+            checksum += gcd(a | 1, b | 1);
+            checksum += powmod(a, b & 1023, 1000000007ULL);
+            checksum -= (a - b) * 3 + (a >> 3);
+        }
+    }
+    printf("%llu\n", checksum);
+    return 0;
+}
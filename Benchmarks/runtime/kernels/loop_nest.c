@@ -0,0 +1,41 @@
+/* Loop nests: integer matrix multiply and a blocked transpose. */
+#include <stdio.h>
+#include <stdlib.h>
+
+#define N 128
+#define BLOCK 16
+
+static int a[N][N], b[N][N], c[N][N], t[N][N];
+
+int main(int argc, char **argv) {
+    int reps = argc > 1? atoi(argv[1]): 200;
+    for(int i = 0; i < N; i++) {
+        for(int j = 0; j < N; j++) {
+            a[i][j] = (i * 3 + j) % 17;
+            b[i][j] = (i + j * 5) % 13;
+        }
+    }
+    long checksum = 0;
+    for(int r = 0; r < reps; r++) {
+        for(int i = 0; i < N; i++) {
+            for(int j = 0; j < N; j++) {
+                int sum = 0;
+                for(int k = 0; k < N; k++)
+                    sum += a[i][k] * b[k][j];
+                c[i][j] = sum;
+            }
+        }
+        for(int ii = 0; ii < N; ii += BLOCK) {
+            for(int jj = 0; jj < N; jj += BLOCK) {
+                for(int i = ii; i < ii + BLOCK; i++) {
+                    for(int j = jj; j < jj + BLOCK; j++)
+                        t[j][i] = c[i][j] + r;
+                }
+            }
+        }
+        for(int i = 0; i < N; i++)
+            checksum += t[i][(i + r) % N];
+    }
+    printf("%ld\n", checksum);
+    return 0;
+}
@@ -0,0 +1,65 @@
+/* String heavy parsing: key=value records matched against keywords. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *records[] = {
+    "name=alpha;size=120;kind=file;owner=root",
+    "name=beta;size=4096;kind=directory;owner=daemon",
+    "name=gamma;size=77;kind=link;owner=nobody",
+    "name=delta;size=65535;kind=file;owner=user",
+    "name=epsilon;size=3;kind=socket;owner=root",
+};
+
+static const char *kinds[] = { "file", "directory", "link", "socket" };
+
+static long parseNumber(const char *s, const char **end) {
+    long value = 0;
+    while(*s >= '0' && *s <= '9') {
+        value = value * 10 + (*s - '0');
+        s++;
+    }
+    *end = s;
+    return value;
+}
+
+static long parseRecord(const char *record) {
+    long result = 0;
+    const char *s = record;
+    while(*s) {
+        const char *key = s;
+        while(*s && *s != '=')
+            s++;
+        size_t keyLength = s - key;
+        if(*s == '=')
+            s++;
+        if(keyLength == 4 && strncmp(key, "size", 4) == 0) {
+            result += parseNumber(s, &s);
+        } else if(keyLength == 4 && strncmp(key, "kind", 4) == 0) {
+            for(int k = 0; k < 4; k++) {
+                size_t length = strlen(kinds[k]);
+                if(strncmp(s, kinds[k], length) == 0)
+                    result += (k + 1) * 1000003;
+            }
+        } else if(keyLength == 5 && strncmp(key, "owner", 5) == 0) {
+            result += strncmp(s, "root", 4) == 0? 7: 11;
+        }
+        while(*s && *s != ';')
+            s++;
+        if(*s == ';')
+            s++;
+    }
+    return result;
+}
+
+int main(int argc, char **argv) {
+    int reps = argc > 1? atoi(argv[1]): 2000000;
+    int nRecords = sizeof(records) / sizeof(records[0]);
+    long checksum = 0;
+    for(int r = 0; r < reps; r++) {
+        checksum += parseRecord(records[r % nRecords]);
+        checksum ^= r;
+    }
+    printf("%ld\n", checksum);
+    return 0;
+}
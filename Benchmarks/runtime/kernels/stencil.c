@@ -0,0 +1,39 @@
+/* Floating point stencil: Jacobi iterations of a 2D heat equation. */
+#include <stdio.h>
+#include <stdlib.h>
+
+#define N 256
+
+static double grid[N][N], next[N][N];
+
+int main(int argc, char **argv) {
+    int reps = argc > 1? atoi(argv[1]): 2000;
+    for(int i = 0; i < N; i++) {
+        for(int j = 0; j < N; j++) {
+            grid[i][j] = (i == 0 || j == 0)? 100.0: 0.0;
+            next[i][j] = grid[i][j];
+        }
+    }
+    for(int r = 0; r < reps; r++) {
+        for(int i = 1; i < N - 1; i++) {
+            for(int j = 1; j < N - 1; j++) {
+                next[i][j] = 0.25 * (grid[i - 1][j] + grid[i + 1][j]
+                    + grid[i][j - 1] + grid[i][j + 1]);
+            }
+        }
+        for(int i = 1; i < N - 1; i++) {
+            for(int j = 1; j < N - 1; j++) {
+                double d = next[i][j] - grid[i][j];
+                grid[i][j] = next[i][j] + 0.01 * d * d;
+            }
+        }
+    }
+    double sum = 0;
+    for(int i = 0; i < N; i++) {
+        for(int j = 0; j < N; j++)
+            sum += grid[i][j];
+    }
+    /* Rounded, as -obfus-float may change the last bits */
+    printf("%.3f\n", sum);
+    return 0;
+}
@@ -0,0 +1,134 @@
+/*
+ * Runs a command and counts its events with perf_event_open (Linux).
+ *
+ * usage: obf-perfcount COMMAND [ARGS...]
+ *
+ * Prints one "event value" line per event to stderr, "event -" if the
+ * event could not be opened, e.g. with no hardware PMU (virtual
+ * machines, containers), in which case the software events still work.
+ * The counters are enabled at exec of the command and count its child
+ * processes too. Multiplexed counters are scaled to the time they were
+ * enabled. The exit status is the one of the command.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define CACHE(cache, op, result) \
+    ((cache) | ((op) << 8) | ((result) << 16))
+
+struct event {
+    const char *name;
+    uint32_t type;
+    uint64_t config;
+    int fd;
+};
+
+static struct event events[] = {
+    { "instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, -1 },
+    { "cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, -1 },
+    { "branches", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_INSTRUCTIONS, -1 },
+    { "branch-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, -1 },
+    { "L1i-misses", PERF_TYPE_HW_CACHE, CACHE(PERF_COUNT_HW_CACHE_L1I,
+        PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS), -1 },
+    { "L1d-loads", PERF_TYPE_HW_CACHE, CACHE(PERF_COUNT_HW_CACHE_L1D,
+        PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_ACCESS), -1 },
+    { "L1d-stores", PERF_TYPE_HW_CACHE, CACHE(PERF_COUNT_HW_CACHE_L1D,
+        PERF_COUNT_HW_CACHE_OP_WRITE, PERF_COUNT_HW_CACHE_RESULT_ACCESS), -1 },
+    { "L1d-misses", PERF_TYPE_HW_CACHE, CACHE(PERF_COUNT_HW_CACHE_L1D,
+        PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS), -1 },
+    { "task-clock", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK, -1 },
+    { "page-faults", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS, -1 },
+    { "context-switches", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES, -1 },
+};
+
+#define NUM_EVENTS (sizeof(events) / sizeof(events[0]))
+
+static int openEvent(struct event *e, pid_t pid) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = e->type;
+    attr.config = e->config;
+    attr.disabled = 1;
+    attr.enable_on_exec = 1;
+    attr.inherit = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return syscall(__NR_perf_event_open, &attr, pid, -1, -1, 0);
+}
+
+int main(int argc, char **argv) {
+    if(argc < 2) {
+        fprintf(stderr, "usage: %s COMMAND [ARGS...]\n", argv[0]);
+        return 2;
+    }
+
+    // The child waits till the counters are opened for it
+    int ready[2];
+    if(pipe(ready) != 0) {
+        perror("pipe");
+        return 2;
+    }
+    pid_t child = fork();
+    if(child < 0) {
+        perror("fork");
+        return 2;
+    }
+    if(child == 0) {
+        char c;
+        close(ready[1]);
+        if(read(ready[0], &c, 1) != 1)
+            _exit(127);
+        close(ready[0]);
+        execvp(argv[1], argv + 1);
+        perror(argv[1]);
+        _exit(127);
+    }
+    close(ready[0]);
+
+    int hardware = 0;
+    for(size_t i = 0; i < NUM_EVENTS; i++) {
+        events[i].fd = openEvent(&events[i], child);
+        if(events[i].fd >= 0 && events[i].type != PERF_TYPE_SOFTWARE)
+            hardware = 1;
+    }
+    if(write(ready[1], "x", 1) != 1)
+        perror("write");
+    close(ready[1]);
+
+    int status;
+    if(waitpid(child, &status, 0) < 0) {
+        perror("waitpid");
+        return 2;
+    }
+
+    if(!hardware)
+        fprintf(stderr, "# hardware counters unavailable, software counters only\n");
+    for(size_t i = 0; i < NUM_EVENTS; i++) {
+        uint64_t values[3];
+        if(events[i].fd < 0 || read(events[i].fd, values, sizeof(values)) != sizeof(values)
+            || values[2] == 0) {
+            fprintf(stderr, "%s -\n", events[i].name);
+            continue;
+        }
+        // values: count, time enabled, time running
+        double count = (double)values[0] * values[1] / values[2];
+        fprintf(stderr, "%s %.0f\n", events[i].name, count);
+        close(events[i].fd);
+    }
+
+    if(WIFEXITED(status))
+        return WEXITSTATUS(status);
+    return 128 + WTERMSIG(status);
+}
@@ -0,0 +1,173 @@
+#!/usr/bin/env python3
+# Runtime overhead of the obfuscation passes on the kernels in kernels/.
+#
+# Every kernel is compiled to bitcode once, transformed by opt with
+# each configuration of the passes below and compiled to an executable
+# with -O2. The executables are run a few times, and the median wall
+# time, the size of .text and the peak RSS are compared with the
+# baseline (opt -mem2reg only). The output of every run is compared
+# with the baseline to catch a miscompile.
+#
+# usage: run.py --opt OPT --cc CLANG --lib-dir DIR [--size LLVM_SIZE]
+#               [--runs N] [--threshold P] [--only CONFIG ...] [--out DIR]
+
+import argparse
+import csv
+import os
+import statistics
+import subprocess
+import sys
+import tempfile
+import time
+
+# name, plugins to load, flags of opt
+CONFIGS = [("baseline", [], [])]
+for iterations in (1, 2, 3):
+    CONFIGS.append(("arith-iter%d" % iterations, ["ArithmeticObfuscation"],
+                    ["-arith-obfus", "-arith-obfus-iter=%d" % iterations]))
+    CONFIGS.append(("arith-float-iter%d" % iterations, ["ArithmeticObfuscation"],
+                    ["-arith-obfus", "-arith-obfus-iter=%d" % iterations, "-obfus-float"]))
+CONFIGS.append(("const-encoding", ["ConstantEncoding"], ["-const-encoding"]))
+CONFIGS.append(("indirect-access", ["IndirectAccess"], ["-loop-rotate", "-indirect-access"]))
+
+
+def compile_kernel(args, source, config, work):
+    name, plugins, flags = config
+    base = os.path.join(work, os.path.splitext(os.path.basename(source))[0])
+    bitcode = base + ".bc"
+    if not os.path.exists(bitcode):
+        # -disable-llvm-passes keeps the IR unoptimized but without optnone
+        subprocess.check_call([args.cc, "-O2", "-Xclang", "-disable-llvm-passes",
+                               "-emit-llvm", "-c", source, "-o", bitcode])
+    loads = ["-load=" + os.path.join(args.lib_dir, p + args.plugin_ext)
+             for p in ["ObfuscationUtils"] + plugins] if plugins else []
+    transformed = "%s.%s.bc" % (base, name)
+    subprocess.check_call([args.opt] + loads + ["-mem2reg"] + flags
+                          + [bitcode, "-o", transformed])
+    executable = "%s.%s" % (base, name)
+    subprocess.check_call([args.cc, "-O2", transformed, "-o", executable, "-lm"])
+    return executable
+
+
+def text_size(args, executable):
+    output = subprocess.check_output([args.size, "-A", executable], universal_newlines=True)
+    for line in output.splitlines():
+        fields = line.split()
+        if len(fields) >= 2 and fields[0] == ".text":
+            return int(fields[1])
+    return os.path.getsize(executable)
+
+
+def run_once(executable):
+    start = time.perf_counter()
+    process = subprocess.Popen([executable], stdout=subprocess.PIPE)
+    output = process.stdout.read()
+    process.stdout.close()
+    # wait4 gives the peak RSS of this child alone
+    _, status, usage = os.wait4(process.pid, 0)
+    elapsed = time.perf_counter() - start
+    # already reaped by wait4
+    process.returncode = 0
+    if not os.WIFEXITED(status) or os.WEXITSTATUS(status) != 0:
+        raise subprocess.CalledProcessError(status, executable)
+    return elapsed, usage.ru_maxrss, output
+
+
+def measure(args, executable):
+    times, rss, outputs = [], [], set()
+    for _ in range(args.runs):
+        elapsed, maxrss, output = run_once(executable)
+        times.append(elapsed)
+        rss.append(maxrss)
+        outputs.add(output)
+    return {
+        "time": statistics.median(times),
+        "size": text_size(args, executable),
+        "rss": max(rss),
+        "output": outputs.pop() if len(outputs) == 1 else None,
+    }
+
+
+def ratio(value, baseline):
+    return value / baseline if baseline else float("nan")
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--opt", required=True)
+    parser.add_argument("--cc", required=True, help="clang, to compile C and bitcode")
+    parser.add_argument("--lib-dir", required=True, help="directory with the pass plugins")
+    parser.add_argument("--plugin-ext", default=".so")
+    parser.add_argument("--size", default="llvm-size")
+    parser.add_argument("--runs", type=int, default=5)
+    parser.add_argument("--threshold", type=float, default=5.0,
+                        help="slowdown in %% over baseline to be reported")
+    parser.add_argument("--only", nargs="*", help="configurations to run, besides baseline")
+    parser.add_argument("--out", default=".", help="directory for results.csv")
+    args = parser.parse_args()
+
+    configs = [c for c in CONFIGS
+               if c[0] == "baseline" or not args.only or c[0] in args.only]
+    kernels_dir = os.path.join(os.path.dirname(os.path.abspath(__file__)), "kernels")
+    kernels = sorted(os.path.join(kernels_dir, f)
+                     for f in os.listdir(kernels_dir) if f.endswith(".c"))
+
+    rows = []
+    with tempfile.TemporaryDirectory() as work:
+        for source in kernels:
+            kernel = os.path.splitext(os.path.basename(source))[0]
+            baseline = None
+            for config in configs:
+                name, _, flags = config
+                try:
+                    result = measure(args, compile_kernel(args, source, config, work))
+                except subprocess.CalledProcessError as error:
+                    print("%s %s: failed: %s" % (kernel, name, error), file=sys.stderr)
+                    if name == "baseline":
+                        break
+                    continue
+                if baseline is None:
+                    baseline = result
+                rows.append({
+                    "kernel": kernel,
+                    "config": name,
+                    "flags": " ".join(flags),
+                    "time": result["time"],
+                    "time_ratio": ratio(result["time"], baseline["time"]),
+                    "size": result["size"],
+                    "size_ratio": ratio(result["size"], baseline["size"]),
+                    "rss": result["rss"],
+                    "rss_ratio": ratio(result["rss"], baseline["rss"]),
+                    "output_ok": result["output"] is not None
+                                 and result["output"] == baseline["output"],
+                })
+
+    os.makedirs(args.out, exist_ok=True)
+    with open(os.path.join(args.out, "results.csv"), "w", newline="") as f:
+        writer = csv.DictWriter(f, fieldnames=list(rows[0].keys()) if rows else ["kernel"])
+        writer.writeheader()
+        writer.writerows(rows)
+
+    header = "%-10s %-18s %10s %7s %9s %7s %9s %7s %s" % (
+        "kernel", "config", "time(s)", "x", ".text", "x", "rss(KB)", "x", "output")
+    print(header)
+    print("-" * len(header))
+    for row in rows:
+        print("%-10s %-18s %10.4f %7.2f %9d %7.2f %9d %7.2f %s" % (
+            row["kernel"], row["config"], row["time"], row["time_ratio"],
+            row["size"], row["size_ratio"], row["rss"], row["rss_ratio"],
+            "ok" if row["output_ok"] else "MISMATCH"))
+
+    limit = 1 + args.threshold / 100
+    slow = [row for row in rows if row["time_ratio"] > limit]
+    print()
+    if not slow:
+        print("No slowdown over %.1f%%" % args.threshold)
+    for row in sorted(slow, key=lambda row: -row["time_ratio"]):
+        print("%s: %.1f%% slower with %s (opt %s)" % (
+            row["kernel"], (row["time_ratio"] - 1) * 100, row["config"], row["flags"]))
+    return 1 if any(not row["output_ok"] for row in rows) else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
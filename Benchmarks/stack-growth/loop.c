@@ -0,0 +1,40 @@
+/*
+ * Stack growth of the code emitted in a loop: a multiply, float add and
+ * multiply, a string and an inner loop, run ITERATIONS times (10^8 by
+ * default, or argv[1]). Prints the checksum and how much the stack
+ * pointer moved down over the loop, which is 0 unless a temporary is
+ * allocated by a dynamic alloca inside the loop.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+static const char message[] = "stack growth";
+
+/* Frame of the callee, just below the stack pointer of the caller */
+__attribute__((noinline)) static char *stack_pointer(void) {
+    return (char *)__builtin_frame_address(0);
+}
+
+int main(int argc, char **argv) {
+    long iterations = argc > 1 ? atol(argv[1]) : 100000000L;
+    unsigned int multiplier = (unsigned int)iterations | 3;
+    unsigned long long checksum = 0;
+    double accumulator = 1.0;
+
+    char *before = stack_pointer();
+    for(long i = 0; i < iterations; i++) {
+        unsigned int x = (unsigned int)i;
+        checksum += x * multiplier;
+        accumulator = accumulator * 0.5 + (double)(x & 1023);
+        checksum += message[x % (sizeof(message) - 1)];
+        /* constant trip count, for the indirect access array */
+        for(int j = 0; j < 4; j++) {
+            checksum += (unsigned long long)j * x;
+        }
+    }
+    char *after = stack_pointer();
+
+    printf("checksum %llu %.3f\n", checksum, accumulator);
+    printf("stack growth %ld bytes\n", (long)(before - after));
+    return 0;
+}
@@ -0,0 +1,89 @@
+#!/usr/bin/env python3
+# Stack growth of the obfuscated code in a loop of 10^8 iterations.
+#
+# loop.c is compiled like the kernels of bench-obfuscation, with each
+# configuration of the passes which emit temporaries, and run once. A
+# temporary allocated inside the loop grows the stack every iteration,
+# till the program crashes, else loop.c prints how much its stack
+# pointer moved over the loop. Any growth, a crash or a checksum
+# different from the baseline is a failure.
+#
+# usage: run.py --opt OPT --cc CLANG --lib-dir DIR [--iterations N]
+
+import argparse
+import os
+import subprocess
+import sys
+import tempfile
+
+# name, plugins to load, flags of opt
+CONFIGS = [
+    ("baseline", [], []),
+    ("arith", ["ArithmeticObfuscation"], ["-arith-obfus"]),
+    ("arith-float", ["ArithmeticObfuscation"], ["-arith-obfus", "-obfus-float"]),
+    ("const-encoding", ["ConstantEncoding"], ["-const-encoding"]),
+    ("indirect-access", ["IndirectAccess"], ["-loop-rotate", "-indirect-access"]),
+]
+
+
+def compile_loop(args, source, config, work):
+    name, plugins, flags = config
+    bitcode = os.path.join(work, "loop.bc")
+    if not os.path.exists(bitcode):
+        # -disable-llvm-passes keeps the IR unoptimized but without optnone
+        subprocess.check_call([args.cc, "-O2", "-Xclang", "-disable-llvm-passes",
+                               "-emit-llvm", "-c", source, "-o", bitcode])
+    loads = ["-load=" + os.path.join(args.lib_dir, p + args.plugin_ext)
+             for p in ["ObfuscationUtils"] + plugins] if plugins else []
+    transformed = os.path.join(work, "loop.%s.bc" % name)
+    subprocess.check_call([args.opt] + loads + ["-mem2reg"] + flags
+                          + [bitcode, "-o", transformed])
+    executable = os.path.join(work, "loop.%s" % name)
+    subprocess.check_call([args.cc, "-O2", transformed, "-o", executable])
+    return executable
+
+
+def run(executable, iterations):
+    process = subprocess.run([executable, str(iterations)], stdout=subprocess.PIPE,
+                             universal_newlines=True)
+    if process.returncode != 0:
+        return None, None
+    lines = process.stdout.splitlines()
+    growth = int(lines[1].split()[2])
+    return lines[0], growth
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--opt", required=True)
+    parser.add_argument("--cc", required=True, help="clang, to compile C and bitcode")
+    parser.add_argument("--lib-dir", required=True, help="directory with the pass plugins")
+    parser.add_argument("--plugin-ext", default=".so")
+    parser.add_argument("--iterations", type=int, default=10**8)
+    args = parser.parse_args()
+
+    source = os.path.join(os.path.dirname(os.path.abspath(__file__)), "loop.c")
+    failed = False
+    baseline = None
+    print("%-16s %14s %s" % ("config", "growth(bytes)", "result"))
+    with tempfile.TemporaryDirectory() as work:
+        for config in CONFIGS:
+            name = config[0]
+            checksum, growth = run(compile_loop(args, source, config, work), args.iterations)
+            if checksum is None:
+                result = "CRASHED"
+            elif baseline is not None and checksum != baseline:
+                result = "MISMATCH"
+            elif growth != 0:
+                result = "GROWS"
+            else:
+                result = "ok"
+            if name == "baseline":
+                baseline = checksum
+            failed = failed or result != "ok"
+            print("%-16s %14s %s" % (name, "-" if growth is None else growth, result))
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
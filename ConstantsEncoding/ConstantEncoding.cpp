@@ -4,84 +4,319 @@
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Support/Debug.h"
 #include "llvm/IR/GlobalVariable.h"
+#include "llvm/Analysis/TargetTransformInfo.h"
+#include "llvm/Analysis/OptimizationRemarkEmitter.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Support/Timer.h"
+#include "ObfuscationUtils/ObfuscationUtils.h"
 #include "ConstantEncoding/ConstantEncoding.h"
-#include <random>
+#include <map>
+#include <memory>
+#include <set>
 using namespace llvm;
 
 #define DEBUG_TYPE "const-encoding"
 
+STATISTIC(NumIntegers, "Integer constants encoded");
+STATISTIC(NumIntegersOverBudget, "Integer constants not encoded, over the budget");
+STATISTIC(NumCaesarStrings, "Strings encoded with the Caesar cipher");
+STATISTIC(NumBitStrings, "Strings encoded with bit encoding");
+STATISTIC(NumStringsOverBudget, "Strings not encoded, over the budget");
+STATISTIC(NumRolledBack, "Functions restored, over the obfuscation budget");
+STATISTIC(NumAlreadyObfuscated, "Functions and strings skipped, encoded by a previous run (-obf-max-layers)");
+
 namespace {
-// Random number generator, better than rand()
-std::random_device rd;
-std::mt19937 engine(rd());
-std::uniform_int_distribution<int> gen(0,1<<30);
+// true if the global variable is a C string, the strings encoded by the pass
+bool isCString(GlobalVariable *globalVar) {
+	if(!globalVar->isConstant() || !globalVar->hasInitializer())
+		return false;
+	ConstantDataArray *str = dyn_cast<ConstantDataArray>(globalVar->getInitializer());
+	return str != nullptr && str->isCString();
+}
+
+// false if a function not named by -obf-function uses the global,
+// strings are decoded at all their uses
+bool isUsedBySelectedOnly(GlobalVariable *globalVar) {
+	if(!ObfuscationUtils::hasSelectedFunctions())
+		return true;
+	for(Instruction *I : ConstantEncodingUtils::getDecodeSites(globalVar)) {
+		if(!ObfuscationUtils::isSelected(I->getParent()->getParent()))
+			return false;
+	}
+	return true;
+}
+
+// (instruction, operand) pairs of the integer constants of the block
+std::vector<std::pair<Instruction*, int>> getIntegerOperands(BasicBlock *BB) {
+	std::vector<std::pair<Instruction*, int>> operands;
+	for(Instruction &I: *BB) {
+		if(I.getType()->isIntegerTy()) {
+			int numOperands = I.getNumOperands();
+			for (int i=0; i < numOperands; i++) {
+				if(isa<ConstantInt>(I.getOperand(i)))
+					operands.push_back(std::make_pair(&I, i));
+			}
+		}
+	}
+	return operands;
+}
 }
 
 bool ConstantEncoding::runOnModule(Module &M) {
-	// TODO: storing all instructions is a bad idea. Make it efficient.
-	//       Probable store all blocks. And store instructions only for each block.
 	ConstantInt *CI;
-	std::vector<Instruction*> insToItertate;
+
+	// Budget shared with the other obfuscation passes
+	ObfuscationCostModel &costModel = getAnalysis<ObfuscationCostModel>();
+	bool inBudget = costModel.needsEstimates();
+	ObfuscationSiteMap *siteMap = &getAnalysis<ObfuscationSiteMap>();
+	// Dry run only estimates, nothing is encoded
+	bool dryRun = costModel.isDryRun();
+
+	// Remarks are emitted for functions, the pass being a module pass
+	std::map<Function*, std::unique_ptr<OptimizationRemarkEmitter>> remarkEmitters;
+	auto getORE = [&](Function *F) -> OptimizationRemarkEmitter& {
+		std::unique_ptr<OptimizationRemarkEmitter> &ORE = remarkEmitters[F];
+		if(!ORE)
+			ORE.reset(new OptimizationRemarkEmitter(F));
+		return *ORE;
+	};
+
+	std::vector<Function*> functions;
 	for (Function &F : M) {
-		for(BasicBlock &BB: F) {
-			for(Instruction &I: BB) {
-				insToItertate.push_back(&I);
-			}
-		}
+		if(!F.isDeclaration())
+			functions.push_back(&F);
 	}
 
     // For bit encoding and decoding new global variable will be 
     // created. Hence storing the original global variables in a 
     // vector and iterating over it.
+	// Strings encoded by a previous run (e.g. before LTO) are skipped
 	std::vector<GlobalVariable*> gvs;
 	for(Module::global_iterator it = M.global_begin(); it!=M.global_end(); it++) {
-		gvs.push_back(&*it);
+		if(!isUsedBySelectedOnly(&*it))
+			continue;
+		if(ObfuscationUtils::canObfuscate(&*it, DEBUG_TYPE)) {
+			gvs.push_back(&*it);
+		} else if(isCString(&*it)) {
+			NumAlreadyObfuscated++;
+		}
 	}
+	// Functions with code emitted by this run, tagged at the end
+	std::set<Function*> transformed;
 
 	// iterating through all operands in all instructions to 
-	// encode and decode integers
-	for(Instruction *I: insToItertate) {
-		if(I->getType()->isIntegerTy()) {
-			int numOperands = I->getNumOperands();
-			for (int i=0; i < numOperands; i++) {
+	// encode and decode integers, one function at a time so that
+	// a function over the size budget can be rolled back
+	for(Function *F : functions) {
+		NamedRegionTimer T("integers", "ConstantEncoding integers", 
+			ObfuscationUtils::TIMER_GROUP, ObfuscationUtils::TIMER_GROUP_DESCRIPTION, TimePassesIsEnabled);
+		if(!ObfuscationUtils::isSelected(F))
+			continue;
+		// The decode code of a previous run has integers too
+		if(!ObfuscationUtils::canObfuscate(F, DEBUG_TYPE)) {
+			NumAlreadyObfuscated++;
+			getORE(F).emit(OptimizationRemarkMissed(DEBUG_TYPE, "AlreadyObfuscated", F->getSubprogram(), &F->getEntryBlock())
+				<< "function already encoded " << ore::NV("Layers", ObfuscationUtils::getLayers(F, DEBUG_TYPE)) 
+				<< " times, see -obf-max-layers");
+			continue;
+		}
+		// Decoding moves the rest of the block to new blocks, hence only
+		// the original blocks are stored, and the operands of one block
+		// at a time, collected before the block is changed
+		std::vector<BasicBlock*> blocks;
+		for(BasicBlock &BB: *F)
+			blocks.push_back(&BB);
+
+		// One entry per operand, in the order of the blocks
+		std::vector<bool> selected;
+		Function *backup = nullptr;
+		if(inBudget) {
+			const TargetTransformInfo &TTI = getAnalysis<TargetTransformInfoWrapperPass>().getTTI(*F);
+			ObfuscationUtils::FunctionFrequency frequencies(*F);
+			costModel.addFunction(*F, &TTI, &frequencies.BFI);
+			std::vector<ObfuscationCandidate> candidates;
+			for(BasicBlock *BB : blocks) {
+				double frequency = ObfuscationUtils::getRelativeFrequency(BB, &frequencies.BFI);
+				for(auto &operand : getIntegerOperands(BB)) {
+					Instruction *I = operand.first;
+					int integerBits = I->getOperand(operand.second)->getType()->getIntegerBitWidth();
+					ObfuscationCost cost = BitEncodingAndDecoding::estimateDecodeNumber(integerBits, &TTI, M.getContext());
+					cost.latency *= frequency;
+					candidates.push_back(ObfuscationCandidate(cost, F));
+				}
+			}
+			selected = costModel.select(DEBUG_TYPE, candidates);
+			backup = costModel.checkpoint(*F);
+		}
+		if(dryRun)
+			continue;
+
+		OptimizationRemarkEmitter &ORE = getORE(F);
+		ObfuscationRandom random(DEBUG_TYPE, F->getName());
+		std::vector<GlobalVariable*> encodedNumbers;
+		unsigned int j = 0;
+		for(BasicBlock *BB : blocks) {
+			for(auto &operand : getIntegerOperands(BB)) {
+				Instruction *I = operand.first;
+				int i = operand.second;
+				if(inBudget && !selected[j++]) {
+					NumIntegersOverBudget++;
+					ORE.emit([&]() {
+						return OptimizationRemarkMissed(DEBUG_TYPE, "OverObfuscationBudget", I)
+							<< "integer constant not encoded, over the budget of -obf-size-budget/-obf-latency-budget";
+					});
+					continue;
+				}
 				if((CI=dyn_cast<ConstantInt>(I->getOperand(i)))!=nullptr) {
 					GlobalVariable *globalVar;
 					int integerBits = CI->getType()->getIntegerBitWidth();
 					long val = CI->getSExtValue();
-					int nBits = BitEncodingAndDecoding::encodeNumber(&globalVar, val, integerBits, &M);
-					BitEncodingAndDecoding::decodeNumber(globalVar, CI, I, integerBits, nBits, M.getContext());
+					int nBits = BitEncodingAndDecoding::encodeNumber(&globalVar, val, integerBits, &M, random);
+					BitEncodingAndDecoding::decodeNumber(globalVar, CI, I, integerBits, nBits, M.getContext(), siteMap);
+					encodedNumbers.push_back(globalVar);
+				}
+			}
+		}
+		if(!encodedNumbers.empty()) {
+			ORE.emit(OptimizationRemark(DEBUG_TYPE, "EncodedIntegers", F->getSubprogram(), &F->getEntryBlock())
+				<< ore::NV("Integers", (unsigned int)encodedNumbers.size()) << " integer constants encoded");
+		}
+
+		if(!costModel.commit(*F, backup)) {
+			NumRolledBack++;
+			ORE.emit(OptimizationRemarkMissed(DEBUG_TYPE, "RolledBack", F->getSubprogram(), &F->getEntryBlock())
+				<< ore::NV("Integers", (unsigned int)encodedNumbers.size()) 
+				<< " encoded integer constants restored, function over the budget of -obf-size-budget/-obf-latency-budget");
+			// Encoded numbers are not used by the restored function
+			for(GlobalVariable *globalVar : encodedNumbers) {
+				if(globalVar->use_empty())
+					globalVar->eraseFromParent();
+			}
+		} else {
+			NumIntegers += encodedNumbers.size();
+			unsigned int layers = ObfuscationUtils::getLayers(F, DEBUG_TYPE);
+			for(GlobalVariable *globalVar : encodedNumbers) {
+				ObfuscationUtils::setLayers(globalVar, DEBUG_TYPE, layers+1);
+			}
+			if(!encodedNumbers.empty())
+				transformed.insert(F);
+		}
+	}
+
+	// Strings are encoded for all their uses at once, hence they
+	// are selected after all the functions have added their budget,
+	// and are not rolled back
+	std::vector<bool> selectedStrings(gvs.size(), true);
+	if(inBudget) {
+		std::vector<ObfuscationCandidate> candidates;
+		std::map<Function*, std::unique_ptr<ObfuscationUtils::FunctionFrequency>> frequencies;
+		for(GlobalVariable *globalVar : gvs) {
+			ObfuscationCost cost;
+			ConstantDataArray *str = nullptr;
+			if(globalVar->isConstant() && globalVar->hasInitializer())
+				str = dyn_cast<ConstantDataArray>(globalVar->getInitializer());
+			if(str != nullptr && str->isCString()) {
+				int stringLength = str->getAsCString().size();
+				for(Instruction *I : ConstantEncodingUtils::getDecodeSites(globalVar)) {
+					Function *F = I->getParent()->getParent();
+					const TargetTransformInfo &TTI = getAnalysis<TargetTransformInfoWrapperPass>().getTTI(*F);
+					if(frequencies.count(F) == 0)
+						frequencies[F].reset(new ObfuscationUtils::FunctionFrequency(*F));
+					// Either of the ciphers is chosen at random, taking the costlier one
+					ObfuscationCost caesar = CaesarCipher::estimateDecode(stringLength, &TTI, M.getContext());
+					ObfuscationCost bits = BitEncodingAndDecoding::estimateDecode(stringLength, &TTI, M.getContext());
+					ObfuscationCost site = caesar.cycles > bits.cycles? caesar: bits;
+					site.latency *= ObfuscationUtils::getRelativeFrequency(I->getParent(), &frequencies[F]->BFI);
+					cost += site;
 				}
 			}
+			candidates.push_back(ObfuscationCandidate(cost, nullptr));
 		}
+		selectedStrings = costModel.select(DEBUG_TYPE, candidates);
 	}
+	if(dryRun)
+		return false;
 
 	int stringLength;
-	for(GlobalVariable *globalVar : gvs) {
+	for(unsigned int j=0; j < gvs.size(); j++) {
+		GlobalVariable *globalVar = gvs[j];
+		if(!selectedStrings[j]) {
+			if(isCString(globalVar)) {
+				NumStringsOverBudget++;
+				for(Instruction *I : ConstantEncodingUtils::getDecodeSites(globalVar)) {
+					getORE(I->getParent()->getParent()).emit([&]() {
+						return OptimizationRemarkMissed(DEBUG_TYPE, "OverObfuscationBudget", I)
+							<< "string " << ore::NV("String", globalVar->getName()) 
+							<< " not encoded, over the budget of -obf-size-budget/-obf-latency-budget";
+					});
+				}
+			}
+			continue;
+		}
 		if(globalVar->isConstant() && globalVar->hasInitializer()) {
-			if(gen(engine)%2) {
+			NamedRegionTimer T("strings", "ConstantEncoding strings", 
+				ObfuscationUtils::TIMER_GROUP, ObfuscationUtils::TIMER_GROUP_DESCRIPTION, TimePassesIsEnabled);
+			// Uses of the string, for the remarks after it is replaced
+			std::vector<std::pair<DebugLoc, BasicBlock*>> uses;
+			for(Instruction *I : ConstantEncodingUtils::getDecodeSites(globalVar)) {
+				uses.push_back(std::make_pair(I->getDebugLoc(), I->getParent()));
+			}
+			std::string name = globalVar->getName();
+			unsigned int layers = ObfuscationUtils::getLayers(globalVar, DEBUG_TYPE);
+			const char *cipher = nullptr;
+			ObfuscationRandom random(DEBUG_TYPE, name);
+			if(random.next()%2) {
 				// Caesar
-				int offset = CaesarCipher::encode(globalVar, &stringLength);
-				if(offset != CaesarCipher::INVALID)
-					CaesarCipher::decode(globalVar, stringLength, offset);
+				int offset = CaesarCipher::encode(globalVar, &stringLength, random);
+				if(offset != CaesarCipher::INVALID) {
+					CaesarCipher::decode(globalVar, stringLength, offset, siteMap);
+					ObfuscationUtils::setLayers(globalVar, DEBUG_TYPE, layers+1);
+					NumCaesarStrings++;
+					cipher = "Caesar cipher";
+				}
 			} else {
 				// Bit encoding and decoding
 				GlobalVariable *newStringGlobalVar = nullptr;
-				int nBits = BitEncodingAndDecoding::encode(globalVar, &newStringGlobalVar, &stringLength, &M);
+				int nBits = BitEncodingAndDecoding::encode(globalVar, &newStringGlobalVar, &stringLength, &M, random);
 				if(nBits != BitEncodingAndDecoding::INVALID) {
-					BitEncodingAndDecoding::decode(globalVar, newStringGlobalVar, stringLength, nBits);
+					BitEncodingAndDecoding::decode(globalVar, newStringGlobalVar, stringLength, nBits, siteMap);
+					ObfuscationUtils::setLayers(newStringGlobalVar, DEBUG_TYPE, layers+1);
 					globalVar->eraseFromParent();
+					NumBitStrings++;
+					cipher = "bit encoding";
 				}
 			}
-
+			if(cipher == nullptr)
+				continue;
+			for(auto &use : uses) {
+				transformed.insert(use.second->getParent());
+				getORE(use.second->getParent()).emit([&]() {
+					return OptimizationRemark(DEBUG_TYPE, "EncodedString", use.first, use.second)
+						<< "string " << ore::NV("String", name) << " of " 
+						<< ore::NV("Length", stringLength) << " characters decoded with " 
+						<< ore::NV("Cipher", cipher);
+				});
+			}
 		}
 	}
 
-
+	for(Function *F : transformed) {
+		ObfuscationUtils::setLayers(F, DEBUG_TYPE, ObfuscationUtils::getLayers(F, DEBUG_TYPE)+1);
+	}
     return true;
 }
 
+void ConstantEncoding::getAnalysisUsage(AnalysisUsage &AU) const {
+	AU.addRequired<TargetTransformInfoWrapperPass>();
+	AU.addRequired<ObfuscationCostModel>();
+	AU.addRequired<ObfuscationSiteMap>();
+}
+
 // Registering the pass
 char ConstantEncoding::ID = 0;
 static RegisterPass<ConstantEncoding> X("const-encoding", "Obfuscates string constants");
+// Added to the standard pipeline with -obf-extension-point
+static ObfuscationPipeline::Registration Y(ObfuscationPipeline::ConstantEncodingOrder, 
+	[]() -> Pass* { return new ConstantEncoding(); });
 
 #undef DEBUG_TYPE
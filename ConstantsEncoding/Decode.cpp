@@ -3,7 +3,9 @@
 #include "llvm/IR/Instruction.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/DerivedTypes.h"
+#include "ObfuscationUtils/ObfuscationUtils.h"
 #include "ConstantEncoding/ConstantEncoding.h"
+#include <algorithm>
 using namespace llvm;
 
 namespace {
@@ -256,6 +258,7 @@ Value* populateEnd(bool isNumber, IRBuilder<>* loopEndBuilder, GlobalVariable *g
  * @param int param, offset (or) nBits used while encoding
  * @param (*populateBody), function used to populate the decode loop body.
  *              For aruments of function, check populateBody functions above
+ * @param ObfuscationSiteMap *siteMap, the decode loop is tagged as a site
  * @param GlobalVariable *newStringVar, new encoded variable created
  *        if this is given, it is considered as encoded variable
  *        and globalVar will be deleted from IR
@@ -263,11 +266,14 @@ Value* populateEnd(bool isNumber, IRBuilder<>* loopEndBuilder, GlobalVariable *g
 void inlineDecode(bool isCaesar, bool isNumber, GlobalVariable *globalVar, int loopBoundInt, 
     int loopIterStep, Value *originalValue, Instruction *I, int param,
     void (*populateBody)(IRBuilder<>*,LLVMContext&,GlobalVariable*,Value*,Value*,int,int), 
-    GlobalVariable *newStringVar=nullptr, int integerBits=0, LLVMContext *ctx=nullptr) {
+    ObfuscationSiteMap *siteMap, GlobalVariable *newStringVar=nullptr, int integerBits=0, 
+    LLVMContext *ctx=nullptr) {
+
+    ObfuscationSiteMap::Marker marker = ObfuscationSiteMap::mark(I);
 
     GlobalVariable *encodedGlobalVar = newStringVar==nullptr? globalVar: newStringVar;
 
-    static LLVMContext& context = ctx==nullptr? globalVar->getContext() : *ctx;
+    LLVMContext& context = ctx==nullptr? globalVar->getContext() : *ctx;
     // Values required later
     Type *i32 = Type::getInt32Ty(context);
     Value* zero = ConstantInt::get(i32, 0);
@@ -294,20 +300,22 @@ void inlineDecode(bool isCaesar, bool isNumber, GlobalVariable *globalVar, int l
 
     // HEADER
     IRBuilder<> loopHeaderBuilder(loopHeader);
-    // allocating new string for the decode result
+    // allocating new string for the decode result, in the entry 
+    // block as the decode can be in a loop
     Value *newAlloca;
     if(isNumber) {
         Type *iN = Type::getIntNTy(context, integerBits);
-        newAlloca = loopHeaderBuilder.CreateAlloca(iN);
+        newAlloca = ObfuscationUtils::createEntryBlockAlloca(F, iN);
         loopHeaderBuilder.CreateStore(ConstantInt::get(iN, 0), newAlloca);
     } else if(isCaesar) {
         PointerType *pType = encodedGlobalVar->getType();
-        newAlloca = loopHeaderBuilder.CreateAlloca(pType->getElementType());
+        newAlloca = ObfuscationUtils::createEntryBlockAlloca(F, pType->getElementType());
     } else {
-        newAlloca = loopHeaderBuilder.CreateAlloca(ArrayType::get(Type::getInt8Ty(context), (loopBoundInt/loopIterStep)+1));
+        newAlloca = ObfuscationUtils::createEntryBlockAlloca(F, 
+            ArrayType::get(Type::getInt8Ty(context), (loopBoundInt/loopIterStep)+1));
     }
     // loop iterator, goes from 0 to stringLength-1, with steps of loopIterStep
-    Value *iterAlloca = loopHeaderBuilder.CreateAlloca(i32);
+    Value *iterAlloca = ObfuscationUtils::createEntryBlockAlloca(F, i32);
     loopHeaderBuilder.CreateStore(zero, iterAlloca);
     loopHeaderBuilder.CreateBr(loopBody);
 
@@ -319,7 +327,10 @@ void inlineDecode(bool isCaesar, bool isNumber, GlobalVariable *globalVar, int l
     // LATCH
     IRBuilder<> loopLatchBuilder(loopLatch);
     Value* cond = populateLatch(&loopLatchBuilder, iterAlloca, loopBound, iterStep);
-    loopLatchBuilder.CreateCondBr(cond, loopBody, loopEnd);
+    BranchInst *latch = loopLatchBuilder.CreateCondBr(cond, loopBody, loopEnd);
+    // the trip count is known, the loop is left once
+    int iterations = (loopBoundInt + loopIterStep - 1) / loopIterStep;
+    ObfuscationUtils::setBranchWeights(latch, std::max(iterations - 1, 0), 1);
 
     // END
     IRBuilder<> loopEndBuilder(loopEnd);
@@ -352,6 +363,9 @@ void inlineDecode(bool isCaesar, bool isNumber, GlobalVariable *globalVar, int l
             uu->replaceUsesOfWith(originalValue, newStrGEP);
         }
     }
+
+    siteMap->tagSince(marker, "const-encoding", 
+        isNumber? "decode-number": isCaesar? "decode-caesar": "decode-bits");
 }
 
 /*___________________________________________________________________________
@@ -402,20 +416,21 @@ Instruction* getInstructionForValue(User *U, Value *val, bool *del) {
 
 } /* namespace */
 
-void CaesarCipher::decode(GlobalVariable* globalVar, int stringLength, int offset) {
+void CaesarCipher::decode(GlobalVariable* globalVar, int stringLength, int offset, ObfuscationSiteMap *siteMap) {
     for(User *U: globalVar->users()) {
         if(Value *val = dyn_cast<Value>(U)) {
             Instruction *I = getInstructionForValue(U, val);
             if(I) {
                 // Constant is used, hence decode it
                 // else skip decoding
-                inlineDecode(true, false, globalVar, stringLength, 1, val, I, offset, populateBodyCaesar);
+                inlineDecode(true, false, globalVar, stringLength, 1, val, I, offset, populateBodyCaesar, siteMap);
             }
         }
     }
 }
 
-void BitEncodingAndDecoding::decode(GlobalVariable* globalVar, GlobalVariable *newStringGlobalVar, int stringLength, int nBits) {
+void BitEncodingAndDecoding::decode(GlobalVariable* globalVar, GlobalVariable *newStringGlobalVar, int stringLength, int nBits, 
+    ObfuscationSiteMap *siteMap) {
     std::vector<Instruction*> toErase;
     bool del;
     for(User *U: globalVar->users()) {
@@ -425,7 +440,7 @@ void BitEncodingAndDecoding::decode(GlobalVariable* globalVar, GlobalVariable *n
                 // Constant is used, hence decode it
                 // else skip decoding
                 inlineDecode(false, false, globalVar, stringLength, (8/nBits), val, I, nBits, 
-                    populateBodyBitEncodingAndDecoding, newStringGlobalVar);
+                    populateBodyBitEncodingAndDecoding, siteMap, newStringGlobalVar);
                 if(del) {
                     toErase.push_back(I);
                 }
@@ -438,7 +453,91 @@ void BitEncodingAndDecoding::decode(GlobalVariable* globalVar, GlobalVariable *n
 }
 
 void BitEncodingAndDecoding::decodeNumber(GlobalVariable* globalVar, Value *val, Instruction *I, 
-    int integerBits, int nBits, LLVMContext& context) {
+    int integerBits, int nBits, LLVMContext& context, ObfuscationSiteMap *siteMap) {
     inlineDecode(false, true, globalVar, (integerBits/nBits), 1, val, I, nBits,
-                    populateBodyBitEncodingAndDecodingNumbers, nullptr, integerBits, &context);
-}
\ No newline at end of file
+                    populateBodyBitEncodingAndDecodingNumbers, siteMap, nullptr, integerBits, &context);
+}
+
+namespace {
+
+/*___________________________________________________________________________
+ *
+ * Cost of one inlineDecode, the loop runs 'iterations' times
+ *
+ * @param ArrayRef<unsigned int> body, opcodes in the loop body
+ * @param ArrayRef<unsigned int> end, opcodes in for.end
+ * @param double iterations, number of iterations of the loop
+ * @param Type *type, type of the values decoded
+ *___________________________________________________________________________*/
+ObfuscationCost estimateInlineDecode(ArrayRef<unsigned int> body, ArrayRef<unsigned int> end,
+    double iterations, Type *type, const TargetTransformInfo *TTI) {
+    // branch to for.head, decoded value and iterator in for.head
+    ObfuscationCost cost = ObfuscationUtils::getReplacementCost({Instruction::Br, 
+        Instruction::Store, Instruction::Store, Instruction::Br}, {}, type, TTI);
+    // their allocas, in the entry block
+    cost.size += 2;
+    cost += ObfuscationUtils::getReplacementCost(end, {}, type, TTI);
+    // body and latch (populateLatch) are run every iteration
+    ObfuscationCost loop = ObfuscationUtils::getReplacementCost(body, {}, type, TTI);
+    loop += ObfuscationUtils::getReplacementCost({Instruction::Br, Instruction::Load, Instruction::Add, 
+        Instruction::Store, Instruction::ICmp, Instruction::Br}, {}, type, TTI);
+    cost.size += loop.size;
+    cost.memoryOps += loop.memoryOps;
+    cost.cycles += loop.cycles * iterations;
+    cost.latency = cost.cycles;
+    // for.head, for.body, for.inc and for.end
+    cost.blocks = 4;
+    return cost;
+}
+
+// for.end of a string, copies the terminating 0 (populateEnd)
+const unsigned int stringEnd[] = {Instruction::GetElementPtr, Instruction::Load, 
+    Instruction::GetElementPtr, Instruction::Store, Instruction::GetElementPtr};
+
+} /* namespace */
+
+ObfuscationCost CaesarCipher::estimateDecode(int stringLength, const TargetTransformInfo *TTI, LLVMContext &context) {
+    // populateBodyCaesar
+    return estimateInlineDecode({Instruction::Load, Instruction::GetElementPtr, Instruction::GetElementPtr, 
+        Instruction::Load, Instruction::Add, Instruction::URem, Instruction::Sub, Instruction::Add, 
+        Instruction::URem, Instruction::Store}, stringEnd, stringLength, Type::getInt8Ty(context), TTI);
+}
+
+ObfuscationCost BitEncodingAndDecoding::estimateDecode(int stringLength, const TargetTransformInfo *TTI, LLVMContext &context) {
+    // populateBodyBitEncodingAndDecoding, each character is in 8/nBits 
+    // characters, nBits is 1, 2 or 4, hence (8+4+2)/3 on an average
+    double step = 14.0/3;
+    ObfuscationCost cost = estimateInlineDecode({Instruction::Load, Instruction::SDiv, 
+        Instruction::GetElementPtr, Instruction::Store, Instruction::Load, Instruction::Store}, 
+        stringEnd, stringLength, Type::getInt8Ty(context), TTI);
+    ObfuscationCost perStep = ObfuscationUtils::getReplacementCost({Instruction::GetElementPtr, 
+        Instruction::Load, Instruction::And, Instruction::Shl, Instruction::Xor, Instruction::Add}, 
+        {}, Type::getInt8Ty(context), TTI);
+    cost.size += perStep.size * step;
+    cost.memoryOps += perStep.memoryOps * step;
+    cost.cycles += perStep.cycles * step * stringLength;
+    cost.latency = cost.cycles;
+    return cost;
+}
+
+ObfuscationCost BitEncodingAndDecoding::estimateDecodeNumber(int integerBits, const TargetTransformInfo *TTI, LLVMContext &context) {
+    // populateBodyBitEncodingAndDecodingNumbers, integerBits/nBits 
+    // iterations, which is (1/1+1/2+1/4)/3 of integerBits on an average
+    return estimateInlineDecode({Instruction::Load, Instruction::GetElementPtr, Instruction::Load, 
+        Instruction::Load, Instruction::And, Instruction::SExt, Instruction::SExt, Instruction::Mul, 
+        Instruction::Shl, Instruction::Add, Instruction::Store}, {Instruction::Load}, 
+        integerBits*7.0/12, Type::getIntNTy(context, integerBits), TTI);
+}
+
+std::vector<Instruction*> ConstantEncodingUtils::getDecodeSites(GlobalVariable* globalVar) {
+    std::vector<Instruction*> sites;
+    for(User *U: globalVar->users()) {
+        if(Value *val = dyn_cast<Value>(U)) {
+            Instruction *I = getInstructionForValue(U, val);
+            if(I) {
+                sites.push_back(I);
+            }
+        }
+    }
+    return sites;
+}
@@ -4,17 +4,9 @@
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Support/Debug.h"
 #include "ConstantEncoding/ConstantEncoding.h"
-#include <random>
 using namespace llvm;
 
-namespace {
-// Random number generator, better than rand()
-std::random_device rd;
-std::mt19937 engine(rd());
-std::uniform_int_distribution<int> gen(0,1<<30);
-}
-
-int CaesarCipher::encode(GlobalVariable* globalVar, int *stringLength){
+int CaesarCipher::encode(GlobalVariable* globalVar, int *stringLength, ObfuscationRandom &random){
 
 	// Getting the string value from the global variable
 	Constant* constValue = globalVar->getInitializer();
@@ -25,7 +17,7 @@ int CaesarCipher::encode(GlobalVariable* globalVar, int *stringLength){
 	std::string str = result->getAsCString();
 
 	// Getting random number
-	int randomNumber = gen(engine) % 125 + 1;
+	int randomNumber = random.next() % 125 + 1;
 
 	// Adding offset to all characters
 	int len = str.length();
@@ -43,8 +35,8 @@ int CaesarCipher::encode(GlobalVariable* globalVar, int *stringLength){
 
 namespace {
 // returns random number among 1,2,4
-int getRandomNBits() {
-	switch(gen(engine)%3) {
+int getRandomNBits(ObfuscationRandom &random) {
+	switch(random.next()%3) {
 		case 0:
 			return 1;
 		case 1:
@@ -55,7 +47,8 @@ int getRandomNBits() {
 }
 }
 
-int BitEncodingAndDecoding::encode(GlobalVariable* globalVar,GlobalVariable **newStringGlobalVar, int *stringLength, Module *M){
+int BitEncodingAndDecoding::encode(GlobalVariable* globalVar,GlobalVariable **newStringGlobalVar, int *stringLength, Module *M, 
+	ObfuscationRandom &random){
 
 	// Getting the string value from the global variable
 	Constant* constValue = globalVar->getInitializer();
@@ -67,7 +60,7 @@ int BitEncodingAndDecoding::encode(GlobalVariable* globalVar,GlobalVariable **ne
 
 	int len = str.length();
 	// Number of bits which are embedded in each character
-	int nBits  = getRandomNBits();
+	int nBits  = getRandomNBits(random);
 	// step = Number of steps taken. 
 	// Each character is of size 8 bits, which is splitted into sets of size nBits.
 	// Therefore number of steps = Total number of bits/nBits = 8/nBits
@@ -100,7 +93,7 @@ int BitEncodingAndDecoding::encode(GlobalVariable* globalVar,GlobalVariable **ne
 			// Current position in encoded string
 			int pos = i*step+j;
 			// Generates random number from 1 to 127
-			int randomNumber = gen(engine) % 127 + 1;
+			int randomNumber = random.next() % 127 + 1;
 
 			encodedStr[pos] = (char)randomNumber;
 			// Gives first n bits of the generated random number
@@ -119,7 +112,7 @@ int BitEncodingAndDecoding::encode(GlobalVariable* globalVar,GlobalVariable **ne
 	}
 
 	// Creating a new global variable to hold encoded string
-    static LLVMContext& context = globalVar->getContext();
+    LLVMContext& context = globalVar->getContext();
 	ArrayType *Ty = ArrayType::get(Type::getInt8Ty(context),strlen(encodedStr)+1);
 	Constant *aString = ConstantDataArray::getString(context, encodedStr, true);
   	*newStringGlobalVar = new GlobalVariable(*M, Ty, true, GlobalValue::PrivateLinkage, aString);
@@ -128,10 +121,11 @@ int BitEncodingAndDecoding::encode(GlobalVariable* globalVar,GlobalVariable **ne
 	return nBits;
 }
 
-int BitEncodingAndDecoding::encodeNumber(GlobalVariable **globalVar, long num, int integerBits, Module *M) {
+int BitEncodingAndDecoding::encodeNumber(GlobalVariable **globalVar, long num, int integerBits, Module *M, 
+	ObfuscationRandom &random) {
 
 	// Number of bits which are embedded in each character
-	int nBits = getRandomNBits();
+	int nBits = getRandomNBits(random);
 
 	int len = integerBits/nBits;
 	char *encodedStr = new char[len+1];
@@ -146,7 +140,7 @@ int BitEncodingAndDecoding::encodeNumber(GlobalVariable **globalVar, long num, i
 	for(int i=0;i<len;i++) {
 		// Logic is same as `BitEncodingAndDecoding::encode`
 		lastnBits = char(num) & mask;
-		int randomNumber = gen(engine) % 127 + 1;
+		int randomNumber = random.next() % 127 + 1;
 		encodedStr[i] = (char)randomNumber;
 		char firstnBits = encodedStr[i] & y;
 		char encodedChar = lastnBits | firstnBits;
@@ -155,7 +149,7 @@ int BitEncodingAndDecoding::encodeNumber(GlobalVariable **globalVar, long num, i
 	}
 
 	// Creating a new global variable to hold encoded string
-    static LLVMContext& context = M->getContext();
+    LLVMContext& context = M->getContext();
 	ArrayType *Ty = ArrayType::get(Type::getInt8Ty(context),strlen(encodedStr)+1);
 	Constant *aString = ConstantDataArray::getString(context, encodedStr, true);
   	*globalVar = new GlobalVariable(*M, Ty, true, GlobalValue::PrivateLinkage, aString);
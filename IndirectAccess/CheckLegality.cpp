@@ -1,4 +1,5 @@
 #include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Support/MathExtras.h"
 #include "IndirectAccess/IndirectAccess.h"
 using namespace llvm;
 
@@ -8,3 +9,18 @@ bool IndirectAccessUtils::isLegalTransform(Loop *L, ScalarEvolution *SE) {
 		&& iterator!=nullptr 
 		&& iterator->getType()->getPrimitiveSizeInBits() <= IndirectAccessUtils::MAX_BITS;
 }
+
+bool IndirectAccessUtils::isRegisterTransform(Loop *L, ScalarEvolution *SE, 
+	const TargetTransformInfo *TTI, unsigned int maxTripCount) {
+	unsigned int tripCount = SE->getSmallConstantTripCount(L);
+	if(tripCount == 0 || tripCount > maxTripCount)
+		return false;
+	// One lane per iteration, the vector should fit in a vector register
+	// of the target, else the backend splits it or spills it
+	unsigned int bits = getIntegerIterator(L,SE)->getType()->getPrimitiveSizeInBits();
+	if(PowerOf2Ceil(tripCount) * bits > TTI->getRegisterBitWidth(true))
+		return false;
+	// Values of the iterator are start + k*step, which has to be 
+	// built in the vector, hence step should be a constant
+	return IndirectAccessUtils::getIteratorStep(L,SE) != nullptr;
+}
@@ -5,18 +5,70 @@
 #include "llvm/Analysis/LoopInfo.h"
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Support/Debug.h"
-#include "llvm/IR/LegacyPassManager.h"
 #include "llvm/Transforms/Scalar.h"
 #include "llvm/IR/LLVMContext.h"
-#include "llvm/CodeGen/Passes.h"
-#include "llvm/Transforms/Scalar/DCE.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/Transforms/Utils/PromoteMemToReg.h"
+#include "llvm/Analysis/OptimizationRemarkEmitter.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/MathExtras.h"
+#include "llvm/IR/ValueHandle.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Support/Timer.h"
+#include "ObfuscationUtils/ObfuscationUtils.h"
 #include "IndirectAccess/IndirectAccess.h"
+#include <map>
 using namespace llvm;
 
 #define DEBUG_TYPE "indirect-access"
 
+STATISTIC(NumLoops, "Loops seen (outer and inner)");
+STATISTIC(NumInnermostLoops, "Innermost loops seen");
+STATISTIC(NumNotLegal, "Innermost loops not legal to transform");
+STATISTIC(NumOverBudget, "Loops not transformed, over the budget");
+STATISTIC(NumTransformed, "Loops transformed");
+STATISTIC(NumInRegister, "Loops transformed with the indices in a register");
+STATISTIC(NumThreadPrivate, "Loops transformed with a thread private array");
+STATISTIC(NumRolledBack, "Functions restored, over the obfuscation budget");
+STATISTIC(NumAlreadyObfuscated, "Functions skipped, obfuscated by a previous run (-obf-max-layers)");
+
+cl::opt<bool> vectorizeFriendly("indirect-access-vectorize", 
+    cl::desc("Lay out and access the indirect access array so that LoopVectorize can vectorize it"), 
+    cl::init(false));
+cl::opt<unsigned int> registerMaxTripCount("indirect-access-register-max-trip", 
+    cl::desc("Keep the indices of loops with trip count <= N in a vector register (0 disables)"), 
+    cl::init(0));
+cl::opt<unsigned int> indirectStride("indirect-access-stride", 
+    cl::desc("Store only every N-th iterator value in the array, the others are computed from it"), 
+    cl::init(1));
+cl::opt<bool> openmpLoops("indirect-access-openmp", 
+    cl::desc("Transform statically scheduled OpenMP loops with a thread private array"), 
+    cl::init(false));
+cl::opt<bool> permuteRegister("indirect-access-permute", 
+    cl::desc("Permute the lanes of the vector register holding the indices"), 
+    cl::init(false));
+
+namespace {
+
+enum BudgetScope { FunctionScope, ModuleScope };
+
+} /* namespace */
+
+cl::opt<double, false, ObfuscationUtils::PercentParser> maxOverhead("indirect-access-max-overhead", 
+    cl::desc("Max estimated slowdown allowed by the transformed loops, e.g. 5%"), 
+    cl::value_desc("percent"));
+cl::opt<BudgetScope> budgetScope("indirect-access-budget-scope", 
+    cl::desc("Scope of -indirect-access-max-overhead"), 
+    cl::values(
+        clEnumValN(FunctionScope, "function", "slowdown of every function (default)"),
+        clEnumValN(ModuleScope, "module", "slowdown of the module")),
+    cl::init(FunctionScope));
+
 namespace {
 
+// Cache line size, used to align the arrays in vectorization friendly mode
+const unsigned int CACHE_LINE_SIZE = 64;
+
 /*___________________________________________________________
  *
  * Performs a DFS on the loops and populates the vector lsi
@@ -42,17 +94,152 @@ void getInnerMostLoops(Loop *L, std::vector<LoopSplitInfo*> *lsi, int *loopCount
 
 } /* namespace */
 
-bool IndirectAccess::runOnFunction(Function &F) {
+namespace {
+
+bool promoteAllocas(Function &F, DominatorTree &DT) {
+    std::vector<AllocaInst*> allocas;
+    bool promoted = false;
+    while(true) {
+        allocas.clear();
+        for(Instruction &I : F.getEntryBlock()) {
+            if(AllocaInst *AI = dyn_cast<AllocaInst>(&I)) {
+                if(isAllocaPromotable(AI))
+                    allocas.push_back(AI);
+            }
+        }
+        if(allocas.empty())
+            break;
+        PromoteMemToReg(allocas, DT);
+        promoted = true;
+    }
+    return promoted;
+}
+
+// Blocks of the loop, its preheader and its exit blocks
+std::vector<BasicBlock*> getLoopRegion(Loop *L) {
+    std::vector<BasicBlock*> region(L->block_begin(), L->block_end());
+    if(BasicBlock *preheader = L->getLoopPreheader())
+        region.push_back(preheader);
+    SmallVector<BasicBlock*, 4> exitBlocks;
+    L->getUniqueExitBlocks(exitBlocks);
+    region.insert(region.end(), exitBlocks.begin(), exitBlocks.end());
+    return region;
+}
+
+// Instructions around the loop before it is transformed, WeakVH
+// as some of them are deleted by the transform
+std::vector<WeakVH> getLoopInstructions(Loop *L) {
+    std::vector<WeakVH> instructions;
+    for(BasicBlock *BB : getLoopRegion(L)) {
+        for(Instruction &I : *BB) {
+            instructions.push_back(WeakVH(&I));
+        }
+    }
+    return instructions;
+}
+
+/*___________________________________________________________
+ *
+ * Tags the code emitted by the transform of a loop as sites of
+ * ObfuscationSiteMap: the cloned loop and its preheader as 
+ * populate-loop, the untransformed copy of a loop with a thread
+ * private array as fallback-loop, and the new instructions around
+ * the original loop as index-load (index-register if the indices
+ * are kept in a register)
+ *
+ * @param LoopSplitInfo *LSI, the transformed loop
+ * @param std::vector<WeakVH> &original, from getLoopInstructions
+ *              before the transform
+ * @param ObfuscationSiteMap &siteMap, the map
+ *___________________________________________________________*/
+void tagLoopSites(LoopSplitInfo *LSI, std::vector<WeakVH> &original, ObfuscationSiteMap &siteMap) {
+    Loop *L = LSI->originalLoop;
+    Function &F = *L->getHeader()->getParent();
+    DebugLoc location = L->getStartLoc();
+
+    SmallPtrSet<BasicBlock*, 8> populateBlocks;
+    if(LSI->clonedLoop != nullptr) {
+        unsigned int site = siteMap.addSite(DEBUG_TYPE, "populate-loop", F, location);
+        populateBlocks.insert(LSI->clonedLoop->block_begin(), LSI->clonedLoop->block_end());
+        populateBlocks.insert(LSI->clonedLoop->getLoopPreheader());
+        // Allocation of the thread private array, before the preheader
+        if(LSI->fallbackLoop != nullptr) {
+            populateBlocks.insert(LSI->clonedLoop->getLoopPreheader()->getSinglePredecessor());
+        }
+        for(BasicBlock *BB : populateBlocks) {
+            for(Instruction &I : *BB) {
+                siteMap.tag(site, &I);
+            }
+        }
+    }
+
+    if(LSI->fallbackLoop != nullptr) {
+        unsigned int site = siteMap.addSite(DEBUG_TYPE, "fallback-loop", F, location);
+        std::vector<BasicBlock*> fallbackBlocks(LSI->fallbackLoop->block_begin(), 
+            LSI->fallbackLoop->block_end());
+        fallbackBlocks.push_back(LSI->fallbackLoop->getLoopPreheader());
+        for(BasicBlock *BB : fallbackBlocks) {
+            for(Instruction &I : *BB) {
+                siteMap.tag(site, &I);
+            }
+        }
+    }
+
+    SmallPtrSet<Instruction*, 32> survivors;
+    for(WeakVH &V : original) {
+        if(V != nullptr)
+            survivors.insert(cast<Instruction>(V));
+    }
+    unsigned int site = siteMap.addSite(DEBUG_TYPE, 
+        LSI->inRegister? "index-register": "index-load", F, location);
+    for(BasicBlock *BB : getLoopRegion(L)) {
+        if(populateBlocks.count(BB))
+            continue;
+        for(Instruction &I : *BB) {
+            if(!survivors.count(&I))
+                siteMap.tag(site, &I);
+        }
+    }
+}
+
+std::string formatPercent(double ratio) {
+    std::string str;
+    raw_string_ostream OS(str);
+    OS << format("%.2f", ratio*100) << "%";
+    return OS.str();
+}
+
+} /* namespace */
 
-    legacy::FunctionPassManager FPM(F.getParent());
-    FPM.add(createLoopSimplifyPass());
-    FPM.add(createPromoteMemoryToRegisterPass());
-    FPM.run(F);
+bool IndirectAccess::runOnFunction(Function &F) {
 
     LoopInfo &LI = getAnalysis<LoopInfoWrapperPass>().getLoopInfo();
     DominatorTree &DT = getAnalysis<DominatorTreeWrapperPass>().getDomTree();
     ScalarEvolution &SE = getAnalysis<ScalarEvolutionWrapperPass>().getSE();
 
+    // Budget shared with the other obfuscation passes
+    ObfuscationCostModel &costModel = getAnalysis<ObfuscationCostModel>();
+    OptimizationRemarkEmitter &ORE = getAnalysis<OptimizationRemarkEmitterWrapperPass>().getORE();
+
+    // Output of a previous run of the pass (e.g. before LTO), the
+    // loops populating the arrays would be transformed again
+    unsigned int layers = ObfuscationUtils::getLayers(&F, DEBUG_TYPE);
+    if(!ObfuscationUtils::isSelected(&F))
+        return false;
+    if(!ObfuscationUtils::canObfuscate(&F, DEBUG_TYPE)) {
+        NumAlreadyObfuscated++;
+        ORE.emit(OptimizationRemarkMissed(DEBUG_TYPE, "AlreadyObfuscated", F.getSubprogram(), &F.getEntryBlock())
+            << "function already obfuscated " << ore::NV("Layers", layers) << " times, see -obf-max-layers");
+        return false;
+    }
+
+    // Loops are in simplified form (required in getAnalysisUsage), and
+    // the iterators should be in registers. Promoting like mem2reg does,
+    // but in place, as mem2reg does not change the CFG.
+    // Also with a dry run, else the iterators of unpromoted input are in
+    // allocas and the report has none of the loops the real run transforms.
+    bool promoted = promoteAllocas(F, DT);
+
     int totalLoops = 0, totalInnermostLoops = 0, transformedLoops = 0;
     // This vector will be filled with the inner most loops
     std::vector<LoopSplitInfo*> lsi;
@@ -63,60 +250,292 @@ bool IndirectAccess::runOnFunction(Function &F) {
 
     // This will contain the filtered innermost loops after validity check
     std::vector<LoopSplitInfo*> valid_lsi;
-    // Max trip count of valid loops 
-    int maxTripCount = 0;
-    
-    int tripCount;
     for(LoopSplitInfo *LSI : lsi) {
+        NamedRegionTimer T("legality", "IndirectAccess legality", 
+            ObfuscationUtils::TIMER_GROUP, ObfuscationUtils::TIMER_GROUP_DESCRIPTION, TimePassesIsEnabled);
         totalInnermostLoops++;
-        if(IndirectAccessUtils::isLegalTransform(LSI->originalLoop, &SE)) {
-            tripCount = SE.getSmallConstantTripCount(LSI->originalLoop);
-            if(tripCount > maxTripCount) {
-                maxTripCount = tripCount;
+        Loop *L = LSI->originalLoop;
+        bool legal = IndirectAccessUtils::isLegalTransform(L, &SE);
+        if(!legal && openmpLoops && IndirectAccessUtils::isParallelTransform(L, &SE, &DT)) {
+            // Chunk of the thread has a runtime trip count, 
+            // hence the shared array in entry block cannot be used
+            LSI->threadPrivate = true;
+            legal = true;
+        }
+        if(legal) {
+            // Register transform needs neither the array nor the cloned loop
+            const TargetTransformInfo &TTI = getAnalysis<TargetTransformInfoWrapperPass>().getTTI(F);
+            LSI->inRegister = IndirectAccessUtils::isRegisterTransform(L, &SE, &TTI, registerMaxTripCount);
+            if(LSI->inRegister) {
+                LSI->lanes = PowerOf2Ceil(SE.getSmallConstantTripCount(L));
+            }
+            LSI->vectorizeFriendly = vectorizeFriendly && !LSI->inRegister;
+            // Values in between are computed with the step, hence it should be a constant
+            if(indirectStride > 1 && IndirectAccessUtils::getIteratorStep(L, &SE) != nullptr) {
+                LSI->stride = indirectStride;
             }
             valid_lsi.push_back(LSI);
+            ORE.emit(OptimizationRemarkAnalysis(DEBUG_TYPE, "Legal", L->getStartLoc(), L->getHeader())
+                << "loop can be transformed" 
+                << (LSI->inRegister? ", indices in a register": "")
+                << (LSI->threadPrivate? ", thread private array": ""));
+        } else {
+            NumNotLegal++;
+            ORE.emit(OptimizationRemarkMissed(DEBUG_TYPE, "NotLegal", L->getStartLoc(), L->getHeader())
+                << "loop not transformed: needs a constant trip count (or a statically scheduled "
+                << "OpenMP loop) and an integer induction variable");
         }
     }
 
-    if(maxTripCount>0) {
-        // Allocating array of max trip count in entry block
-        // This array will be reused in all the valid loops
-        Value *array = IndirectAccessUtils::allocateArrayInEntryBlock(&F, maxTripCount);
+    if(maxOverhead.getNumOccurrences() > 0 && !valid_lsi.empty()) {
+        NamedRegionTimer T("profitability", "IndirectAccess profitability", 
+            ObfuscationUtils::TIMER_GROUP, ObfuscationUtils::TIMER_GROUP_DESCRIPTION, TimePassesIsEnabled);
+        const TargetTransformInfo &TTI = getAnalysis<TargetTransformInfoWrapperPass>().getTTI(F);
+        BlockFrequencyInfo &BFI = getAnalysis<BlockFrequencyInfoWrapperPass>().getBFI();
+        double functionCost = IndirectAccessUtils::getFunctionCost(&F, &TTI, &BFI);
+        for(LoopSplitInfo *LSI : valid_lsi) {
+            IndirectAccessUtils::estimateOverhead(LSI, &SE, &TTI, &BFI);
+        }
+
+        // Every loop is worth the same, hence taking the cheapest loops 
+        // first gives the max number of loops under the budget
+        std::stable_sort(valid_lsi.begin(), valid_lsi.end(), 
+            [](LoopSplitInfo *A, LoopSplitInfo *B) { return A->overhead < B->overhead; });
 
+        double budget = maxOverhead * functionCost, spent = 0;
+        if(budgetScope == ModuleScope) {
+            // Budget of the functions seen till now, unspent budget 
+            // of previous functions can be used in this function
+            moduleBudget += budget;
+            budget = moduleBudget;
+            spent = moduleSpent;
+        }
+
+        std::vector<LoopSplitInfo*> selected;
         for(LoopSplitInfo *LSI : valid_lsi) {
-            // clone the loop
-            IndirectAccessUtils::clone(LSI, &LI, &DT);
-            // clear the cloned loop
-            IndirectAccessUtils::clearClonedLoop(LSI);
-            // populate the array with induction variable in the cloned loop
-            IndirectAccessUtils::populateArray(LSI, &F, array, &SE);
-            // replace uses of insuction variable with indirect access in original loop
-            IndirectAccessUtils::updateIndirectAccess(LSI, &F, array, &SE);
+            Loop *L = LSI->originalLoop;
+            std::string slowdown = formatPercent(LSI->loopCost>0? LSI->overhead/LSI->loopCost: 0);
+            if(spent + LSI->overhead <= budget) {
+                spent += LSI->overhead;
+                selected.push_back(LSI);
+                ORE.emit(OptimizationRemark(DEBUG_TYPE, "Profitable", L->getStartLoc(), L->getHeader())
+                    << "loop selected, estimated loop slowdown " << ore::NV("LoopSlowdown", slowdown)
+                    << ", function slowdown " << ore::NV("FunctionSlowdown", 
+                        formatPercent(functionCost>0? LSI->overhead/functionCost: 0)));
+            } else {
+                NumOverBudget++;
+                ORE.emit(OptimizationRemarkMissed(DEBUG_TYPE, "OverBudget", L->getStartLoc(), L->getHeader())
+                    << "loop not transformed, estimated loop slowdown " << ore::NV("LoopSlowdown", slowdown)
+                    << " exceeds the remaining budget of -indirect-access-max-overhead");
+            }
+        }
+        if(budgetScope == ModuleScope) {
+            moduleSpent = spent;
+        }
+        valid_lsi = selected;
+    }
+
+    Function *backup = nullptr;
+    if(costModel.needsEstimates()) {
+        NamedRegionTimer T("profitability", "IndirectAccess profitability", 
+            ObfuscationUtils::TIMER_GROUP, ObfuscationUtils::TIMER_GROUP_DESCRIPTION, TimePassesIsEnabled);
+        const TargetTransformInfo &TTI = getAnalysis<TargetTransformInfoWrapperPass>().getTTI(F);
+        BlockFrequencyInfo &BFI = getAnalysis<BlockFrequencyInfoWrapperPass>().getBFI();
+        costModel.addFunction(F, &TTI, &BFI);
+        std::vector<ObfuscationCandidate> candidates;
+        for(LoopSplitInfo *LSI : valid_lsi) {
+            IndirectAccessUtils::estimateOverhead(LSI, &SE, &TTI, &BFI);
+            ObfuscationCost cost = IndirectAccessUtils::estimateSize(LSI, &SE, &TTI);
+            cost.cycles = LSI->iterationOverhead;
+            cost.latency = LSI->overhead;
+            candidates.push_back(ObfuscationCandidate(cost, &F));
+        }
+        std::vector<bool> selected = costModel.select(DEBUG_TYPE, candidates);
+        if(costModel.isDryRun()) {
+            return promoted;
+        }
+        std::vector<LoopSplitInfo*> selected_lsi;
+        for(unsigned int i=0; i<valid_lsi.size(); i++) {
+            if(selected[i]) {
+                selected_lsi.push_back(valid_lsi[i]);
+            } else {
+                NumOverBudget++;
+                Loop *L = valid_lsi[i]->originalLoop;
+                ORE.emit(OptimizationRemarkMissed(DEBUG_TYPE, "OverObfuscationBudget", L->getStartLoc(), L->getHeader())
+                    << "loop not transformed, over the budget of -obf-size-budget/-obf-latency-budget");
+            }
+        }
+        valid_lsi = selected_lsi;
+        if(!valid_lsi.empty()) {
+            backup = costModel.checkpoint(F);
+        }
+    }
+
+    // Max trip count of valid loops, for each size of integer in the array.
+    // In vectorization friendly mode the array has the width of the iterator,
+    // so that the vector of indices is not wider than needed. Else a single
+    // array of IndirectAccessUtils::MAX_BITS is shared by all loops.
+    std::map<unsigned int, int> maxTripCount;
+    int tripCount;
+    for(LoopSplitInfo *LSI : valid_lsi) {
+        if(LSI->inRegister || LSI->threadPrivate)
+            continue;
+        tripCount = SE.getSmallConstantTripCount(LSI->originalLoop);
+        // Only every stride-th value is stored
+        tripCount = (tripCount + LSI->stride - 1) / LSI->stride;
+        unsigned int bits = IndirectAccessUtils::MAX_BITS;
+        if(LSI->vectorizeFriendly) {
+            bits = IndirectAccessUtils::getIntegerIterator(LSI->originalLoop, &SE)
+                ->getType()->getPrimitiveSizeInBits();
+        }
+        if(tripCount > maxTripCount[bits]) {
+            maxTripCount[bits] = tripCount;
+        }
+    }
+
+    // Allocating array of max trip count in entry block
+    // This array will be reused in all the valid loops
+    std::map<unsigned int, Value*> arrays;
+    ObfuscationSiteMap &siteMap = getAnalysis<ObfuscationSiteMap>();
+    for(auto &it : maxTripCount) {
+        arrays[it.first] = IndirectAccessUtils::allocateArrayInEntryBlock(&F, it.second, 
+            it.first, vectorizeFriendly? CACHE_LINE_SIZE: 0);
+        siteMap.tag(siteMap.addSite(DEBUG_TYPE, "index-array", F, DebugLoc()), 
+            cast<Instruction>(arrays[it.first]));
+    }
+
+    for(LoopSplitInfo *LSI : valid_lsi) {
+        NamedRegionTimer T("transform", "IndirectAccess transform", 
+            ObfuscationUtils::TIMER_GROUP, ObfuscationUtils::TIMER_GROUP_DESCRIPTION, TimePassesIsEnabled);
+        Loop *L = LSI->originalLoop;
+        std::string origin = IndirectAccessUtils::getLoopOrigin(L);
+        // Instructions before the transform, to find the ones 
+        // emitted by it for the site map
+        std::vector<WeakVH> originalInstructions;
+        if(siteMap.isEnabled()) {
+            originalInstructions = getLoopInstructions(L);
+        }
+        if(LSI->inRegister) {
+            IndirectAccessUtils::updateIndirectAccessInRegister(LSI, &F, &SE, permuteRegister);
+            IndirectAccessUtils::removeDeadInstructions(L);
+            if(siteMap.isEnabled()) {
+                tagLoopSites(LSI, originalInstructions, siteMap);
+            }
+            IndirectAccessUtils::tagLoop(L, "transformed", origin);
+            // The iterator and the exit condition changed
+            SE.forgetLoop(L);
             transformedLoops++;
+            NumInRegister++;
+            ORE.emit(OptimizationRemark(DEBUG_TYPE, "Transformed", L->getStartLoc(), L->getHeader())
+                << "loop transformed, indices in a register");
+            continue;
+        }
+        unsigned int bits = IndirectAccessUtils::MAX_BITS;
+        if(LSI->vectorizeFriendly) {
+            bits = IndirectAccessUtils::getIntegerIterator(L, &SE)
+                ->getType()->getPrimitiveSizeInBits();
+            // Loop bound known at compile time, hence not taken from the cloned loop
+            if(!LSI->threadPrivate) {
+                LSI->tripCountValue = ConstantInt::get(Type::getInt64Ty(F.getContext()), 
+                    SE.getSmallConstantTripCount(L));
+            }
+        }
+        // clone the loop
+        IndirectAccessUtils::clone(LSI, &LI, &DT);
+        Value *array;
+        if(LSI->threadPrivate) {
+            // Array of this thread, allocated before the cloned loop
+            array = IndirectAccessUtils::allocateThreadPrivateArray(LSI, &F, &SE, 
+                &LI, &DT, bits, CACHE_LINE_SIZE);
+        } else {
+            array = arrays[bits];
+        }
+        // clear the cloned loop
+        IndirectAccessUtils::clearClonedLoop(LSI);
+        // populate the array with induction variable in the cloned loop
+        IndirectAccessUtils::populateArray(LSI, &F, array, &SE);
+        // replace uses of insuction variable with indirect access in original loop
+        IndirectAccessUtils::updateIndirectAccess(LSI, &F, array, &SE, &LI, &DT);
+        // dead instructions are created while clearing cloned loop
+        // and replacing the iterator, hence removing them
+        IndirectAccessUtils::removeDeadInstructions(LSI->clonedLoop);
+        IndirectAccessUtils::removeDeadInstructions(L);
+        if(siteMap.isEnabled()) {
+            tagLoopSites(LSI, originalInstructions, siteMap);
+        }
+        // tag both loops for IndirectAccessVectorizationReport
+        IndirectAccessUtils::tagLoop(LSI->clonedLoop, "populate", origin);
+        IndirectAccessUtils::tagLoop(L, "transformed", origin);
+        // Only the original loop has changed for ScalarEvolution,
+        // the cloned loop is new
+        SE.forgetLoop(L);
+        transformedLoops++;
+        if(LSI->threadPrivate) {
+            NumThreadPrivate++;
         }
+        ORE.emit(OptimizationRemark(DEBUG_TYPE, "Transformed", L->getStartLoc(), L->getHeader())
+            << "loop transformed, indices in " 
+            << (LSI->threadPrivate? "a thread private array": "the shared array"));
+    }
 
-        // dead instructions will be created while clearing cloned loop
-        // hence removing it
-        FPM.add(createDeadInstEliminationPass());
-        FPM.run(F);
+    bool rolledBack = false;
+    if(backup != nullptr && !costModel.commit(F, backup)) {
+        // Function is restored to its body before the transform, the
+        // analyses are not preserved when it can be (getAnalysisUsage)
+        NumRolledBack++;
+        ORE.emit(OptimizationRemarkMissed(DEBUG_TYPE, "RolledBack", F.getSubprogram(), &F.getEntryBlock())
+            << ore::NV("Loops", transformedLoops) 
+            << " transformed loops restored, function over the budget of -obf-size-budget/-obf-latency-budget");
+        transformedLoops = 0;
+        rolledBack = true;
+    }
+    if(transformedLoops > 0) {
+        ObfuscationUtils::setLayers(&F, DEBUG_TYPE, layers+1);
     }
 
-    dbgs() << "\nTotal loops (outer+inner): " << totalLoops << "\n";;
-    dbgs() << "Total inner loops: " << totalInnermostLoops << "\n";;
-    dbgs() << "Transformed inner loops: " << transformedLoops << "\n";;
-    dbgs() << "% (inner): " << (totalInnermostLoops>0? (transformedLoops*100.0)/totalInnermostLoops: 0) << "\n\n";;
+#ifdef EXPENSIVE_CHECKS
+    if(!rolledBack) {
+        assert(DT.verify() && "DominatorTree not updated correctly");
+        LI.verify(DT);
+    }
+#endif
 
-    return transformedLoops>0;
+    NumLoops += totalLoops;
+    NumInnermostLoops += totalInnermostLoops;
+    NumTransformed += transformedLoops;
+    ORE.emit(OptimizationRemarkAnalysis(DEBUG_TYPE, "Summary", F.getSubprogram(), &F.getEntryBlock())
+        << ore::NV("TransformedLoops", transformedLoops) << " of " 
+        << ore::NV("InnermostLoops", totalInnermostLoops) << " innermost loops transformed");
+    DEBUG(dbgs() << "indirect-access: " << F.getName() << ": " << totalLoops << " loops, " 
+        << totalInnermostLoops << " innermost, " << transformedLoops << " transformed\n");
+
+    return transformedLoops>0 || rolledBack || promoted;
 }
 
 void IndirectAccess::getAnalysisUsage(AnalysisUsage &AU) const {
+    AU.addRequiredID(LoopSimplifyID);
     AU.addRequired<LoopInfoWrapperPass>();
     AU.addRequired<DominatorTreeWrapperPass>();
     AU.addRequired<ScalarEvolutionWrapperPass>();
+    AU.addRequired<TargetTransformInfoWrapperPass>();
+    AU.addRequired<BlockFrequencyInfoWrapperPass>();
+    AU.addRequired<OptimizationRemarkEmitterWrapperPass>();
+    AU.addRequired<ObfuscationCostModel>();
+    AU.addRequired<ObfuscationSiteMap>();
+    // Updated incrementally while transforming the loops, but not
+    // for the body restored when a function is over the budget
+    if(!ObfuscationCostModel::canRollBack()) {
+        AU.addPreserved<LoopInfoWrapperPass>();
+        AU.addPreserved<DominatorTreeWrapperPass>();
+        AU.addPreserved<ScalarEvolutionWrapperPass>();
+    }
 }
 
 // Registering the pass
 char IndirectAccess::ID = 0;
 static RegisterPass<IndirectAccess> X("indirect-access", "Indirect access of loop iterators");
+// Added to the standard pipeline with -obf-extension-point
+static ObfuscationPipeline::Registration Y(ObfuscationPipeline::IndirectAccessOrder, 
+    []() -> Pass* { return new IndirectAccess(); });
 
 #undef DEBUG_TYPE
@@ -5,10 +5,14 @@
 #include "llvm/Transforms/Utils/LoopUtils.h"
 #include "llvm/Transforms/Utils/Cloning.h"
 #include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/Analysis/ScalarEvolutionExpressions.h"
 #include "llvm/ADT/Twine.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/DerivedTypes.h"
 #include "llvm/ADT/APInt.h"
+#include "llvm/IR/ValueHandle.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include "llvm/Transforms/Utils/Local.h"
 #include "IndirectAccess/IndirectAccess.h"
 using namespace llvm;
 
@@ -18,22 +22,37 @@ namespace {
  *
  * After cloning, cloned loop is put after the original
  * This function moves the cloned loop before the original loop
+ * and updates the DominatorTree for it
  *
  * @param Loop *L1, the original loop (the first loop)
  * @param Loop *L2, the cloned loop (the second loop)
+ * @param DominatorTree *DT, from analysis pass, with the cloned
+ *        blocks added under the predecessor of L1's preheader
  *_______________________________________________________________*/
-void swapLoops(Loop *L1, Loop *L2) {
+void swapLoops(Loop *L1, Loop *L2, DominatorTree *DT) {
 
     BasicBlock *L1PreHeader = L1->getLoopPreheader();
     BasicBlock *L1PrePreHeader = L1PreHeader->getUniquePredecessor();
     BasicBlock *L2PreHeader = L2->getLoopPreheader();
-    BasicBlock *L1Latch = L1->getLoopLatch();
     BasicBlock *L2Latch = L2->getLoopLatch();
 
-    BasicBlock *end = L2Latch->getTerminator()->getSuccessor(1);
+    // Cloned loop exits into the original loop
     L2Latch->getTerminator()->setSuccessor(1, L1PreHeader);
-    L1Latch->getTerminator()->setSuccessor(1, end);
-    L1PrePreHeader->getTerminator()->setSuccessor(0, L2PreHeader);
+    // and is entered instead of the original loop
+    TerminatorInst *T = L1PrePreHeader->getTerminator();
+    for(unsigned int i=0; i<T->getNumSuccessors(); i++) {
+        if(T->getSuccessor(i) == L1PreHeader) {
+            T->setSuccessor(i, L2PreHeader);
+        }
+    }
+
+    // The DominatorTree already has the cloned blocks under L1PrePreHeader,
+    // as if it branched to both loops and the cloned loop had no exit.
+    // Hence only L1's preheader moves under the cloned latch.
+    DT->applyUpdates({
+        {DominatorTree::Insert, L2Latch, L1PreHeader},
+        {DominatorTree::Delete, L1PrePreHeader, L1PreHeader}
+    });
 
 }
 
@@ -49,25 +68,21 @@ void swapLoops(Loop *L1, Loop *L2) {
  *___________________________________________________________*/
 Loop* cloneLoop(Loop *L, LoopInfo *LI, DominatorTree *DT) {
 
-    // Before and after block for the cloned loop
+    // Cloned blocks are laid out before the exit block, and 
+    // are dominated by the block entering the original loop
     BasicBlock *Before = L->getUniqueExitBlock();
-    BasicBlock *LoopDomBB = Before->getUniqueSuccessor();
+    BasicBlock *LoopDomBB = L->getLoopPreheader()->getUniquePredecessor();
 
     ValueToValueMapTy VMap;
     SmallVector< BasicBlock *, 8> blocks;
     
-    // Cloning the loop
-    // Loop* newLoop = cloneLoopWithPreheader(Before, LoopDomBB, L, VMap, Twine(".cl"), LI, DT, blocks);
+    // Cloning the loop, this adds the cloned loop to LoopInfo 
+    // and the cloned blocks to DominatorTree
     Loop* newLoop = cloneLoopWithPreheader(Before, LoopDomBB, L, VMap, Twine(".cl"), LI, DT, blocks);
     // Remapping the blocks in new loop
     remapInstructionsInBlocks(blocks, VMap);
-    
-    // Fixing the successor of the old block to
-    // map to the preHeader of new loop
-    // else it will be mapping to the new loop body
-    L->getLoopLatch()->getTerminator()->setSuccessor(1,newLoop->getLoopPreheader());
 
-    swapLoops(L, newLoop);
+    swapLoops(L, newLoop, DT);
 
     return newLoop;
 }
@@ -121,6 +136,18 @@ Value* IndirectAccessUtils::getIntegerIterator(Loop *L, ScalarEvolution *SE) {
     return nullptr;
 }
 
+ConstantInt* IndirectAccessUtils::getIteratorStep(Loop *L, ScalarEvolution *SE) {
+    Value *iterator = getIntegerIterator(L, SE);
+    if(iterator == nullptr)
+        return nullptr;
+    const SCEVAddRecExpr *AR = dyn_cast<SCEVAddRecExpr>(SE->getSCEV(iterator));
+    if(AR == nullptr || !AR->isAffine())
+        return nullptr;
+    if(const SCEVConstant *step = dyn_cast<SCEVConstant>(AR->getStepRecurrence(*SE)))
+        return step->getValue();
+    return nullptr;
+}
+
 void IndirectAccessUtils::clone(LoopSplitInfo *LSI, 
     LoopInfo *LI, DominatorTree *DT) {
     // This cloned loop is used to populate the array
@@ -154,14 +181,34 @@ void IndirectAccessUtils::clearClonedLoop(LoopSplitInfo *LSI) {
 
 }
 
-Value* IndirectAccessUtils::allocateArrayInEntryBlock(Function *F, int size) {
+void IndirectAccessUtils::removeDeadInstructions(Loop *L) {
+    for(BasicBlock *BB : L->getBlocks()) {
+        // Handles cycles of phi nodes, like the replaced iterator and its increment
+        DeleteDeadPHIs(BB);
+        std::vector<WeakTrackingVH> instructions;
+        for(Instruction &I : *BB) {
+            instructions.push_back(WeakTrackingVH(&I));
+        }
+        for(WeakTrackingVH &V : instructions) {
+            // Can be deleted already as an operand of another dead instruction
+            if(V) {
+                RecursivelyDeleteTriviallyDeadInstructions(V);
+            }
+        }
+    }
+}
+
+Value* IndirectAccessUtils::allocateArrayInEntryBlock(Function *F, int size, 
+    unsigned int bits, unsigned int align) {
     BasicBlock &entryBlock = F->getEntryBlock();
     IRBuilder<> builder(entryBlock.getTerminator());
 
     // Initialising array in loop pre header for indirect access
-    Type* iMAX = Type::getIntNTy(F->getContext(), IndirectAccessUtils::MAX_BITS);
-    AllocaInst* indirectAccessArray = builder.CreateAlloca(ArrayType::get(iMAX, size));
-    // indirectAccessArray->setAlignment(16);
+    Type* iN = Type::getIntNTy(F->getContext(), bits);
+    AllocaInst* indirectAccessArray = builder.CreateAlloca(ArrayType::get(iN, size));
+    if(align > 0) {
+        indirectAccessArray->setAlignment(align);
+    }
     return indirectAccessArray;
 }
 
@@ -171,51 +218,92 @@ void IndirectAccessUtils::populateArray(LoopSplitInfo *LSI,
     
     Type* i32 = Type::getInt32Ty(F->getContext());
     Value* zero = ConstantInt::get(i32, 0);
-    IRBuilder<> headerBuilder(LSI->clonedLoop->getLoopPreheader()->getTerminator());
-
-    // Initialising cnt = 0 in loop pre header
-    // This is the runtime trip count of the loop to avoid any runtime errors
-    // This count is used as loop bound for during indirect access
-    AllocaInst* cnt = headerBuilder.CreateAlloca(i32);
-    headerBuilder.CreateStore(zero, cnt);
-    // cnt->setAlignment(4);
+    BasicBlock *preHeader = LSI->clonedLoop->getLoopPreheader();
+    BasicBlock *loopLatch = LSI->clonedLoop->getLoopLatch();
+    IRBuilder<> headerBuilder(preHeader->getTerminator());
 
     // array[cnt] = iter,  iterator in loop body
-    IRBuilder<> bodyBuilder(LSI->clonedLoop->getLoopPreheader()
-        ->getUniqueSuccessor()->getTerminator());
+    IRBuilder<> bodyBuilder(preHeader->getUniqueSuccessor()->getTerminator());
+    IRBuilder<> latchBuilder(loopLatch->getTerminator());
     // iter
     Value *iterLoad = getIntegerIterator(LSI->clonedLoop, SE);
+    unsigned int iBits = iterLoad->getType()->getPrimitiveSizeInBits();
+
+    Value *countBody;
+    AllocaInst* cnt = nullptr;
+    if(LSI->vectorizeFriendly) {
+        // cnt is a canonical induction variable in a register,
+        // hence the store below is a consecutive store for LoopVectorize
+        Type* i64 = Type::getInt64Ty(F->getContext());
+        IRBuilder<> phiBuilder(preHeader->getUniqueSuccessor()->getFirstNonPHI());
+        PHINode *cntPhi = phiBuilder.CreatePHI(i64, 2);
+        cntPhi->addIncoming(ConstantInt::get(i64, 0), preHeader);
+        // cnt++ in loop latch, it cannot wrap as trip count fits in i64
+        Value *increment = latchBuilder.CreateAdd(cntPhi, ConstantInt::get(i64, 1), "", true, true);
+        cntPhi->addIncoming(increment, loopLatch);
+        countBody = cntPhi;
+        zero = ConstantInt::get(i64, 0);
+        // runtime trip count, unless a constant was already given
+        if(LSI->tripCountValue == nullptr) {
+            LSI->tripCountValue = increment;
+        }
+    } else {
+        // Initialising cnt = 0 in loop pre header
+        // This is the runtime trip count of the loop to avoid any runtime errors
+        // This count is used as loop bound for during indirect access
+        // Allocated in the entry block, as the loop can be nested
+        cnt = ObfuscationUtils::createEntryBlockAlloca(F, i32);
+        headerBuilder.CreateStore(zero, cnt);
+        // cnt->setAlignment(4);
+
+        // cnt
+        countBody = bodyBuilder.CreateLoad(cnt);
+    }
     
-    // cnt
-    Value *countLoadBody = bodyBuilder.CreateLoad(cnt);
-    
+    Value *index = countBody;
+    if(LSI->stride > 1) {
+        // array[cnt/stride] = iter - (cnt%stride)*step
+        // All the stride iterations store the same value, which is 
+        // the iterator of the first of them, hence no branch is needed
+        Type *countType = countBody->getType();
+        Value *strideValue = ConstantInt::get(countType, LSI->stride);
+        index = bodyBuilder.CreateUDiv(countBody, strideValue);
+        Value *rem = bodyBuilder.CreateURem(countBody, strideValue);
+        rem = bodyBuilder.CreateZExtOrTrunc(rem, iterLoad->getType());
+        Value *offset = bodyBuilder.CreateMul(rem, getIteratorStep(LSI->originalLoop, SE));
+        iterLoad = bodyBuilder.CreateSub(iterLoad, offset);
+    }
+
     // array[cnt]
     // GEP needs '0, cnt'
     std::vector<Value*> idxVector;
-    idxVector.push_back(zero); // 0
-    idxVector.push_back(countLoadBody); // cnt
+    // Thread private array (allocateThreadPrivateArray) is a pointer
+    // to its first element, hence needs only 'cnt'
+    if(isa<ArrayType>(cast<PointerType>(indirectAccessArray->getType())->getElementType()))
+        idxVector.push_back(zero); // 0
+    idxVector.push_back(index); // cnt
     ArrayRef<Value*> idxList(idxVector);
     Value *arrayIdx = bodyBuilder.CreateGEP(indirectAccessArray, idxList);
 
     // array[cnt] = iter
-    unsigned int iBits = iterLoad->getType()->getPrimitiveSizeInBits();
-    if(iBits != IndirectAccessUtils::MAX_BITS) {
-        Type* iMAX = Type::getIntNTy(F->getContext(), IndirectAccessUtils::MAX_BITS);
-        iterLoad = bodyBuilder.CreateZExt(iterLoad, iMAX);
+    Type* elementType = cast<PointerType>(arrayIdx->getType())->getElementType();
+    if(iBits != elementType->getPrimitiveSizeInBits()) {
+        iterLoad = bodyBuilder.CreateZExt(iterLoad, elementType);
     }
     bodyBuilder.CreateStore(iterLoad, arrayIdx);
 
     // Type* m = Type::getIntNTy(F->getContext(), iBits);
     // auto *Trunc = bodyBuilder.CreateTrunc(iterLoad, m);
 
-    // cnt++ in loop latch
-    Value* one = ConstantInt::get(i32, 1);
-    IRBuilder<> latchBuilder(LSI->clonedLoop->getLoopLatch()->getTerminator());
-    Value *countLoadLatch = latchBuilder.CreateLoad(cnt);
-    Value *increment = latchBuilder.CreateAdd(countLoadLatch, one);
-    latchBuilder.CreateStore(increment, cnt);
+    if(cnt != nullptr) {
+        // cnt++ in loop latch
+        Value* one = ConstantInt::get(i32, 1);
+        Value *countLoadLatch = latchBuilder.CreateLoad(cnt);
+        Value *increment = latchBuilder.CreateAdd(countLoadLatch, one);
+        latchBuilder.CreateStore(increment, cnt);
 
-    // runtime trip count
-    LSI->tripCountValue = cnt;
+        // runtime trip count
+        LSI->tripCountValue = cnt;
+    }
 
 }
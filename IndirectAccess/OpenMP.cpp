@@ -0,0 +1,173 @@
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/Analysis/ScalarEvolutionExpander.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/LoopUtils.h"
+#include "IndirectAccess/IndirectAccess.h"
+using namespace llvm;
+
+namespace {
+
+// Schedule types of __kmpc_for_static_init_* (kmp.h in the OpenMP runtime)
+// for which every thread gets fixed chunks of the loop
+const int64_t kmp_sch_static_chunked = 33;
+const int64_t kmp_sch_static = 34;
+const int64_t kmp_distribute_static_chunked = 91;
+const int64_t kmp_distribute_static = 92;
+
+bool isStaticSchedule(Value *schedule) {
+    ConstantInt *C = dyn_cast<ConstantInt>(schedule);
+    if(C == nullptr)
+        return false;
+    int64_t type = C->getSExtValue();
+    return type == kmp_sch_static_chunked || type == kmp_sch_static
+        || type == kmp_distribute_static_chunked || type == kmp_distribute_static;
+}
+
+/*___________________________________________________________
+ *
+ * Copies the loop before it is transformed, for the chunks whose
+ * array cannot be allocated. The copy is entered only from entry
+ * and exits into the exit of the loop.
+ *
+ * @param Loop *L, the loop, in LCSSA form with a unique exit
+ * @param BasicBlock *entry, block which branches to the copy
+ * @param LoopInfo *LI, from analysis pass
+ * @param DominatorTree *DT, from analysis pass
+ *
+ * @return Loop*, the copy
+ *___________________________________________________________*/
+Loop* cloneFallbackLoop(Loop *L, BasicBlock *entry, LoopInfo *LI, DominatorTree *DT) {
+    BasicBlock *exit = L->getUniqueExitBlock();
+    BasicBlock *latch = L->getLoopLatch();
+
+    // Cloning the loop, this adds the copy to LoopInfo and its 
+    // blocks to DominatorTree under entry, which dominates it
+    ValueToValueMapTy VMap;
+    SmallVector<BasicBlock*, 8> blocks;
+    Loop *fallback = cloneLoopWithPreheader(exit, entry, L, VMap, Twine(".fb"), LI, DT, blocks);
+    remapInstructionsInBlocks(blocks, VMap);
+
+    // Values of the loop are used after it only in the phi nodes of
+    // its exit (LCSSA), which get the values of the copy too
+    BasicBlock *fallbackLatch = cast<BasicBlock>(VMap[latch]);
+    for(PHINode &phi : exit->phis()) {
+        Value *V = phi.getIncomingValueForBlock(latch);
+        Value *mapped = VMap.lookup(V);
+        phi.addIncoming(mapped != nullptr? mapped: V, fallbackLatch);
+    }
+    // The exit is now dominated by entry
+    DT->applyUpdates({{DominatorTree::Insert, fallbackLatch, exit}});
+
+    return fallback;
+}
+
+} /* namespace */
+
+CallInst* IndirectAccessUtils::getStaticInitCall(Loop *L, DominatorTree *DT) {
+    Function *F = L->getHeader()->getParent();
+    for(BasicBlock &BB : *F) {
+        for(Instruction &I : BB) {
+            CallInst *call = dyn_cast<CallInst>(&I);
+            if(call == nullptr || call->getCalledFunction() == nullptr)
+                continue;
+            // __kmpc_for_static_init_4, _4u, _8, _8u
+            if(!call->getCalledFunction()->getName().startswith("__kmpc_for_static_init_"))
+                continue;
+            // (loc, gtid, schedtype, plastiter, plower, pupper, pstride, incr, chunk)
+            if(call->getNumArgOperands() < 3 || !isStaticSchedule(call->getArgOperand(2)))
+                continue;
+            // The chunk of the thread is known only after the call
+            if(!L->contains(&BB) && DT->dominates(call, L->getHeader()))
+                return call;
+        }
+    }
+    return nullptr;
+}
+
+bool IndirectAccessUtils::isParallelTransform(Loop *L, ScalarEvolution *SE, DominatorTree *DT) {
+    Value *iterator = getIntegerIterator(L, SE);
+    if(iterator == nullptr || iterator->getType()->getPrimitiveSizeInBits() > MAX_BITS)
+        return false;
+    if(getStaticInitCall(L, DT) == nullptr)
+        return false;
+    // Trip count of the chunk, computed from the bounds given by 
+    // the runtime, it is needed before the loop to allocate the array
+    const SCEV *backedgeTakenCount = SE->getBackedgeTakenCount(L);
+    return !isa<SCEVCouldNotCompute>(backedgeTakenCount)
+        && SE->isLoopInvariant(backedgeTakenCount, L)
+        && isSafeToExpand(backedgeTakenCount, *SE)
+        && L->getExitingBlock() == L->getLoopLatch();
+}
+
+Value* IndirectAccessUtils::allocateThreadPrivateArray(LoopSplitInfo *LSI, Function *F, 
+    ScalarEvolution *SE, LoopInfo *LI, DominatorTree *DT, unsigned int bits, unsigned int align) {
+    Loop *L = LSI->originalLoop;
+    Module *M = F->getParent();
+    const DataLayout &DL = M->getDataLayout();
+    LLVMContext &context = F->getContext();
+    Type *intPtr = DL.getIntPtrType(context);
+    Type *iN = Type::getIntNTy(context, bits);
+
+    // The cloned loop is entered first, hence the array 
+    // is allocated in its preheader
+    BasicBlock *preHeader = LSI->clonedLoop->getLoopPreheader();
+    IRBuilder<> builder(preHeader->getTerminator());
+
+    // trip count = backedge taken count + 1, of the chunk of this thread
+    const SCEV *tripCount = SE->getAddExpr(SE->getBackedgeTakenCount(L), 
+        SE->getOne(SE->getBackedgeTakenCount(L)->getType()));
+    tripCount = SE->getZeroExtendExpr(tripCount, intPtr);
+    SCEVExpander expander(*SE, DL, "ia.omp");
+    Value *size = expander.expandCodeFor(tripCount, intPtr, preHeader->getTerminator());
+
+    // Only every stride-th value is stored
+    if(LSI->stride > 1) {
+        size = builder.CreateUDiv(
+            builder.CreateAdd(size, ConstantInt::get(intPtr, LSI->stride - 1)),
+            ConstantInt::get(intPtr, LSI->stride));
+    }
+    // aligned_alloc needs the size to be a multiple of the alignment
+    size = builder.CreateMul(size, ConstantInt::get(intPtr, bits/8));
+    size = builder.CreateAnd(builder.CreateAdd(size, ConstantInt::get(intPtr, align - 1)), 
+        ConstantInt::get(intPtr, ~(uint64_t)(align - 1)));
+
+    // Every thread runs this with its own chunk, hence gets its own buffer,
+    // and buffers of different threads do not share a cache line
+    Type *i8Ptr = Type::getInt8PtrTy(context);
+    Constant *alignedAlloc = M->getOrInsertFunction("aligned_alloc", i8Ptr, intPtr, intPtr);
+    Value *buffer = builder.CreateCall(alignedAlloc, {ConstantInt::get(intPtr, align), size});
+
+    // Freed after the original loop, which always runs after the cloned loop
+    Constant *freeFunction = M->getOrInsertFunction("free", Type::getVoidTy(context), i8Ptr);
+    SmallVector<BasicBlock*, 4> exitBlocks;
+    L->getUniqueExitBlocks(exitBlocks);
+    for(BasicBlock *exit : exitBlocks) {
+        IRBuilder<> exitBuilder(&*exit->getFirstInsertionPt());
+        exitBuilder.CreateCall(freeFunction, {buffer});
+    }
+
+    Value *array = builder.CreateBitCast(buffer, PointerType::getUnqual(iN));
+
+    // aligned_alloc gives null when it fails, the chunk then runs in an
+    // untransformed copy of the loop. The check ends the block of the 
+    // allocation, the rest of the preheader is split from it.
+    BasicBlock *allocation = preHeader;
+    preHeader = SplitBlock(allocation, allocation->getTerminator(), DT, LI);
+    formLCSSA(*L, *DT, LI, SE);
+    LSI->fallbackLoop = cloneFallbackLoop(L, allocation, LI, DT);
+    allocation->getTerminator()->eraseFromParent();
+    IRBuilder<> checkBuilder(allocation);
+    Value *failed = checkBuilder.CreateICmpEQ(buffer, ConstantPointerNull::get(cast<PointerType>(i8Ptr)));
+    BranchInst *check = checkBuilder.CreateCondBr(failed, 
+        LSI->fallbackLoop->getLoopPreheader(), preHeader);
+    ObfuscationUtils::setBranchWeights(check, 
+        ObfuscationUtils::UNLIKELY_WEIGHT, ObfuscationUtils::LIKELY_WEIGHT);
+
+    return array;
+}
@@ -0,0 +1,245 @@
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/Analysis/TargetTransformInfo.h"
+#include "llvm/Analysis/BlockFrequencyInfo.h"
+#include "llvm/IR/DerivedTypes.h"
+#include "IndirectAccess/IndirectAccess.h"
+using namespace llvm;
+
+namespace {
+
+// Cost of the aligned_alloc and free of a thread private array, calls
+// to the allocator, not known to TTI. About the cycles of its fast path
+const double ALLOCATION_COST = 40;
+
+// Frequency of the block relative to the entry block
+double getRelativeFrequency(BasicBlock *BB, BlockFrequencyInfo *BFI) {
+    return (double)BFI->getBlockFreq(BB).getFrequency() / BFI->getEntryFreq();
+}
+
+double getBlockCost(BasicBlock *BB, const TargetTransformInfo *TTI) {
+    double cost = 0;
+    for(Instruction &I : *BB) {
+        cost += TTI->getUserCost(&I);
+    }
+    return cost;
+}
+
+// Widest vector in the loop, 1 if loop is not vectorized
+unsigned int getVectorWidth(Loop *L) {
+    unsigned int width = 1;
+    for(BasicBlock *BB : L->getBlocks()) {
+        for(Instruction &I : *BB) {
+            if(VectorType *VTy = dyn_cast<VectorType>(I.getType())) {
+                width = std::max(width, VTy->getNumElements());
+            }
+        }
+    }
+    return width;
+}
+
+} /* namespace */
+
+double IndirectAccessUtils::getFunctionCost(Function *F, 
+    const TargetTransformInfo *TTI, BlockFrequencyInfo *BFI) {
+    double cost = 0;
+    for(BasicBlock &BB : *F) {
+        cost += getBlockCost(&BB, TTI) * getRelativeFrequency(&BB, BFI);
+    }
+    return cost;
+}
+
+void IndirectAccessUtils::estimateOverhead(LoopSplitInfo *LSI, ScalarEvolution *SE, 
+    const TargetTransformInfo *TTI, BlockFrequencyInfo *BFI) {
+
+    Loop *L = LSI->originalLoop;
+    LLVMContext &context = L->getHeader()->getContext();
+    Type *iterType = getIntegerIterator(L, SE)->getType();
+    Type *i32 = Type::getInt32Ty(context);
+    Type *iPhi = LSI->vectorizeFriendly? Type::getInt64Ty(context): i32;
+    Type *iArray = LSI->vectorizeFriendly? iterType: Type::getIntNTy(context, MAX_BITS);
+
+    // Number of iterations per call of the function
+    double iterations = getRelativeFrequency(L->getHeader(), BFI);
+
+    LSI->loopCost = 0;
+    for(BasicBlock *BB : L->getBlocks()) {
+        LSI->loopCost += getBlockCost(BB, TTI) * getRelativeFrequency(BB, BFI);
+    }
+
+    // Cost added to every iteration of the original loop, 
+    // phi nodes are free: counter++, counter < bound
+    double perIteration = TTI->getArithmeticInstrCost(Instruction::Add, iPhi)
+        + TTI->getCmpSelInstrCost(Instruction::ICmp, iPhi);
+    // Cost of the cloned loop per iteration
+    double populatePerIteration = 0;
+    if(LSI->inRegister) {
+        // extractelement from lane 0 and rotate of the vector
+        Type *vecType = VectorType::get(iterType, LSI->lanes);
+        perIteration += TTI->getVectorInstrCost(Instruction::ExtractElement, vecType, 0)
+            + TTI->getShuffleCost(TargetTransformInfo::SK_PermuteSingleSrc, vecType, 0, nullptr);
+    } else {
+        // load of array[counter], once in stride iterations
+        perIteration += TTI->getMemoryOpCost(Instruction::Load, iArray, 0, 0) / LSI->stride;
+        if(iArray != iterType) {
+            perIteration += TTI->getCastInstrCost(Instruction::Trunc, iterType, iArray);
+        }
+        // cloned loop keeps the control flow of the loop 
+        // and stores array[cnt] = iter
+        populatePerIteration = getBlockCost(L->getLoopLatch(), TTI)
+            + TTI->getMemoryOpCost(Instruction::Store, iArray, 0, 0)
+            + TTI->getArithmeticInstrCost(Instruction::Add, iPhi);
+        if(LSI->stride > 1) {
+            // counter%stride == 0, previous + step and the branch, 
+            // counter/stride once in stride iterations
+            perIteration += TTI->getArithmeticInstrCost(Instruction::URem, iPhi)
+                + TTI->getCmpSelInstrCost(Instruction::ICmp, iPhi)
+                + TTI->getArithmeticInstrCost(Instruction::Add, iterType)
+                + TTI->getCFInstrCost(Instruction::Br)
+                + TTI->getArithmeticInstrCost(Instruction::UDiv, iPhi) / LSI->stride;
+            // array[cnt/stride] = iter - (cnt%stride)*step
+            populatePerIteration += TTI->getArithmeticInstrCost(Instruction::UDiv, iPhi)
+                + TTI->getArithmeticInstrCost(Instruction::URem, iPhi)
+                + TTI->getArithmeticInstrCost(Instruction::Mul, iterType)
+                + TTI->getArithmeticInstrCost(Instruction::Sub, iterType);
+        }
+        if(!LSI->vectorizeFriendly) {
+            // cnt is loaded twice and stored once in cloned loop, 
+            // and loaded once in original loop
+            double memoryOp = TTI->getMemoryOpCost(Instruction::Load, i32, 0, 0);
+            perIteration += memoryOp;
+            populatePerIteration += 3*memoryOp;
+        }
+    }
+
+    // A vectorized loop does every scalar operation added by 
+    // the transform once per element
+    double width = getVectorWidth(L);
+    LSI->iterationOverhead = (perIteration + populatePerIteration) * width;
+    LSI->overhead = iterations * LSI->iterationOverhead;
+    if(LSI->threadPrivate) {
+        // Array of the chunk allocated and freed every time the loop is
+        // entered, its size: trip count, rounding to cache lines, and 
+        // the check of the allocation
+        double entries = getRelativeFrequency(L->getLoopPreheader(), BFI);
+        double size = TTI->getArithmeticInstrCost(Instruction::Add, iterType)
+            + TTI->getArithmeticInstrCost(Instruction::Mul, iterType)
+            + TTI->getArithmeticInstrCost(Instruction::And, iterType);
+        double check = TTI->getCmpSelInstrCost(Instruction::ICmp, Type::getInt8PtrTy(context))
+            + TTI->getCFInstrCost(Instruction::Br);
+        LSI->overhead += entries * (ALLOCATION_COST + size + check);
+    }
+}
+
+ObfuscationCost IndirectAccessUtils::estimateSize(LoopSplitInfo *LSI, ScalarEvolution *SE, 
+    const TargetTransformInfo *TTI) {
+    Loop *L = LSI->originalLoop;
+    LLVMContext &context = L->getHeader()->getContext();
+    PHINode *iterator = cast<PHINode>(getIntegerIterator(L, SE));
+    Type *iterType = iterator->getType();
+    Type *iArray = LSI->vectorizeFriendly? iterType: Type::getIntNTy(context, MAX_BITS);
+    Type *iPhi = LSI->vectorizeFriendly? Type::getInt64Ty(context): Type::getInt32Ty(context);
+    // The iterator, its increment and the compare of the latch are 
+    // dead after the transform (removeDeadInstructions)
+    std::vector<unsigned int> removed = {Instruction::PHI, Instruction::Add, Instruction::ICmp};
+    ObfuscationCost cost;
+
+    if(LSI->inRegister) {
+        // updateIndirectAccessInRegister: counter and vector phis, 
+        // extractelement of lane 0, counter++, rotate and the compare
+        std::vector<unsigned int> added = {Instruction::PHI, Instruction::PHI, 
+            Instruction::ExtractElement, Instruction::Add, Instruction::ShuffleVector, Instruction::ICmp};
+        // splat(start) + offsets in the preheader, unless start is a constant
+        if(!isa<Constant>(iterator->getIncomingValueForBlock(L->getLoopPreheader()))) {
+            added.insert(added.end(), {Instruction::InsertElement, 
+                Instruction::ShuffleVector, Instruction::Add});
+        }
+        cost = ObfuscationUtils::getReplacementCost(added, removed, iterType, TTI);
+        cost.cycles = cost.latency = 0;
+        return cost;
+    }
+
+    // clearClonedLoop: the cloned loop keeps the preheader and the latch,
+    // the phi nodes of the header and the terminators of the other blocks
+    BasicBlock *header = L->getHeader();
+    cost.size = L->getLoopPreheader()->size();
+    for(BasicBlock *BB : L->getBlocks()) {
+        if(BB == L->getLoopLatch()) {
+            cost.size += BB->size();
+            continue;
+        }
+        cost.size++;
+        if(BB == header) {
+            cost.size += std::distance(header->phis().begin(), header->phis().end());
+        }
+    }
+    cost.blocks = L->getNumBlocks() + 1;
+
+    // populateArray: array[cnt] = iter
+    std::vector<unsigned int> populate = {Instruction::GetElementPtr, Instruction::Store};
+    // updateIndirectAccess: phi, array[phi], phi++ and the compare with the trip count
+    std::vector<unsigned int> update = {Instruction::PHI, Instruction::GetElementPtr, 
+        Instruction::Load, Instruction::Add, Instruction::ICmp};
+    if(iArray != iterType) {
+        populate.push_back(Instruction::ZExt);
+        update.push_back(Instruction::Trunc);
+    }
+    if(LSI->vectorizeFriendly) {
+        // cnt phi and cnt++
+        populate.insert(populate.end(), {Instruction::PHI, Instruction::Add});
+    } else {
+        // cnt in the entry block, cnt = 0, the load of cnt for the 
+        // store, cnt++ in the latch, and the load of the trip count 
+        // in the original loop
+        populate.insert(populate.end(), {Instruction::Alloca, Instruction::Store, 
+            Instruction::Load, Instruction::Load, Instruction::Add, Instruction::Store});
+        update.push_back(Instruction::Load);
+    }
+    if(LSI->stride > 1) {
+        // array[cnt/stride] = iter - (cnt%stride)*step
+        populate.insert(populate.end(), {Instruction::UDiv, Instruction::URem, 
+            Instruction::Mul, Instruction::Sub});
+        if(iPhi != iterType) {
+            populate.push_back(Instruction::ZExt);
+        }
+        // previous iterator, phi%stride == 0, previous + step and the 
+        // branch in the header, the reload block with array[phi/stride],
+        // and the merge phi in the rest of the header
+        update.insert(update.end(), {Instruction::PHI, Instruction::URem, Instruction::ICmp, 
+            Instruction::Add, Instruction::Br, Instruction::UDiv, Instruction::Br, Instruction::PHI});
+        cost.blocks += 2;
+    }
+    cost += ObfuscationUtils::getReplacementCost(populate, {}, iterType, TTI);
+    cost += ObfuscationUtils::getReplacementCost(update, removed, iterType, TTI);
+
+    if(LSI->threadPrivate) {
+        // allocateThreadPrivateArray: trip count of the chunk, its size 
+        // rounded to cache lines, aligned_alloc and the bitcast, the 
+        // check of the allocation, and free in every exit
+        std::vector<unsigned int> allocate = {Instruction::Add, Instruction::ZExt, 
+            Instruction::Mul, Instruction::Add, Instruction::And, Instruction::Call, 
+            Instruction::BitCast, Instruction::ICmp, Instruction::Br};
+        if(LSI->stride > 1) {
+            allocate.insert(allocate.end(), {Instruction::Add, Instruction::UDiv});
+        }
+        SmallVector<BasicBlock*, 4> exitBlocks;
+        L->getUniqueExitBlocks(exitBlocks);
+        allocate.insert(allocate.end(), exitBlocks.size(), Instruction::Call);
+        cost += ObfuscationUtils::getReplacementCost(allocate, {}, iterType, TTI);
+        // untransformed copy of the loop with its preheader, run when 
+        // the allocation fails, and the preheader split for the check
+        std::vector<BasicBlock*> copied(L->block_begin(), L->block_end());
+        copied.push_back(L->getLoopPreheader());
+        for(BasicBlock *BB : copied) {
+            for(Instruction &I : *BB) {
+                cost.size++;
+                if(isa<LoadInst>(&I) || isa<StoreInst>(&I))
+                    cost.memoryOps++;
+            }
+        }
+        cost.blocks += L->getNumBlocks() + 2;
+    }
+    // Per iteration, given by estimateOverhead
+    cost.cycles = cost.latency = 0;
+    return cost;
+}
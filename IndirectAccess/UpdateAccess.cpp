@@ -1,10 +1,13 @@
 #include "llvm/Analysis/LoopInfo.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include "llvm/IR/Constants.h"
 #include "IndirectAccess/IndirectAccess.h"
 using namespace llvm;
 
-void IndirectAccessUtils::updateIndirectAccess(LoopSplitInfo* LSI, Function* F, Value *array, ScalarEvolution *SE) {
+
+void IndirectAccessUtils::updateIndirectAccess(LoopSplitInfo* LSI, Function* F, Value *array, 
+    ScalarEvolution *SE, LoopInfo *LI, DominatorTree *DT) {
 	if(LSI->clonedLoop==nullptr)
 		return;
     
@@ -13,46 +16,177 @@ void IndirectAccessUtils::updateIndirectAccess(LoopSplitInfo* LSI, Function* F,
     Loop* L = LSI->originalLoop;
     Value* tripcount = LSI->tripCountValue;  // Loop trip count
     BasicBlock *preHeader = L->getLoopPreheader(); // Loop preheader
-    BasicBlock *loopLatch = L->getLoopLatch();  // Loop latch
+    BasicBlock *header = preHeader->getUniqueSuccessor(); // Loop header
 
     // Creating a new variable to iterate loop, initialized with 0
-    Type* i32 = Type::getInt32Ty(F->getContext());
-    Value* zero = ConstantInt::get(i32, 0);
+    // In vectorization friendly mode this is a canonical i64 induction
+    // variable which cannot wrap, hence array[phi] is a consecutive access
+    Type* iPhi = LSI->vectorizeFriendly? Type::getInt64Ty(F->getContext()): Type::getInt32Ty(F->getContext());
+    Value* zero = ConstantInt::get(iPhi, 0);
+    Type* iOriginal = iterator->getType();
 
     // Adding out phi node for iteration in the begining of the loop body
-    IRBuilder<> Builder(preHeader->getUniqueSuccessor()->getFirstNonPHI());
-    PHINode *phi = Builder.CreatePHI(i32, 2);
+    IRBuilder<> Builder(header->getFirstNonPHI());
+    PHINode *phi = Builder.CreatePHI(iPhi, 2);
     phi->addIncoming(zero, preHeader);
 
-    // For incrementing the iterator and changing conditions of loop
-    IRBuilder<> latchBuilder(loopLatch->getTerminator());
-    Value* one = ConstantInt::get(i32, 1);
-    Value *increment = latchBuilder.CreateAdd(phi, one);
-    phi->addIncoming(increment,loopLatch);
+    // With stride, the iterator of previous iteration is kept in a register
+    PHINode *previous = nullptr;
+    Value *next = nullptr;
+    Value *strideValue = ConstantInt::get(iPhi, LSI->stride);
+    if(LSI->stride > 1) {
+        previous = Builder.CreatePHI(iOriginal, 2);
+        // First iteration always loads from the array
+        previous->addIncoming(UndefValue::get(iOriginal), preHeader);
+        // if(phi%stride == 0) iter = array[phi/stride]
+        // else iter = previous + step
+        Value *isLoad = Builder.CreateICmpEQ(Builder.CreateURem(phi, strideValue), zero);
+        next = Builder.CreateAdd(previous, getIteratorStep(L, SE));
+
+        // Rest of the header moves to a new block, and the load 
+        // from the array is done in another block before it
+        BasicBlock *rest = SplitBlock(header, cast<Instruction>(next)->getNextNode(), DT, LI);
+        BasicBlock *reload = BasicBlock::Create(F->getContext(), "ia.reload", F, rest);
+        L->addBasicBlockToLoop(reload, *LI);
+        if(DT != nullptr) {
+            DT->addNewBlock(reload, header);
+        }
+        header->getTerminator()->eraseFromParent();
+        // array[phi/stride] is loaded once every stride iterations
+        ObfuscationUtils::setBranchWeights(BranchInst::Create(reload, rest, isLoad, header), 
+            1, LSI->stride - 1);
+        Builder.SetInsertPoint(BranchInst::Create(rest, reload));
+    }
 
     // Adding getelementptr to get the value from the array
+    Value *index = phi;
+    if(LSI->stride > 1) {
+        index = Builder.CreateUDiv(phi, strideValue);
+    }
     std::vector<Value*> idxVector;
-    idxVector.push_back(zero);
-    idxVector.push_back(phi);
+    if(isa<ArrayType>(cast<PointerType>(array->getType())->getElementType()))
+        idxVector.push_back(zero);
+    idxVector.push_back(index);
     ArrayRef<Value*> idxList(idxVector);
     Value *arrayIdx = Builder.CreateGEP(array, idxList);
     Value *indirectAccess = Builder.CreateLoad(arrayIdx);
     
     // Fixing the bits in the integer
-    unsigned int iBits = iterator->getType()->getPrimitiveSizeInBits();
-    if(iBits != IndirectAccessUtils::MAX_BITS) {
+    unsigned int iBits = iOriginal->getPrimitiveSizeInBits();
+    if(iBits != indirectAccess->getType()->getPrimitiveSizeInBits()) {
         // integer was smaller, hence truncate
-        Type* iOriginal = Type::getIntNTy(F->getContext(), iBits);
         indirectAccess = Builder.CreateTrunc(indirectAccess, iOriginal);
     }
 
+    if(LSI->stride > 1) {
+        // iter = phi%stride == 0? array[phi/stride]: previous + step
+        BasicBlock *reload = Builder.GetInsertBlock();
+        BasicBlock *rest = reload->getSingleSuccessor();
+        IRBuilder<> restBuilder(&rest->front());
+        PHINode *merged = restBuilder.CreatePHI(iOriginal, 2);
+        merged->addIncoming(indirectAccess, reload);
+        merged->addIncoming(next, header);
+        indirectAccess = merged;
+    }
+
+    // Header could have been the latch before split
+    BasicBlock *loopLatch = L->getLoopLatch();  // Loop latch
+    if(previous != nullptr) {
+        previous->addIncoming(indirectAccess, loopLatch);
+    }
+
+    // For incrementing the iterator and changing conditions of loop
+    IRBuilder<> latchBuilder(loopLatch->getTerminator());
+    Value* one = ConstantInt::get(iPhi, 1);
+    Value *increment = latchBuilder.CreateAdd(phi, one, "", 
+        LSI->vectorizeFriendly, LSI->vectorizeFriendly);
+    phi->addIncoming(increment,loopLatch);
+
     //Replacing all the uses of previous iterator with new one
     iterator->replaceAllUsesWith(indirectAccess);
 
     // Changing compare imstruction of the loop
-    Value *tripcnt = latchBuilder.CreateLoad(tripcount);
+    Value *tripcnt = tripcount;
+    if(!LSI->vectorizeFriendly) {
+        tripcnt = latchBuilder.CreateLoad(tripcount);
+    }
     Value *cmpInst = latchBuilder.CreateICmpSLT(increment,tripcnt);
-    Instruction* I = L->getLoopLatch()->getTerminator();
+    Instruction* I = loopLatch->getTerminator();
     I->setOperand(0,cmpInst);
 
 }
+
+void IndirectAccessUtils::updateIndirectAccessInRegister(LoopSplitInfo* LSI, Function* F, ScalarEvolution *SE, bool permute) {
+    Loop* L = LSI->originalLoop;
+    PHINode *iterator = cast<PHINode>(getIntegerIterator(L, SE));
+    BasicBlock *preHeader = L->getLoopPreheader(); // Loop preheader
+    BasicBlock *loopLatch = L->getLoopLatch();  // Loop latch
+    unsigned int tripCount = SE->getSmallConstantTripCount(L);
+
+    // iterator = start + k*step, for k = 0 to tripCount-1
+    APInt step = getIteratorStep(L, SE)->getValue();
+    Value *start = iterator->getIncomingValueForBlock(preHeader);
+
+    // Number of lanes is a power of 2, hence (k*multiplier)%lanes 
+    // visits every lane once for any odd multiplier. It fits in a 
+    // vector register, see isRegisterTransform
+    unsigned int lanes = LSI->lanes;
+    unsigned int multiplier = 1;
+    if(permute && lanes > 2) {
+        ObfuscationRandom random("indirect-access", getLoopOrigin(L));
+        multiplier = (random.next() % (lanes/2))*2 + 1;
+    }
+    Type* iterType = iterator->getType();
+    Type* vecType = VectorType::get(iterType, lanes);
+
+    // offsets[(k*multiplier)%lanes] = k*step
+    std::vector<Constant*> offsets(lanes);
+    for(unsigned int k=0; k<lanes; k++) {
+        offsets[(k*multiplier)%lanes] = ConstantInt::get(iterType, step*k);
+    }
+    Constant *offsetVector = ConstantVector::get(offsets);
+
+    // indices = splat(start) + offsets
+    Value *indices;
+    if(Constant *startConst = dyn_cast<Constant>(start)) {
+        // Whole vector is a constant
+        indices = ConstantExpr::getAdd(ConstantVector::getSplat(lanes, startConst), offsetVector);
+    } else {
+        // Built from the start value with an insert and a shuffle
+        IRBuilder<> preHeaderBuilder(preHeader->getTerminator());
+        indices = preHeaderBuilder.CreateAdd(preHeaderBuilder.CreateVectorSplat(lanes, start), offsetVector);
+    }
+
+    // Adding phi nodes for counting the iterations and 
+    // for the rotated indices in the begining of the loop body
+    Type* i32 = Type::getInt32Ty(F->getContext());
+    Value* zero = ConstantInt::get(i32, 0);
+    IRBuilder<> Builder(preHeader->getUniqueSuccessor()->getFirstNonPHI());
+    PHINode *phi = Builder.CreatePHI(i32, 2);
+    phi->addIncoming(zero, preHeader);
+    PHINode *vecPhi = Builder.CreatePHI(vecType, 2);
+    vecPhi->addIncoming(indices, preHeader);
+
+    // Iterator for this iteration is always in lane 0
+    Value *indirectAccess = Builder.CreateExtractElement(vecPhi, (uint64_t)0);
+
+    // Incrementing the counter and rotating the indices by multiplier lanes
+    IRBuilder<> latchBuilder(loopLatch->getTerminator());
+    Value* one = ConstantInt::get(i32, 1);
+    Value *increment = latchBuilder.CreateAdd(phi, one);
+    phi->addIncoming(increment,loopLatch);
+    std::vector<uint32_t> mask(lanes);
+    for(unsigned int j=0; j<lanes; j++) {
+        mask[j] = (j+multiplier)%lanes;
+    }
+    Value *rotated = latchBuilder.CreateShuffleVector(vecPhi, UndefValue::get(vecType), mask);
+    vecPhi->addIncoming(rotated, loopLatch);
+
+    //Replacing all the uses of previous iterator with new one
+    iterator->replaceAllUsesWith(indirectAccess);
+
+    // Changing compare imstruction of the loop
+    Value *cmpInst = latchBuilder.CreateICmpSLT(increment, ConstantInt::get(i32, tripCount));
+    Instruction* I = loopLatch->getTerminator();
+    I->setOperand(0,cmpInst);
+}
@@ -0,0 +1,157 @@
+#include "llvm/Pass.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Metadata.h"
+#include "llvm/IR/DebugLoc.h"
+#include "llvm/IR/DerivedTypes.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Support/raw_ostream.h"
+#include "IndirectAccess/IndirectAccess.h"
+#include <map>
+using namespace llvm;
+
+namespace {
+
+// Name of the loop metadata added by IndirectAccessUtils::tagLoop
+const char *TAG_NAME = "indirect.access";
+
+/*___________________________________________________________
+ *
+ * Gives the "indirect.access" tag of the loop if present
+ *
+ * @param Loop *L, the loop to check
+ *
+ * @return MDNode*, !{"indirect.access", role, origin} or nullptr
+ *___________________________________________________________*/
+MDNode* getTag(Loop *L) {
+    MDNode *loopID = L->getLoopID();
+    if(loopID == nullptr)
+        return nullptr;
+    // Operand 0 is the loop id itself
+    for(unsigned int i=1; i<loopID->getNumOperands(); i++) {
+        MDNode *node = dyn_cast<MDNode>(loopID->getOperand(i));
+        if(node == nullptr || node->getNumOperands() != 3)
+            continue;
+        MDString *name = dyn_cast<MDString>(node->getOperand(0));
+        if(name != nullptr && name->getString() == TAG_NAME)
+            return node;
+    }
+    return nullptr;
+}
+
+/*___________________________________________________________
+ *
+ * LoopVectorize keeps the loop metadata of the scalar loop on
+ * the vector loop. Hence the vector loop is the one with the
+ * vector instructions, and the VF is their number of elements
+ *
+ * @param Loop *L, the loop to check
+ *
+ * @return unsigned int, the VF, 1 if the loop is scalar
+ *___________________________________________________________*/
+unsigned int getVectorizationFactor(Loop *L) {
+    unsigned int VF = 1;
+    for(BasicBlock *BB : L->getBlocks()) {
+        for(Instruction &I : *BB) {
+            if(VectorType *VTy = dyn_cast<VectorType>(I.getType())) {
+                if(VTy->getNumElements() > VF)
+                    VF = VTy->getNumElements();
+            }
+        }
+    }
+    return VF;
+}
+
+void getInnerMostLoops(Loop *L, std::vector<Loop*> *loops) {
+    if(L->empty()) {
+        loops->push_back(L);
+        return;
+    }
+    for(Loop *NL : *L) {
+        getInnerMostLoops(NL, loops);
+    }
+}
+
+} /* namespace */
+
+std::string IndirectAccessUtils::getLoopOrigin(Loop *L) {
+    std::string origin;
+    raw_string_ostream OS(origin);
+    OS << L->getHeader()->getParent()->getName() << ":";
+    if(DebugLoc DL = L->getStartLoc()) {
+        DL.print(OS);
+    } else {
+        L->getHeader()->printAsOperand(OS, false);
+    }
+    return OS.str();
+}
+
+void IndirectAccessUtils::tagLoop(Loop *L, StringRef role, StringRef origin) {
+    LLVMContext &context = L->getHeader()->getContext();
+    // Reserve space for the loop id
+    SmallVector<Metadata*, 4> MDs(1);
+    if(MDNode *loopID = L->getLoopID()) {
+        for(unsigned int i=1; i<loopID->getNumOperands(); i++) {
+            // Replacing an older tag, the loop could be cloned from a tagged loop
+            MDNode *node = dyn_cast<MDNode>(loopID->getOperand(i));
+            MDString *name = node && node->getNumOperands()>0? 
+                dyn_cast<MDString>(node->getOperand(0)): nullptr;
+            if(name == nullptr || name->getString() != TAG_NAME)
+                MDs.push_back(loopID->getOperand(i));
+        }
+    }
+    Metadata *tag[] = {
+        MDString::get(context, TAG_NAME), 
+        MDString::get(context, role), 
+        MDString::get(context, origin)
+    };
+    MDs.push_back(MDNode::get(context, tag));
+    MDNode *newLoopID = MDNode::get(context, MDs);
+    // Set operand 0 to refer to the loop id itself
+    newLoopID->replaceOperandWith(0, newLoopID);
+    L->setLoopID(newLoopID);
+}
+
+bool IndirectAccessVectorizationReport::runOnFunction(Function &F) {
+    LoopInfo &LI = getAnalysis<LoopInfoWrapperPass>().getLoopInfo();
+
+    std::vector<Loop*> loops;
+    for(Loop *L : LI) {
+        getInnerMostLoops(L, &loops);
+    }
+
+    // (origin, role) -> VF
+    // LoopVectorize leaves the vector loop and the scalar remainder
+    // with the same tag, hence taking the max over them
+    std::map<std::pair<std::string, std::string>, unsigned int> report;
+    for(Loop *L : loops) {
+        std::string origin, role;
+        if(MDNode *tag = getTag(L)) {
+            role = cast<MDString>(tag->getOperand(1))->getString();
+            origin = cast<MDString>(tag->getOperand(2))->getString();
+        } else {
+            role = "original";
+            origin = IndirectAccessUtils::getLoopOrigin(L);
+        }
+        unsigned int &VF = report[std::make_pair(origin, role)];
+        VF = std::max(VF, getVectorizationFactor(L));
+    }
+
+    for(auto &it : report) {
+        errs() << "indirect-access-vec-report: " << it.first.first 
+               << " " << it.first.second
+               << (it.second > 1? " vectorized VF=": " not-vectorized VF=")
+               << it.second << "\n";
+    }
+
+    return false;
+}
+
+void IndirectAccessVectorizationReport::getAnalysisUsage(AnalysisUsage &AU) const {
+    AU.addRequired<LoopInfoWrapperPass>();
+    AU.setPreservesAll();
+}
+
+// Registering the pass
+char IndirectAccessVectorizationReport::ID = 0;
+static RegisterPass<IndirectAccessVectorizationReport> Y("indirect-access-vec-report", 
+    "Reports vectorization of loops before and after indirect access", false, true);
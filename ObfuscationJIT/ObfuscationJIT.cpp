@@ -0,0 +1,77 @@
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/TargetTransformInfo.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/PassRegistry.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Transforms/Scalar.h"
+#include "ObfuscationJIT/ObfuscationJIT.h"
+using namespace llvm;
+
+#define DEBUG_TYPE "obf-jit"
+
+STATISTIC(NumPrepared, "Modules transformed by the module passes before partitioning");
+STATISTIC(NumPartitions, "Partitions transformed at their first call");
+
+ObfuscationTransform::ObfuscationTransform(TargetMachine &TM): TM(&TM) {}
+
+Expected<ObfuscationTransform> ObfuscationTransform::create(TargetMachine &TM, ArrayRef<std::string> passNames) {
+    ObfuscationTransform transform(TM);
+    PassRegistry &registry = *PassRegistry::getPassRegistry();
+    for(const std::string &name : passNames) {
+        const PassInfo *info = registry.getPassInfo(name);
+        if(info == nullptr || info->getNormalCtor() == nullptr)
+            return make_error<StringError>("unknown pass " + name, inconvertibleErrorCode());
+        // The kind is only known from an instance
+        std::unique_ptr<Pass> pass(info->createPass());
+        if(pass->getPassKind() == PT_Module) {
+            transform.modulePasses.push_back(info);
+        } else {
+            transform.functionPasses.push_back(info);
+        }
+        transform.allPasses.push_back(info);
+    }
+    return std::move(transform);
+}
+
+void ObfuscationTransform::run(Module &M, ArrayRef<const PassInfo*> passes) {
+    if(passes.empty())
+        return;
+    legacy::PassManager PM;
+    PM.add(createTargetTransformInfoWrapperPass(TM->getTargetIRAnalysis()));
+    // Same as opt -mem2reg, the passes expect the values in registers
+    PM.add(createPromoteMemoryToRegisterPass());
+    for(const PassInfo *info : passes) {
+        // Loops of -indirect-access are expected in rotated form
+        if(info->getPassArgument() == "indirect-access")
+            PM.add(createLoopRotatePass());
+        PM.add(info->createPass());
+    }
+    PM.run(M);
+}
+
+void ObfuscationTransform::prepareModule(Module &M) {
+    if(modulePasses.empty())
+        return;
+    run(M, modulePasses);
+    NumPrepared++;
+}
+
+std::shared_ptr<Module> ObfuscationTransform::operator()(std::shared_ptr<Module> M) {
+    // The module of the globals has no function to transform
+    bool hasDefinitions = false;
+    for(Function &F : *M) {
+        hasDefinitions |= !F.isDeclaration();
+    }
+    if(!hasDefinitions || functionPasses.empty())
+        return M;
+    DEBUG(dbgs() << "obf-jit: transforming partition " << M->getName() << "\n");
+    run(*M, functionPasses);
+    NumPartitions++;
+    return M;
+}
+
+void ObfuscationTransform::runAll(Module &M) {
+    run(M, allPasses);
+}
+
+#undef DEBUG_TYPE
@@ -0,0 +1,57 @@
+/*
+ * Runtime of -obf-instrument: writes the counters of the obfuscation
+ * sites of every instrumented module at exit.
+ *
+ * The counters are appended to the file in $OBF_COUNTERS_FILE (default
+ * obf-counters.tsv), one line per site with a non zero counter:
+ *     module site instructions
+ * where instructions is the number of instructions executed by the
+ * site, and site is the id in the map of -obf-site-map-file for the module.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+struct obf_module {
+    uint64_t *counters;
+    uint32_t numCounters;
+    const char *name;
+    struct obf_module *next;
+};
+
+static struct obf_module *modules = NULL;
+
+static void obf_write_counters(void) {
+    const char *path = getenv("OBF_COUNTERS_FILE");
+    if(path == NULL)
+        path = "obf-counters.tsv";
+    FILE *out = fopen(path, "a");
+    if(out == NULL) {
+        perror(path);
+        return;
+    }
+    for(struct obf_module *module = modules; module != NULL; module = module->next) {
+        /* counters[0] is not a site */
+        for(uint32_t site = 1; site < module->numCounters; site++) {
+            if(module->counters[site] != 0) {
+                fprintf(out, "%s\t%u\t%llu\n", module->name, site,
+                    (unsigned long long)module->counters[site]);
+            }
+        }
+    }
+    fclose(out);
+}
+
+/* Called by the constructor added to every instrumented module */
+void __obf_register_counters(uint64_t *counters, uint32_t numCounters, const char *name) {
+    struct obf_module *module = malloc(sizeof(struct obf_module));
+    if(module == NULL)
+        return;
+    if(modules == NULL)
+        atexit(obf_write_counters);
+    module->counters = counters;
+    module->numCounters = numCounters;
+    module->name = name;
+    module->next = modules;
+    modules = module;
+}
@@ -0,0 +1,353 @@
+#include "llvm/ADT/SetVector.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/DerivedTypes.h"
+#include "llvm/IR/GlobalVariable.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MD5.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/ValueMapper.h"
+#include "ObfuscationUtils/ObfuscationUtils.h"
+using namespace llvm;
+
+#define DEBUG_TYPE "obf-cache"
+
+STATISTIC(NumHits, "Functions loaded from the obfuscation cache");
+STATISTIC(NumMisses, "Functions not found in the obfuscation cache");
+STATISTIC(NumStored, "Functions stored in the obfuscation cache");
+
+cl::opt<std::string> cacheDirectory("obf-cache-dir",
+    cl::desc("Cache the obfuscated functions in the directory, for incremental builds"),
+    cl::value_desc("directory"));
+
+namespace {
+
+// Changed with the format of the entries, or the code emitted by the passes
+const char *CACHE_VERSION = "3";
+
+bool hasDebugInfo(Function &F) {
+    if(F.getSubprogram() != nullptr)
+        return true;
+    for(BasicBlock &BB : F) {
+        for(Instruction &I : BB) {
+            if(I.getDebugLoc() || isa<DbgInfoIntrinsic>(&I))
+                return true;
+        }
+    }
+    return false;
+}
+
+// Identified structs used by T, their bodies are not in the printed function
+void collectStructs(Type *T, SetVector<StructType*> &structs) {
+    StructType *ST = dyn_cast<StructType>(T);
+    if(ST != nullptr && !ST->isLiteral() && !structs.insert(ST))
+        return;
+    for(Type *contained : T->subtypes()) {
+        collectStructs(contained, structs);
+    }
+}
+
+// Globals used by C, looking through the constant expressions
+void collectGlobals(Constant *C, SetVector<GlobalValue*> &globals, SmallPtrSetImpl<Constant*> &visited) {
+    if(!visited.insert(C).second)
+        return;
+    if(GlobalValue *GV = dyn_cast<GlobalValue>(C)) {
+        globals.insert(GV);
+        return;
+    }
+    for(Use &U : C->operands()) {
+        collectGlobals(cast<Constant>(U.get()), globals, visited);
+    }
+}
+
+// false if F uses a constant which cannot be declared in another module
+bool collectGlobals(Function &F, SetVector<GlobalValue*> &globals) {
+    SmallPtrSet<Constant*, 32> visited;
+    if(F.hasPersonalityFn())
+        collectGlobals(F.getPersonalityFn(), globals, visited);
+    for(BasicBlock &BB : F) {
+        for(Instruction &I : BB) {
+            for(Use &U : I.operands()) {
+                if(Constant *C = dyn_cast<Constant>(U.get())) {
+                    collectGlobals(C, globals, visited);
+                }
+            }
+        }
+    }
+    for(Constant *C : visited) {
+        if(isa<BlockAddress>(C))
+            return false;
+    }
+    for(GlobalValue *GV : globals) {
+        if(!GV->hasName() || isa<GlobalIndirectSymbol>(GV))
+            return false;
+    }
+    return true;
+}
+
+std::string getEntryPath(StringRef key) {
+    SmallString<256> path(cacheDirectory);
+    sys::path::append(path, key + ".bc");
+    return std::string(path.str());
+}
+
+/*______________________________________________________________________
+ *
+ * Maps the types of a cached module to the types of the module of the
+ * function. Reading the entry in the same context renames its identified
+ * structs (struct.S becomes struct.S.0), they are mapped through the
+ * types of the globals, matched by name, as IRMover does when linking.
+ *______________________________________________________________________*/
+class CacheTypeRemapper : public ValueMapTypeRemapper {
+
+public:
+    // false if the types cannot be the same
+    bool addMapping(Type *cached, Type *type) {
+        if(cached == type)
+            return true;
+        auto it = mapping.find(cached);
+        if(it != mapping.end())
+            return it->second == type;
+        if(cached->getTypeID() != type->getTypeID()
+            || cached->getNumContainedTypes() != type->getNumContainedTypes())
+            return false;
+        if(StructType *ST = dyn_cast<StructType>(cached)) {
+            StructType *DST = cast<StructType>(type);
+            if(ST->isLiteral() != DST->isLiteral() || ST->isPacked() != DST->isPacked()
+                || ST->isOpaque() != DST->isOpaque())
+                return false;
+            // before the elements, structs can be recursive
+            if(!ST->isLiteral())
+                mapping[cached] = type;
+        } else if(ArrayType *AT = dyn_cast<ArrayType>(cached)) {
+            if(AT->getNumElements() != cast<ArrayType>(type)->getNumElements())
+                return false;
+        } else if(VectorType *VT = dyn_cast<VectorType>(cached)) {
+            if(VT->getNumElements() != cast<VectorType>(type)->getNumElements())
+                return false;
+        } else if(PointerType *PT = dyn_cast<PointerType>(cached)) {
+            if(PT->getAddressSpace() != cast<PointerType>(type)->getAddressSpace())
+                return false;
+        } else if(FunctionType *FT = dyn_cast<FunctionType>(cached)) {
+            if(FT->isVarArg() != cast<FunctionType>(type)->isVarArg())
+                return false;
+        } else if(IntegerType *IT = dyn_cast<IntegerType>(cached)) {
+            if(IT->getBitWidth() != cast<IntegerType>(type)->getBitWidth())
+                return false;
+        }
+        for(unsigned int i=0; i<cached->getNumContainedTypes(); i++) {
+            if(!addMapping(cached->getContainedType(i), type->getContainedType(i)))
+                return false;
+        }
+        return true;
+    }
+
+    Type *remapType(Type *cached) override {
+        auto it = mapping.find(cached);
+        if(it != mapping.end())
+            return it->second;
+        Type *type = cached;
+        if(cached->getNumContainedTypes() > 0 && !(isa<StructType>(cached) && !cast<StructType>(cached)->isLiteral())) {
+            std::vector<Type*> contained;
+            for(Type *T : cached->subtypes()) {
+                contained.push_back(remapType(T));
+            }
+            if(PointerType *PT = dyn_cast<PointerType>(cached)) {
+                type = PointerType::get(contained[0], PT->getAddressSpace());
+            } else if(ArrayType *AT = dyn_cast<ArrayType>(cached)) {
+                type = ArrayType::get(contained[0], AT->getNumElements());
+            } else if(VectorType *VT = dyn_cast<VectorType>(cached)) {
+                type = VectorType::get(contained[0], VT->getNumElements());
+            } else if(FunctionType *FT = dyn_cast<FunctionType>(cached)) {
+                type = FunctionType::get(contained[0], ArrayRef<Type*>(contained).slice(1), FT->isVarArg());
+            } else if(StructType *ST = dyn_cast<StructType>(cached)) {
+                type = StructType::get(cached->getContext(), contained, ST->isPacked());
+            }
+        }
+        // Structs used only in the body stay the ones of the entry
+        mapping[cached] = type;
+        return type;
+    }
+
+private:
+    DenseMap<Type*, Type*> mapping;
+
+};
+
+} /* namespace */
+
+bool ObfuscationCache::isEnabled() {
+    return !cacheDirectory.empty();
+}
+
+std::string ObfuscationCache::getKey(Function &F, StringRef pass, StringRef configuration) {
+    if(!isEnabled() || F.isDeclaration() || hasDebugInfo(F))
+        return "";
+    SetVector<GlobalValue*> globals;
+    if(!collectGlobals(F, globals))
+        return "";
+
+    std::string text;
+    raw_string_ostream OS(text);
+    Module *M = F.getParent();
+    OS << CACHE_VERSION << "\n" << pass << "\n" << configuration << "\n";
+    OS << M->getTargetTriple() << "\n" << M->getDataLayoutStr() << "\n";
+    // A key changing every run would only fill the directory
+    OS << (ObfuscationRandom::isReproducible()? Twine(ObfuscationRandom::getSeed()).str(): "-") << "\n";
+    OS << ObfuscationRandom::getVariant() << "\n";
+    F.print(OS);
+
+    // The printed function names the globals and structs, but
+    // does not show their types and bodies
+    SetVector<StructType*> structs;
+    for(GlobalValue *GV : globals) {
+        OS << GV->getName() << " ";
+        GV->getType()->print(OS);
+        OS << "\n";
+        collectStructs(GV->getValueType(), structs);
+    }
+    for(BasicBlock &BB : F) {
+        for(Instruction &I : BB) {
+            collectStructs(I.getType(), structs);
+            for(Use &U : I.operands()) {
+                collectStructs(U->getType(), structs);
+            }
+            if(AllocaInst *AI = dyn_cast<AllocaInst>(&I)) {
+                collectStructs(AI->getAllocatedType(), structs);
+            } else if(GetElementPtrInst *GEP = dyn_cast<GetElementPtrInst>(&I)) {
+                collectStructs(GEP->getSourceElementType(), structs);
+            }
+        }
+    }
+    for(StructType *ST : structs) {
+        OS << ST->getName() << " =";
+        for(Type *element : ST->elements()) {
+            OS << " ";
+            element->print(OS);
+        }
+        OS << (ST->isPacked()? " packed\n": "\n");
+    }
+
+    MD5 hash;
+    hash.update(OS.str());
+    MD5::MD5Result result;
+    hash.final(result);
+    SmallString<32> key;
+    MD5::stringifyResult(result, key);
+    return std::string(key.str());
+}
+
+bool ObfuscationCache::load(Function &F, StringRef key) {
+    ErrorOr<std::unique_ptr<MemoryBuffer>> buffer = MemoryBuffer::getFile(getEntryPath(key));
+    if(!buffer) {
+        NumMisses++;
+        return false;
+    }
+    Expected<std::unique_ptr<Module>> entry = parseBitcodeFile((*buffer)->getMemBufferRef(), F.getContext());
+    if(!entry) {
+        // A broken entry is a miss, it is overwritten by store
+        DEBUG(dbgs() << "obf-cache: cannot read entry " << key << ": " << toString(entry.takeError()) << "\n");
+        NumMisses++;
+        return false;
+    }
+    Module &cached = **entry;
+    Function *cachedF = cached.getFunction(key);
+
+    // The globals of the entry with the ones of the module, by name
+    CacheTypeRemapper typeRemapper;
+    ValueToValueMapTy VMap;
+    bool matched = cachedF != nullptr && typeRemapper.addMapping(cachedF->getType(), F.getType());
+    for(GlobalValue &cachedGV : cached.global_values()) {
+        if(!matched || &cachedGV == cachedF)
+            continue;
+        GlobalValue *GV = F.getParent()->getNamedValue(cachedGV.getName());
+        matched = GV != nullptr && typeRemapper.addMapping(cachedGV.getType(), GV->getType());
+        VMap[&cachedGV] = GV;
+    }
+    if(!matched) {
+        DEBUG(dbgs() << "obf-cache: entry " << key << " does not match " << F.getName() << "\n");
+        NumMisses++;
+        return false;
+    }
+
+    auto cachedArg = cachedF->arg_begin();
+    for(Argument &arg : F.args()) {
+        VMap[&*cachedArg++] = &arg;
+    }
+    // deleteBody makes the function external
+    GlobalValue::LinkageTypes linkage = F.getLinkage();
+    F.deleteBody();
+    F.setLinkage(linkage);
+    SmallVector<ReturnInst*, 8> returns;
+    CloneFunctionInto(&F, cachedF, VMap, true, returns, "", nullptr, &typeRemapper);
+    NumHits++;
+    DEBUG(dbgs() << "obf-cache: " << F.getName() << " loaded from " << key << "\n");
+    return true;
+}
+
+void ObfuscationCache::store(Function &F, StringRef key) {
+    if(key.empty())
+        return;
+    SetVector<GlobalValue*> globals;
+    if(!collectGlobals(F, globals))
+        return;
+
+    // In the context of F, to clone without copying the types
+    Module cached("obf-cache", F.getContext());
+    cached.setTargetTriple(F.getParent()->getTargetTriple());
+    cached.setDataLayout(F.getParent()->getDataLayout());
+    ValueToValueMapTy VMap;
+    for(GlobalValue *GV : globals) {
+        // F itself, when recursive, is declared with its name
+        GlobalValue *declaration = nullptr;
+        if(Function *function = dyn_cast<Function>(GV)) {
+            declaration = Function::Create(function->getFunctionType(), GlobalValue::ExternalLinkage,
+                function->getName(), &cached);
+        } else {
+            GlobalVariable *var = cast<GlobalVariable>(GV);
+            declaration = new GlobalVariable(cached, var->getValueType(), var->isConstant(),
+                GlobalValue::ExternalLinkage, nullptr, var->getName(), nullptr,
+                var->getThreadLocalMode(), var->getType()->getAddressSpace());
+        }
+        VMap[GV] = declaration;
+    }
+    // Named by the key, the name of F may be a declaration above
+    Function *cachedF = Function::Create(F.getFunctionType(), GlobalValue::ExternalLinkage, key, &cached);
+    auto cachedArg = cachedF->arg_begin();
+    for(Argument &arg : F.args()) {
+        cachedArg->setName(arg.getName());
+        VMap[&arg] = &*cachedArg++;
+    }
+    SmallVector<ReturnInst*, 8> returns;
+    CloneFunctionInto(cachedF, &F, VMap, true, returns);
+
+    // Written to a temporary then renamed, for the other
+    // processes of a parallel build reading the entry
+    if(std::error_code EC = sys::fs::create_directories(cacheDirectory)) {
+        DEBUG(dbgs() << "obf-cache: cannot create " << cacheDirectory << ": " << EC.message() << "\n");
+        return;
+    }
+    int FD;
+    SmallString<256> temporary;
+    if(sys::fs::createUniqueFile(getEntryPath(key) + ".%%%%%%.tmp", FD, temporary))
+        return;
+    raw_fd_ostream OS(FD, true);
+    WriteBitcodeToFile(&cached, OS);
+    OS.close();
+    if(OS.has_error() || sys::fs::rename(temporary, getEntryPath(key))) {
+        OS.clear_error();
+        sys::fs::remove(temporary);
+        return;
+    }
+    NumStored++;
+}
+
+#undef DEBUG_TYPE
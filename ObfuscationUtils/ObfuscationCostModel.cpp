@@ -0,0 +1,405 @@
+#include "llvm/Pass.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Instruction.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/MDBuilder.h"
+#include "llvm/IR/Metadata.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/ValueMapper.h"
+#include "ObfuscationUtils/ObfuscationUtils.h"
+#include <algorithm>
+#include <limits>
+using namespace llvm;
+
+#define DEBUG_TYPE "obf-cost-model"
+
+cl::opt<double, false, ObfuscationUtils::PercentParser> sizeBudgetPercent("obf-size-budget", 
+    cl::desc("Max growth in code size by all the obfuscation passes, e.g. 30%"), 
+    cl::value_desc("percent"));
+cl::opt<double, false, ObfuscationUtils::PercentParser> latencyBudgetPercent("obf-latency-budget", 
+    cl::desc("Max growth in estimated latency by all the obfuscation passes, e.g. 5%"), 
+    cl::value_desc("percent"));
+cl::opt<bool> dryRun("obf-dry-run", 
+    cl::desc("Only estimate the cost of the obfuscation passes, without changing the IR"), 
+    cl::init(false));
+cl::opt<std::string> dryRunOutput("obf-dry-run-output", 
+    cl::desc("JSON report of -obf-dry-run ('-' for stdout)"), 
+    cl::value_desc("filename"), cl::init("obf-dry-run.json"));
+cl::opt<unsigned int> maxLayers("obf-max-layers", 
+    cl::desc("Times a pass obfuscates the same code when run more than once, e.g. compile and LTO (default 1)"), 
+    cl::value_desc("N"), cl::init(1));
+cl::list<std::string> selectedFunctions("obf-function", 
+    cl::desc("Obfuscate only this function, the others are left as they are (can be repeated)"), 
+    cl::value_desc("name"));
+
+double ObfuscationUtils::getOpcodeCost(unsigned int opcode, Type *type, const TargetTransformInfo *TTI) {
+    if(Instruction::isBinaryOp(opcode))
+        return TTI->getArithmeticInstrCost(opcode, type);
+    switch(opcode) {
+        case Instruction::ICmp:
+        case Instruction::FCmp:
+        case Instruction::Select:
+            return TTI->getCmpSelInstrCost(opcode, type);
+        case Instruction::Load:
+        case Instruction::Store:
+            return TTI->getMemoryOpCost(opcode, type, 0, 0);
+        case Instruction::Br:
+            return TTI->getCFInstrCost(opcode);
+        default:
+            // casts, allocas and GEPs
+            return TargetTransformInfo::TCC_Basic;
+    }
+}
+
+ObfuscationCost ObfuscationUtils::getReplacementCost(ArrayRef<unsigned int> added,
+    ArrayRef<unsigned int> removed, Type *type, const TargetTransformInfo *TTI) {
+    ObfuscationCost cost;
+    cost.size = (double)added.size() - removed.size();
+    for(unsigned int opcode : added) {
+        cost.cycles += getOpcodeCost(opcode, type, TTI);
+        if(opcode == Instruction::Load || opcode == Instruction::Store)
+            cost.memoryOps++;
+    }
+    for(unsigned int opcode : removed) {
+        cost.cycles -= getOpcodeCost(opcode, type, TTI);
+        if(opcode == Instruction::Load || opcode == Instruction::Store)
+            cost.memoryOps--;
+    }
+    cost.latency = cost.cycles;
+    return cost;
+}
+
+double ObfuscationUtils::getRelativeFrequency(BasicBlock *BB, BlockFrequencyInfo *BFI) {
+    return (double)BFI->getBlockFreq(BB).getFrequency() / BFI->getEntryFreq();
+}
+
+double ObfuscationUtils::getFunctionSize(Function &F) {
+    double size = 0;
+    for(BasicBlock &BB : F) {
+        size += BB.size();
+    }
+    return size;
+}
+
+double ObfuscationUtils::getFunctionLatency(Function &F, 
+    const TargetTransformInfo *TTI, BlockFrequencyInfo *BFI) {
+    double latency = 0;
+    for(BasicBlock &BB : F) {
+        double blockLatency = 0;
+        for(Instruction &I : BB) {
+            blockLatency += TTI->getUserCost(&I);
+        }
+        latency += blockLatency * getRelativeFrequency(&BB, BFI);
+    }
+    return latency;
+}
+
+unsigned int ObfuscationUtils::getLayers(const GlobalObject *GO, StringRef pass) {
+    MDNode *node = GO->getMetadata(("obf." + pass).str());
+    if(node == nullptr || node->getNumOperands() == 0)
+        return 0;
+    ConstantInt *layers = mdconst::dyn_extract<ConstantInt>(node->getOperand(0));
+    return layers? layers->getZExtValue(): 0;
+}
+
+void ObfuscationUtils::setLayers(GlobalObject *GO, StringRef pass, unsigned int layers) {
+    LLVMContext &context = GO->getContext();
+    Metadata *count = ConstantAsMetadata::get(ConstantInt::get(Type::getInt32Ty(context), layers));
+    GO->setMetadata(("obf." + pass).str(), MDNode::get(context, count));
+}
+
+bool ObfuscationUtils::canObfuscate(const GlobalObject *GO, StringRef pass) {
+    return getLayers(GO, pass) < maxLayers;
+}
+
+bool ObfuscationUtils::hasSelectedFunctions() {
+    return !selectedFunctions.empty();
+}
+
+bool ObfuscationUtils::isSelected(const Function *F) {
+    if(selectedFunctions.empty())
+        return true;
+    return std::find(selectedFunctions.begin(), selectedFunctions.end(), F->getName()) != selectedFunctions.end();
+}
+
+AllocaInst *ObfuscationUtils::createEntryBlockAlloca(Function *F, Type *type, const Twine &name) {
+    BasicBlock &entryBlock = F->getEntryBlock();
+    IRBuilder<> builder(&entryBlock, entryBlock.begin());
+    return builder.CreateAlloca(type, nullptr, name);
+}
+
+void ObfuscationUtils::setBranchWeights(BranchInst *BI, uint32_t trueWeight, uint32_t falseWeight) {
+    MDBuilder MDB(BI->getContext());
+    BI->setMetadata(LLVMContext::MD_prof, MDB.createBranchWeights(
+        std::max<uint32_t>(trueWeight, 1), std::max<uint32_t>(falseWeight, 1)));
+}
+
+namespace {
+
+// Replaces the body of F with the body of backup, and deletes backup
+void restoreFunction(Function &F, Function *backup) {
+    // Dropping the references first, as blocks use each other
+    for(BasicBlock &BB : F) {
+        BB.dropAllReferences();
+    }
+    while(!F.empty()) {
+        F.begin()->eraseFromParent();
+    }
+    F.getBasicBlockList().splice(F.end(), backup->getBasicBlockList());
+    for(Function::arg_iterator A = F.arg_begin(), B = backup->arg_begin(); 
+        A != F.arg_end(); ++A, ++B) {
+        B->replaceAllUsesWith(&*A);
+    }
+    // Not in the module, see checkpoint
+    delete backup;
+}
+
+// Escapes the string for a JSON string
+std::string escapeJSON(StringRef str) {
+    std::string escaped;
+    raw_string_ostream OS(escaped);
+    for(unsigned char c : str) {
+        if(c == '"' || c == '\\')
+            OS << '\\' << c;
+        else if(c < 0x20)
+            OS << format("\\u%04x", c);
+        else
+            OS << c;
+    }
+    return OS.str();
+}
+
+void printCost(raw_ostream &OS, const ObfuscationCost &cost) {
+    OS << "{\"instructions\": " << format("%.2f", cost.size)
+        << ", \"blocks\": " << format("%.2f", cost.blocks)
+        << ", \"memory_ops\": " << format("%.2f", cost.memoryOps)
+        << ", \"cycles\": " << format("%.2f", cost.cycles)
+        << ", \"weighted_cycles\": " << format("%.2f", cost.latency) << "}";
+}
+
+} /* namespace */
+
+ObfuscationCostModel::ObfuscationCostModel() : ImmutablePass(ID),
+    sizeBudget(0), sizeSpent(0), latencyBudget(0), latencySpent(0), rolledBack(0) {}
+
+bool ObfuscationCostModel::hasBudget() const {
+    return sizeBudgetPercent.getNumOccurrences() > 0 
+        || latencyBudgetPercent.getNumOccurrences() > 0;
+}
+
+bool ObfuscationCostModel::isDryRun() const {
+    return dryRun;
+}
+
+bool ObfuscationCostModel::canRollBack() {
+    return sizeBudgetPercent.getNumOccurrences() > 0 && !dryRun;
+}
+
+void ObfuscationCostModel::addFunction(Function &F, 
+    const TargetTransformInfo *TTI, BlockFrequencyInfo *BFI) {
+    if(!needsEstimates() || seen[&F])
+        return;
+    seen[&F] = true;
+    if(isDryRun()) {
+        FunctionReport &functionReport = report[F.getName().str()];
+        functionReport.size = ObfuscationUtils::getFunctionSize(F);
+        functionReport.latency = ObfuscationUtils::getFunctionLatency(F, TTI, BFI);
+    }
+    sizeBudget += sizeBudgetPercent * ObfuscationUtils::getFunctionSize(F);
+    if(latencyBudgetPercent.getNumOccurrences() > 0) {
+        latencyBudget += latencyBudgetPercent * ObfuscationUtils::getFunctionLatency(F, TTI, BFI);
+    }
+}
+
+std::vector<bool> ObfuscationCostModel::select(StringRef pass, ArrayRef<ObfuscationCandidate> candidates) {
+    std::vector<bool> selected(candidates.size(), !hasBudget());
+    if(hasBudget()) {
+        selectInBudget(candidates, selected);
+    }
+
+    if(isDryRun()) {
+        for(unsigned int i=0; i<candidates.size(); i++) {
+            Function *F = candidates[i].function;
+            // Candidates in many functions are reported for the module
+            ReportEntry &entry = report[F != nullptr? F->getName().str(): ""].passes[pass.str()];
+            entry.candidates++;
+            entry.total += candidates[i].cost;
+            if(selected[i]) {
+                entry.selectedCandidates++;
+                entry.selected += candidates[i].cost;
+            }
+        }
+    }
+    return selected;
+}
+
+void ObfuscationCostModel::selectInBudget(ArrayRef<ObfuscationCandidate> candidates, 
+    std::vector<bool> &selected) {
+
+    bool limitSize = sizeBudgetPercent.getNumOccurrences() > 0;
+    bool limitLatency = latencyBudgetPercent.getNumOccurrences() > 0;
+
+    // Cost of a candidate is the largest fraction of a budget it takes,
+    // candidates which make the code smaller or faster are free
+    auto unitCost = [&](const ObfuscationCost &cost) {
+        double units = 0;
+        if(limitSize && cost.size > 0)
+            units = std::max(units, sizeBudget > 0? cost.size/sizeBudget: std::numeric_limits<double>::infinity());
+        if(limitLatency && cost.latency > 0)
+            units = std::max(units, latencyBudget > 0? cost.latency/latencyBudget: std::numeric_limits<double>::infinity());
+        return units;
+    };
+
+    std::vector<unsigned int> order(candidates.size());
+    std::vector<double> ratio(candidates.size());
+    for(unsigned int i=0; i<candidates.size(); i++) {
+        order[i] = i;
+        double units = unitCost(candidates[i].cost);
+        ratio[i] = units > 0? candidates[i].value/units: std::numeric_limits<double>::infinity();
+    }
+    std::stable_sort(order.begin(), order.end(), 
+        [&](unsigned int a, unsigned int b) { return ratio[a] > ratio[b]; });
+
+    int count = 0;
+    for(unsigned int i : order) {
+        const ObfuscationCost &cost = candidates[i].cost;
+        if(limitSize && sizeSpent + cost.size > sizeBudget)
+            continue;
+        if(limitLatency && latencySpent + cost.latency > latencyBudget)
+            continue;
+        sizeSpent += cost.size;
+        latencySpent += cost.latency;
+        if(candidates[i].function != nullptr) {
+            pendingSize[candidates[i].function] += cost.size;
+            pendingLatency[candidates[i].function] += cost.latency;
+        }
+        selected[i] = true;
+        count++;
+    }
+
+    DEBUG(dbgs() << "obf-cost-model: selected " << count << "/" << candidates.size() 
+        << ", size " << sizeSpent << "/" << sizeBudget 
+        << ", latency " << latencySpent << "/" << latencyBudget << "\n");
+}
+
+Function* ObfuscationCostModel::checkpoint(Function &F) {
+    if(!canRollBack() || F.isDeclaration())
+        return nullptr;
+    // Outside the module, a function pass should not add functions to
+    // it. Without module level changes the metadata is not copied, and
+    // the body keeps the subprogram of F, where CloneFunction would make
+    // a copy of it under -g and the restored body would point to it.
+    Function *backup = Function::Create(F.getFunctionType(), F.getLinkage(), F.getName());
+    ValueToValueMapTy VMap;
+    Function::arg_iterator B = backup->arg_begin();
+    for(Argument &A : F.args()) {
+        B->setName(A.getName());
+        VMap[&A] = &*B++;
+    }
+    SmallVector<ReturnInst*, 8> returns;
+    CloneFunctionInto(backup, &F, VMap, false, returns);
+    checkpointSize[&F] = ObfuscationUtils::getFunctionSize(F);
+    pendingSize[&F] = 0;
+    pendingLatency[&F] = 0;
+    return backup;
+}
+
+bool ObfuscationCostModel::commit(Function &F, Function *backup) {
+    if(backup == nullptr)
+        return true;
+    // Measured growth replaces the estimated one
+    double measured = ObfuscationUtils::getFunctionSize(F) - checkpointSize[&F];
+    double latency = pendingLatency[&F];
+    sizeSpent -= pendingSize[&F];
+    pendingSize.erase(&F);
+    pendingLatency.erase(&F);
+    checkpointSize.erase(&F);
+    if(sizeSpent + measured > sizeBudget) {
+        DEBUG(dbgs() << "obf-cost-model: " << F.getName() << " grew by " << measured 
+            << " instructions, over the size budget, rolled back\n");
+        restoreFunction(F, backup);
+        // Its candidates are not transformed anymore
+        latencySpent -= latency;
+        rolledBack++;
+        return false;
+    }
+    sizeSpent += measured;
+    delete backup;
+    return true;
+}
+
+bool ObfuscationCostModel::doFinalization(Module &M) {
+    if(!isDryRun())
+        return false;
+
+    std::error_code EC;
+    raw_fd_ostream OS(dryRunOutput, EC, sys::fs::F_Text);
+    if(EC) {
+        errs() << "obf-dry-run: cannot open " << dryRunOutput << ": " << EC.message() << "\n";
+        return false;
+    }
+
+    // Sum over all the functions, per pass
+    std::map<std::string, ReportEntry> total;
+    OS << "{\n  \"module\": \"" << escapeJSON(M.getModuleIdentifier()) << "\",\n";
+    OS << "  \"functions\": [";
+    bool firstFunction = true;
+    for(auto &function : report) {
+        OS << (firstFunction? "\n": ",\n");
+        firstFunction = false;
+        OS << "    {\"name\": \"" << escapeJSON(function.first) << "\", "
+            << "\"instructions\": " << format("%.0f", function.second.size) << ", "
+            << "\"weighted_cycles\": " << format("%.2f", function.second.latency) << ", "
+            << "\"passes\": {";
+        bool firstPass = true;
+        for(auto &pass : function.second.passes) {
+            const ReportEntry &entry = pass.second;
+            OS << (firstPass? "\n": ",\n");
+            firstPass = false;
+            OS << "      \"" << escapeJSON(pass.first) << "\": {\"candidates\": " << entry.candidates
+                << ", \"selected\": " << entry.selectedCandidates << ",\n        \"estimate\": ";
+            printCost(OS, entry.total);
+            OS << ",\n        \"selected_estimate\": ";
+            printCost(OS, entry.selected);
+            OS << "}";
+            ReportEntry &sum = total[pass.first];
+            sum.candidates += entry.candidates;
+            sum.selectedCandidates += entry.selectedCandidates;
+            sum.total += entry.total;
+            sum.selected += entry.selected;
+        }
+        OS << (firstPass? "}}": "\n    }}");
+    }
+    OS << "\n  ],\n  \"total\": {";
+    bool firstPass = true;
+    for(auto &pass : total) {
+        OS << (firstPass? "\n": ",\n");
+        firstPass = false;
+        OS << "    \"" << escapeJSON(pass.first) << "\": {\"candidates\": " << pass.second.candidates
+            << ", \"selected\": " << pass.second.selectedCandidates << ",\n      \"estimate\": ";
+        printCost(OS, pass.second.total);
+        OS << ",\n      \"selected_estimate\": ";
+        printCost(OS, pass.second.selected);
+        OS << "}";
+    }
+    OS << (firstPass? "}\n}\n": "\n  }\n}\n");
+    return false;
+}
+
+void ObfuscationCostModel::print(raw_ostream &OS, const Module *M) const {
+    OS << "size " << sizeSpent << "/" << sizeBudget 
+        << ", latency " << latencySpent << "/" << latencyBudget
+        << ", rolled back functions " << rolledBack << "\n";
+}
+
+// Registering the pass
+char ObfuscationCostModel::ID = 0;
+static RegisterPass<ObfuscationCostModel> X("obf-cost-model", "Cost model and budget of the obfuscation passes", false, true);
+
+#undef DEBUG_TYPE
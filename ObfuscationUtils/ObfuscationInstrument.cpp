@@ -0,0 +1,107 @@
+#include "llvm/Pass.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/ADT/MapVector.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Transforms/Utils/ModuleUtils.h"
+#include "ObfuscationUtils/ObfuscationUtils.h"
+using namespace llvm;
+
+#define DEBUG_TYPE "obf-instrument"
+
+namespace {
+
+// Implemented in ObfuscationRuntime
+const char *REGISTER_FUNCTION = "__obf_register_counters";
+
+/*______________________________________________________________________
+ *
+ * Adds the counting of every site with instructions in the block
+ * at the start of the block: counters[site] += instructions
+ *______________________________________________________________________*/
+void instrumentBlock(BasicBlock &BB, GlobalVariable *counters) {
+    // Sites in the order of their first instruction, and their instructions
+    MapVector<unsigned int, unsigned int> sites;
+    for(Instruction &I : BB) {
+        unsigned int site = ObfuscationSiteMap::getSite(&I);
+        if(site != 0)
+            sites[site]++;
+    }
+    // e.g. catchswitch blocks, have no place for the counting
+    if(sites.empty() || BB.getFirstInsertionPt() == BB.end())
+        return;
+
+    IRBuilder<> builder(&*BB.getFirstInsertionPt());
+    Type *i64 = builder.getInt64Ty();
+    for(auto &it : sites) {
+        Value *counter = builder.CreateConstInBoundsGEP2_64(counters, 0, it.first);
+        Value *count = builder.CreateLoad(counter);
+        builder.CreateStore(builder.CreateAdd(count, ConstantInt::get(i64, it.second)), counter);
+    }
+}
+
+/*______________________________________________________________________
+ *
+ * Adds a constructor which registers the counters with the runtime:
+ * __obf_register_counters(counters, number of counters, module name)
+ *______________________________________________________________________*/
+void addRegisterConstructor(Module &M, GlobalVariable *counters, unsigned int numCounters) {
+    LLVMContext &context = M.getContext();
+    Type *i64Ptr = Type::getInt64PtrTy(context);
+    Type *i32 = Type::getInt32Ty(context);
+    Type *i8Ptr = Type::getInt8PtrTy(context);
+    Constant *registerFunction = M.getOrInsertFunction(REGISTER_FUNCTION,
+        Type::getVoidTy(context), i64Ptr, i32, i8Ptr);
+
+    Function *constructor = Function::Create(FunctionType::get(Type::getVoidTy(context), false),
+        GlobalValue::InternalLinkage, "__obf_register_counters_ctor", &M);
+    IRBuilder<> builder(BasicBlock::Create(context, "entry", constructor));
+    Value *moduleName = builder.CreateGlobalStringPtr(M.getModuleIdentifier(), "__obf_module_name");
+    builder.CreateCall(registerFunction, {
+        builder.CreateConstInBoundsGEP2_64(counters, 0, 0),
+        ConstantInt::get(i32, numCounters),
+        moduleName});
+    builder.CreateRetVoid();
+    appendToGlobalCtors(M, constructor, 0);
+}
+
+} /* namespace */
+
+ObfuscationInstrument::ObfuscationInstrument(): ModulePass(ID) {}
+
+bool ObfuscationInstrument::runOnModule(Module &M) {
+    ObfuscationSiteMap &siteMap = getAnalysis<ObfuscationSiteMap>();
+    unsigned int numSites = siteMap.getNumSites();
+    if(numSites == 0)
+        return false;
+
+    // Indexed by site id, counters[0] is unused
+    ArrayType *arrayType = ArrayType::get(Type::getInt64Ty(M.getContext()), numSites + 1);
+    GlobalVariable *counters = new GlobalVariable(M, arrayType, false,
+        GlobalValue::InternalLinkage, ConstantAggregateZero::get(arrayType), "__obf_site_counters");
+    // counters of a module are on their own cache lines
+    counters->setAlignment(64);
+
+    for(Function &F : M) {
+        for(BasicBlock &BB : F) {
+            instrumentBlock(BB, counters);
+        }
+    }
+    addRegisterConstructor(M, counters, numSites + 1);
+    DEBUG(dbgs() << "obf-instrument: " << numSites << " sites\n");
+    return true;
+}
+
+void ObfuscationInstrument::getAnalysisUsage(AnalysisUsage &AU) const {
+    AU.addRequired<ObfuscationSiteMap>();
+    // The sites are recorded for this pass
+    AU.addRequired<ObfuscationSiteRequest>();
+}
+
+// Registering the pass
+char ObfuscationInstrument::ID = 0;
+static RegisterPass<ObfuscationInstrument> X("obf-instrument", "Count the instructions executed by the obfuscation sites");
+
+#undef DEBUG_TYPE
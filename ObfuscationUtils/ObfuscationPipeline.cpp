@@ -0,0 +1,74 @@
+#include "llvm/Pass.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Transforms/IPO/PassManagerBuilder.h"
+#include "llvm/Transforms/Scalar.h"
+#include "ObfuscationUtils/ObfuscationUtils.h"
+using namespace llvm;
+
+#define DEBUG_TYPE "obf-pipeline"
+
+namespace {
+
+enum ExtensionPoint { NoExtensionPoint, OptimizerLast };
+
+} /* namespace */
+
+cl::opt<ExtensionPoint> extensionPoint("obf-extension-point",
+    cl::desc("Add the loaded obfuscation passes to the standard pipeline (clang, opt -O<N>)"),
+    cl::values(
+        clEnumValN(NoExtensionPoint, "none", "only when given to opt (default)"),
+        clEnumValN(OptimizerLast, "optimizer-last", "after the optimizations, followed by a cleanup")),
+    cl::init(NoExtensionPoint));
+
+namespace {
+
+// Registered by the pass libraries as they are loaded, hence
+// in a function static, not to depend on the initialization order
+std::map<ObfuscationPipeline::Order, ObfuscationPipeline::PassFactory> &getPasses() {
+    static std::map<ObfuscationPipeline::Order, ObfuscationPipeline::PassFactory> passes;
+    return passes;
+}
+
+void addObfuscationPasses(legacy::PassManagerBase &PM) {
+    for(auto &it : getPasses()) {
+        PM.add(it.second());
+    }
+}
+
+/*______________________________________________________________________
+ *
+ * Cleanup after the obfuscation at the end of the pipeline: removes the
+ * dead code and the trivial blocks left by the passes, and promotes
+ * the allocas of the decode loops. Passes which fold or hoist
+ * expressions (InstCombine, GVN, LICM, unrolling) would undo the
+ * rewrites, hence are not run.
+ *______________________________________________________________________*/
+void addCleanupPasses(legacy::PassManagerBase &PM) {
+    PM.add(createPromoteMemoryToRegisterPass());
+    PM.add(createAggressiveDCEPass());
+    PM.add(createCFGSimplificationPass());
+}
+
+void addAtOptimizerLast(const PassManagerBuilder &Builder, legacy::PassManagerBase &PM) {
+    if(extensionPoint != OptimizerLast || getPasses().empty())
+        return;
+    DEBUG(dbgs() << "obf-pipeline: " << getPasses().size() << " passes at optimizer-last\n");
+    addObfuscationPasses(PM);
+    if(Builder.OptLevel > 0) {
+        addCleanupPasses(PM);
+    }
+}
+
+} /* namespace */
+
+ObfuscationPipeline::Registration::Registration(Order order, PassFactory factory) {
+    getPasses()[order] = factory;
+}
+
+static RegisterStandardPasses OptimizerLastPasses(PassManagerBuilder::EP_OptimizerLast, addAtOptimizerLast);
+// The optimizer-last extension point is not run at -O0
+static RegisterStandardPasses OptLevel0Passes(PassManagerBuilder::EP_EnabledOnOptLevel0, addAtOptimizerLast);
+
+#undef DEBUG_TYPE
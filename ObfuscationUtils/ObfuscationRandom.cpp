@@ -0,0 +1,71 @@
+#include "llvm/ADT/Twine.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/MD5.h"
+#include "ObfuscationUtils/ObfuscationUtils.h"
+using namespace llvm;
+
+#define DEBUG_TYPE "obf-random"
+
+cl::opt<unsigned long long> obfuscationSeed("obf-seed",
+    cl::desc("Seed of the random choices of the obfuscation passes, for a reproducible output"),
+    cl::value_desc("N"));
+
+namespace {
+
+// Seed of this run when -obf-seed is not given, the same for all the
+// passes and threads of the run
+uint64_t getRunSeed() {
+    static uint64_t runSeed = []() {
+        std::random_device rd;
+        return ((uint64_t)rd() << 32) | rd();
+    }();
+    return runSeed;
+}
+
+thread_local unsigned int currentVariant = 0;
+
+} /* namespace */
+
+ObfuscationRandom::ObfuscationRandom(StringRef pass, StringRef name) {
+    // Hashed as text, hence the same on every platform
+    MD5 hash;
+    hash.update(Twine(getSeed()).str());
+    hash.update(StringRef("\0", 1));
+    // The seeds without variants are left unchanged
+    if(currentVariant != 0) {
+        hash.update(Twine(currentVariant).str());
+        hash.update(StringRef("\0", 1));
+    }
+    hash.update(pass);
+    hash.update(StringRef("\0", 1));
+    hash.update(name);
+    MD5::MD5Result result;
+    hash.final(result);
+    std::seed_seq seed{(uint32_t)result.low(), (uint32_t)(result.low() >> 32),
+        (uint32_t)result.high(), (uint32_t)(result.high() >> 32)};
+    engine.seed(seed);
+}
+
+unsigned int ObfuscationRandom::next() {
+    // The output of mt19937 is specified by the standard, unlike
+    // the distributions, which differ between the libraries
+    return engine() >> 2;
+}
+
+bool ObfuscationRandom::isReproducible() {
+    return obfuscationSeed.getNumOccurrences() > 0;
+}
+
+uint64_t ObfuscationRandom::getSeed() {
+    return isReproducible()? (uint64_t)obfuscationSeed: getRunSeed();
+}
+
+void ObfuscationRandom::setVariant(unsigned int variant) {
+    currentVariant = variant;
+}
+
+unsigned int ObfuscationRandom::getVariant() {
+    return currentVariant;
+}
+
+#undef DEBUG_TYPE
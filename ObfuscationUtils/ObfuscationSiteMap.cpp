@@ -0,0 +1,164 @@
+#include "llvm/Pass.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Instruction.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Metadata.h"
+#include "llvm/IR/DebugInfoMetadata.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "ObfuscationUtils/ObfuscationUtils.h"
+using namespace llvm;
+
+#define DEBUG_TYPE "obf-site-map"
+
+cl::opt<std::string> siteMapOutput("obf-site-map-file",
+    cl::desc("Write the map of the code emitted by the obfuscation passes to the file"),
+    cl::value_desc("filename"));
+
+namespace {
+
+const char *SITE_METADATA = "obf.site";
+
+std::string formatLocation(const DebugLoc &location) {
+    if(!location)
+        return "-";
+    DILocation *DIL = location.get();
+    return (DIL->getFilename() + ":" + Twine(DIL->getLine()) + ":" + Twine(DIL->getColumn())).str();
+}
+
+} /* namespace */
+
+ObfuscationSiteMap::ObfuscationSiteMap(): ImmutablePass(ID), sitesRequired(false) {}
+
+bool ObfuscationSiteMap::isEnabled() const {
+    return !siteMapOutput.empty() || sitesRequired;
+}
+
+bool ObfuscationSiteMap::doInitialization(Module &M) {
+    // All the passes are scheduled, with the ones they require
+    sitesRequired = getAnalysisIfAvailable<ObfuscationSiteRequest>() != nullptr;
+    return false;
+}
+
+ObfuscationSiteMap::Marker ObfuscationSiteMap::mark(Instruction *I) {
+    Marker marker;
+    marker.original = I;
+    marker.previous = I->getPrevNode();
+    marker.next = I->getNextNode();
+    marker.block = I->getParent();
+    marker.lastBlock = &I->getParent()->getParent()->back();
+    return marker;
+}
+
+unsigned int ObfuscationSiteMap::tagSince(const Marker &marker, StringRef pass, StringRef kind) {
+    Function &F = *marker.block->getParent();
+    DebugLoc location = marker.original->getDebugLoc();
+    unsigned int site = 0;
+    if(isEnabled()) {
+        site = addSite(pass, kind, F, location);
+        sites[site-1].parent = getSite(marker.original);
+    }
+    auto isEmitted = [&](Instruction *I) {
+        return I != marker.original && I != marker.next;
+    };
+    auto tagEmitted = [&](Instruction *I) {
+        if(site != 0) {
+            tag(site, I);
+        } else if(!I->getDebugLoc()) {
+            I->setDebugLoc(location);
+        }
+    };
+
+    // inserted before the original in its block
+    Instruction *I = marker.previous? marker.previous->getNextNode(): &marker.block->front();
+    for(; I != nullptr && isEmitted(I); I = I->getNextNode()) {
+        tagEmitted(I);
+    }
+    // in the new blocks, the instructions after the original are moved
+    // to the end of one of them
+    for(Function::iterator BB = ++marker.lastBlock->getIterator(); BB != F.end(); BB++) {
+        for(I = &BB->front(); I != nullptr && isEmitted(I); I = I->getNextNode()) {
+            tagEmitted(I);
+        }
+    }
+    return site;
+}
+
+unsigned int ObfuscationSiteMap::addSite(StringRef pass, StringRef kind, Function &F,
+    const DebugLoc &location) {
+    if(!isEnabled())
+        return 0;
+    Site site;
+    site.pass = pass;
+    site.kind = kind;
+    site.function = F.getName();
+    site.location = formatLocation(location);
+    site.debugLoc = location;
+    site.parent = 0;
+    sites.push_back(site);
+    return sites.size();
+}
+
+void ObfuscationSiteMap::tag(unsigned int site, Instruction *I) {
+    if(site == 0)
+        return;
+    LLVMContext &context = I->getContext();
+    I->setMetadata(SITE_METADATA, MDNode::get(context,
+        ConstantAsMetadata::get(ConstantInt::get(Type::getInt32Ty(context), site))));
+    if(!I->getDebugLoc()) {
+        I->setDebugLoc(sites[site-1].debugLoc);
+    }
+}
+
+unsigned int ObfuscationSiteMap::getSite(const Instruction *I) {
+    MDNode *node = I->getMetadata(SITE_METADATA);
+    if(node == nullptr)
+        return 0;
+    return mdconst::extract<ConstantInt>(node->getOperand(0))->getZExtValue();
+}
+
+bool ObfuscationSiteMap::doFinalization(Module &M) {
+    if(siteMapOutput.empty())
+        return false;
+
+    std::error_code EC;
+    raw_fd_ostream OS(siteMapOutput, EC, sys::fs::F_Text);
+    if(EC) {
+        errs() << "obf-site-map: cannot open " << siteMapOutput << ": " << EC.message() << "\n";
+        return false;
+    }
+
+    // Instructions of every site left in the IR, after dead code
+    // removal, later iterations and rollbacks of the passes
+    std::vector<unsigned int> instructions(sites.size() + 1, 0);
+    for(Function &F : M) {
+        for(BasicBlock &BB : F) {
+            for(Instruction &I : BB) {
+                unsigned int site = getSite(&I);
+                if(site > 0 && site <= sites.size())
+                    instructions[site]++;
+            }
+        }
+    }
+
+    OS << "# module " << M.getModuleIdentifier() << "\n";
+    OS << "# site\tpass\tkind\tfunction\tlocation\tinstructions\tparent\n";
+    for(unsigned int id = 1; id <= sites.size(); id++) {
+        const Site &site = sites[id-1];
+        OS << id << "\t" << site.pass << "\t" << site.kind << "\t" << site.function << "\t"
+            << site.location << "\t" << instructions[id] << "\t" << site.parent << "\n";
+    }
+    return false;
+}
+
+// Registering the pass
+char ObfuscationSiteMap::ID = 0;
+static RegisterPass<ObfuscationSiteMap> X("obf-site-map", "Map of the code emitted by the obfuscation passes", false, true);
+
+ObfuscationSiteRequest::ObfuscationSiteRequest(): ImmutablePass(ID) {}
+
+char ObfuscationSiteRequest::ID = 0;
+static RegisterPass<ObfuscationSiteRequest> Y("obf-site-request", "Records the obfuscation sites without a site map file", false, true);
+
+#undef DEBUG_TYPE
@@ -0,0 +1,20 @@
+# -*- Python -*-
+
+import os
+
+import lit.formats
+
+config.name = 'Obfuscation'
+config.test_format = lit.formats.ShTest(True)
+config.suffixes = ['.ll']
+config.test_source_root = os.path.dirname(__file__)
+config.test_exec_root = config.obfuscation_obj_root
+
+# opt and FileCheck of the build
+config.environment['PATH'] = os.path.pathsep.join(
+    (config.llvm_tools_dir, config.environment['PATH']))
+
+# %load_arith loads -arith-obfus and -obf-outline, ObfuscationUtils
+# is loaded with it
+config.substitutions.append(('%load_arith', '-load ' + os.path.join(
+    config.llvm_libs_dir, 'ArithmeticObfuscation' + config.llvm_plugin_ext)))
@@ -0,0 +1,41 @@
+; The sequences of a loop body, more frequent than the entry by far,
+; are kept inline unless -obf-outline-hot-frequency is above the
+; frequency of the loop.
+;
+; RUN: opt %load_arith -arith-obfus -obfus-float -obf-outline -verify -S %s \
+; RUN:   | FileCheck %s --check-prefix=HOT
+; RUN: opt %load_arith -arith-obfus -obfus-float -obf-outline \
+; RUN:   -obf-outline-hot-frequency=1000 -verify -S %s | FileCheck %s --check-prefix=COLD
+
+; HOT-LABEL: define double @sum(
+; HOT: fptosi
+; HOT-NOT: call {{.*}}@obf.outlined
+; HOT: ret double
+; HOT-NOT: @obf.outlined
+
+; COLD-LABEL: define double @sum(
+; COLD: loop:
+; COLD-NOT: fptosi
+; COLD: call void @obf.outlined.fadd(
+; COLD-NOT: fptosi
+; COLD: call void @obf.outlined.fadd(
+; COLD: ret double
+; COLD: define internal {{.*}}@obf.outlined.fadd(
+define double @sum(double* %x, double %c, i64 %n) {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i64 [ 0, %entry ], [ %i.next, %loop ]
+  %s = phi double [ 0.0, %entry ], [ %s.next, %loop ]
+  %p = getelementptr inbounds double, double* %x, i64 %i
+  %v = load double, double* %p
+  %t = fadd double %v, %c
+  %s.next = fadd double %s, %t
+  %i.next = add nuw i64 %i, 1
+  %cond = icmp ult i64 %i.next, %n
+  br i1 %cond, label %loop, label %exit
+
+exit:
+  ret double %s.next
+}
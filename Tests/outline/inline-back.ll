@@ -0,0 +1,32 @@
+; An outlined function with a single call is inlined back, and its code
+; keeps the site tags (!obf.site) and the locations of its sequence.
+;
+; RUN: opt %load_arith -arith-obfus -obfus-float -obf-outline -verify -S %s \
+; RUN:   | FileCheck %s
+
+; CHECK-LABEL: define double @single(
+; CHECK-NOT: call
+; CHECK: fcmp olt double %a, {{.*}}, !dbg ![[LOC:[0-9]+]], !obf.site ![[SITE:[0-9]+]]
+; CHECK: fptosi double %a to i64, !dbg ![[LOC]], !obf.site ![[SITE]]
+; CHECK-NOT: call
+; CHECK: ret double
+; CHECK-NOT: @obf.outlined
+; CHECK: ![[LOC]] = !DILocation(line: 2, column: 14,
+define double @single(double %a, double %b) !dbg !6 {
+entry:
+  %x = fadd double %a, %b, !dbg !8
+  ret double %x, !dbg !9
+}
+
+!llvm.dbg.cu = !{!0}
+!llvm.module.flags = !{!3, !4}
+
+!0 = distinct !DICompileUnit(language: DW_LANG_C99, file: !1, producer: "clang", isOptimized: true, runtimeVersion: 0, emissionKind: FullDebug, enums: !2)
+!1 = !DIFile(filename: "single.c", directory: "/tmp")
+!2 = !{}
+!3 = !{i32 2, !"Dwarf Version", i32 4}
+!4 = !{i32 2, !"Debug Info Version", i32 3}
+!5 = !DISubroutineType(types: !2)
+!6 = distinct !DISubprogram(name: "single", scope: !1, file: !1, line: 1, type: !5, isLocal: false, isDefinition: true, scopeLine: 1, isOptimized: true, unit: !0, variables: !2)
+!8 = !DILocation(line: 2, column: 14, scope: !6)
+!9 = !DILocation(line: 2, column: 3, scope: !6)
@@ -0,0 +1,39 @@
+; Outlined functions of the same shape are merged, in every function
+; of the module: the fadds of @first and @second call the same one.
+; The fadd of @single, on floats, has a shape of its own and a single
+; call, hence it is inlined back.
+;
+; RUN: opt %load_arith -arith-obfus -obfus-float -obf-outline -verify -S %s \
+; RUN:   | FileCheck %s
+
+; CHECK-LABEL: define double @first(
+; CHECK: call void @obf.outlined.fadd(double %a, double %b,
+; CHECK: ret double
+define double @first(double %a, double %b) {
+entry:
+  %x = fadd double %a, %b
+  ret double %x
+}
+
+; CHECK-LABEL: define double @second(
+; CHECK: call void @obf.outlined.fadd(double %c, double %d,
+; CHECK: ret double
+define double @second(double %c, double %d) {
+entry:
+  %x = fadd double %c, %d
+  ret double %x
+}
+
+; CHECK-LABEL: define float @single(
+; CHECK-NOT: call
+; CHECK: fptosi float %a
+; CHECK-NOT: call
+; CHECK: ret float
+define float @single(float %a, float %b) {
+entry:
+  %x = fadd float %a, %b
+  ret float %x
+}
+
+; CHECK: define internal void @obf.outlined.fadd(double
+; CHECK-NOT: define
@@ -0,0 +1,37 @@
+; A sequence is outlined when the call saves at least
+; -obf-outline-min-saving (default 2) in TTI size: a single iteration
+; on integers is kept inline, a float guard is outlined.
+;
+; RUN: opt %load_arith -arith-obfus -obfus-float -obf-outline -verify -S %s \
+; RUN:   | FileCheck %s --check-prefix=DEFAULT
+; RUN: opt %load_arith -arith-obfus -obfus-float -obf-outline \
+; RUN:   -obf-outline-min-saving=1000 -verify -S %s | FileCheck %s --check-prefix=NONE
+
+; DEFAULT-LABEL: define i32 @adds(
+; DEFAULT-NOT: call
+; DEFAULT: ret i32
+; NONE-LABEL: define i32 @adds(
+; NONE-NOT: call
+; NONE: ret i32
+define i32 @adds(i32 %a, i32 %b, i32 %c) {
+entry:
+  %x = add i32 %a, %b
+  %y = add i32 %x, %c
+  ret i32 %y
+}
+
+; DEFAULT-LABEL: define double @fadds(
+; DEFAULT: call void @obf.outlined.fadd(
+; DEFAULT: call void @obf.outlined.fadd(
+; DEFAULT: ret double
+; DEFAULT: define internal {{.*}}@obf.outlined.fadd(
+; NONE-LABEL: define double @fadds(
+; NONE-NOT: call
+; NONE: ret double
+; NONE-NOT: @obf.outlined
+define double @fadds(double %a, double %b, double %c) {
+entry:
+  %x = fadd double %a, %b
+  %y = fadd double %x, %c
+  ret double %y
+}
@@ -0,0 +1,38 @@
+; Two sequences of -arith-obfus in the same block are both outlined:
+; outlining the first moves the second to a new block, which has to
+; be split where it is now. With -obf-seed=0 both adds get the same
+; rewrite, hence the same outlined function.
+;
+; RUN: opt %load_arith -obf-seed=0 -arith-obfus -obfus-float -obf-outline \
+; RUN:   -obf-outline-min-saving=-1000 -verify -S %s | FileCheck %s
+
+; CHECK-LABEL: define i32 @two_adds(
+; CHECK: call {{.*}}@obf.outlined.add(
+; CHECK: call {{.*}}@obf.outlined.add(
+; CHECK: ret i32
+define i32 @two_adds(i32 %a, i32 %b, i32 %c) {
+entry:
+  %x = add i32 %a, %b
+  %y = add i32 %x, %c
+  ret i32 %y
+}
+
+; The float guard of the second one starts in the block
+; where the guard of the first one ends
+; CHECK-LABEL: define double @two_fadds(
+; CHECK-NOT: fptosi
+; CHECK: call void @obf.outlined.fadd(double %a, double %b,
+; CHECK-NOT: fptosi
+; CHECK: call void @obf.outlined.fadd(double {{%.*}}, double %c,
+; CHECK-NOT: fptosi
+; CHECK: ret double
+define double @two_fadds(double %a, double %b, double %c) {
+entry:
+  %x = fadd double %a, %b
+  %y = fadd double %x, %c
+  ret double %y
+}
+
+; CHECK: define internal {{.*}}@obf.outlined.add(
+; CHECK: define internal {{.*}}@obf.outlined.fadd(
+; CHECK-NOT: define
@@ -0,0 +1,331 @@
+/*______________________________________________________________________
+ *
+ * llvm-obfuscate, runs the obfuscation passes on every bitcode file
+ * given, in parallel on a thread pool, and writes every result next to
+ * its input (or to -output-dir), with the extension replaced by -suffix.
+ *
+ * Every file gets its own LLVMContext, TargetMachine and PassManager,
+ * so that nothing is shared between the threads. The files are read
+ * lazily: with -obf-function only the files defining one of the
+ * functions are materialized, the others are copied as they are. The
+ * passes transform only the functions named (see -obf-function), the
+ * rest of the file is materialized too, the strings are decoded at
+ * all their uses and the bitcode writer needs every body.
+ *
+ * With -variants=N the single input is obfuscated N times, each with
+ * the seeds of its variant, and compiled to N object files. The file
+ * is read once, and parsed from the same buffer in every context.
+ *
+ * usage: llvm-obfuscate -passes=const-encoding,arith-obfus -j 8 a.bc b.bc ...
+ *        llvm-obfuscate -passes=... -obf-seed=1 -variants=16 -j 8 app.bc
+ *______________________________________________________________________*/
+
+#include "llvm/ADT/Triple.h"
+#include "llvm/Analysis/TargetTransformInfo.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Verifier.h"
+#include "llvm/IRReader/IRReader.h"
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/InitializePasses.h"
+#include "llvm/PassRegistry.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/ManagedStatic.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/PrettyStackTrace.h"
+#include "llvm/Support/Signals.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/TargetRegistry.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Support/Threading.h"
+#include "llvm/Support/ToolOutputFile.h"
+#include "llvm/Target/TargetMachine.h"
+#include "llvm/Transforms/Scalar.h"
+#include "ObfuscationUtils/ObfuscationUtils.h"
+#include <atomic>
+#include <mutex>
+using namespace llvm;
+
+static cl::list<std::string> inputFilenames(cl::Positional, cl::OneOrMore,
+    cl::desc("<input bitcode files>"));
+
+static cl::list<std::string> passNames("passes", cl::CommaSeparated,
+    cl::desc("Obfuscation passes to run, in order (arith-obfus, const-encoding, indirect-access)"),
+    cl::value_desc("pass,..."));
+
+static cl::opt<std::string> outputDirectory("output-dir",
+    cl::desc("Directory of the output files (default: the directory of every input)"),
+    cl::value_desc("directory"));
+
+static cl::opt<std::string> outputSuffix("suffix",
+    cl::desc("Replaces the extension of the input in the output file name"),
+    cl::init(".obf.bc"));
+
+static cl::opt<unsigned int> numThreads("j",
+    cl::desc("Number of files processed in parallel (default: number of cores)"),
+    cl::init(0));
+
+static cl::opt<unsigned int> numVariants("variants",
+    cl::desc("Obfuscate the single input N times, with different seeds, to N object files"),
+    cl::value_desc("N"), cl::init(0));
+
+static cl::opt<bool> noVerify("disable-verify",
+    cl::desc("Do not verify the modules after the passes"), cl::init(false));
+
+namespace {
+
+// errs() is not thread safe
+std::mutex outputMutex;
+
+void reportError(StringRef file, const Twine &message) {
+    std::lock_guard<std::mutex> lock(outputMutex);
+    errs() << "llvm-obfuscate: " << file << ": " << message << "\n";
+}
+
+std::string getOutputFilename(StringRef input, StringRef suffix) {
+    SmallString<256> output(input);
+    sys::path::replace_extension(output, "");
+    output += suffix;
+    if(outputDirectory.empty())
+        return std::string(output.str());
+    SmallString<256> path(outputDirectory);
+    sys::path::append(path, sys::path::filename(output));
+    return std::string(path.str());
+}
+
+// true if none of -obf-function is defined in M, which is read
+// lazily, hence only the symbol table is looked at
+bool isSkipped(Module &M) {
+    if(!ObfuscationUtils::hasSelectedFunctions())
+        return false;
+    for(Function &F : M) {
+        if((F.isMaterializable() || !F.isDeclaration()) && ObfuscationUtils::isSelected(&F))
+            return false;
+    }
+    return true;
+}
+
+// TTI of the target of the module, for the cost estimates of the
+// passes, and the code generator of -variants
+std::unique_ptr<TargetMachine> createTargetMachine(Module &M) {
+    std::string error;
+    const Target *target = TargetRegistry::lookupTarget(M.getTargetTriple(), error);
+    if(target == nullptr)
+        return nullptr;
+    return std::unique_ptr<TargetMachine>(target->createTargetMachine(
+        M.getTargetTriple(), "", "", TargetOptions(), None));
+}
+
+void addPasses(legacy::PassManager &PM, TargetMachine *TM, ArrayRef<const PassInfo*> passes) {
+    PM.add(createTargetTransformInfoWrapperPass(TM? TM->getTargetIRAnalysis(): TargetIRAnalysis()));
+    // Same as opt -mem2reg, the passes expect the values in registers
+    PM.add(createPromoteMemoryToRegisterPass());
+    for(const PassInfo *info : passes) {
+        // Loops of -indirect-access are expected in rotated form
+        if(info->getPassArgument() == "indirect-access")
+            PM.add(createLoopRotatePass());
+        PM.add(info->createPass());
+    }
+    if(!noVerify)
+        PM.add(createVerifierPass());
+}
+
+/*______________________________________________________________________
+ *
+ * Reads, transforms and writes one file, in a thread of the pool
+ *
+ * @return bool, true if the file was transformed (or copied)
+ *______________________________________________________________________*/
+bool processFile(const std::string &input, ArrayRef<const PassInfo*> passes) {
+    std::string output = getOutputFilename(input, outputSuffix);
+    // Owned by this file, contexts are not thread safe
+    LLVMContext context;
+    SMDiagnostic diagnostic;
+    std::unique_ptr<Module> M = getLazyIRFileModule(input, diagnostic, context);
+    if(!M) {
+        std::string message;
+        raw_string_ostream OS(message);
+        diagnostic.print("llvm-obfuscate", OS);
+        std::lock_guard<std::mutex> lock(outputMutex);
+        errs() << OS.str();
+        return false;
+    }
+
+    if(isSkipped(*M)) {
+        if(std::error_code EC = sys::fs::copy_file(input, output)) {
+            reportError(input, "cannot copy to " + output + ": " + EC.message());
+            return false;
+        }
+        return true;
+    }
+    if(Error error = M->materializeAll()) {
+        reportError(input, toString(std::move(error)));
+        return false;
+    }
+
+    std::unique_ptr<TargetMachine> TM = createTargetMachine(*M);
+    legacy::PassManager PM;
+    addPasses(PM, TM.get(), passes);
+    PM.run(*M);
+
+    std::error_code EC;
+    ToolOutputFile out(output, EC, sys::fs::F_None);
+    if(EC) {
+        reportError(input, "cannot open " + output + ": " + EC.message());
+        return false;
+    }
+    WriteBitcodeToFile(M.get(), out.os());
+    out.keep();
+    return true;
+}
+
+/*______________________________________________________________________
+ *
+ * Obfuscates and compiles one variant of the input, in a thread of the
+ * pool. The random choices of the passes are seeded from the variant
+ * (ObfuscationRandom::setVariant), hence every variant differs, and
+ * with -obf-seed every variant is the same in every run.
+ *
+ * @param MemoryBufferRef buffer, the input, shared by the variants
+ * @param unsigned int variant, number of the variant, from 1
+ *
+ * @return bool, true if the object file was written
+ *______________________________________________________________________*/
+bool processVariant(MemoryBufferRef buffer, unsigned int variant, ArrayRef<const PassInfo*> passes) {
+    StringRef input = buffer.getBufferIdentifier();
+    std::string output = getOutputFilename(input, ("." + Twine(variant) + ".o").str());
+    // Modules cannot be cloned between contexts, every
+    // variant parses the buffer in its own
+    LLVMContext context;
+    Expected<std::unique_ptr<Module>> M = parseBitcodeFile(buffer, context);
+    if(!M) {
+        reportError(input, toString(M.takeError()));
+        return false;
+    }
+    std::unique_ptr<TargetMachine> TM = createTargetMachine(**M);
+    if(!TM) {
+        reportError(input, "no target for " + (*M)->getTargetTriple());
+        return false;
+    }
+
+    std::error_code EC;
+    ToolOutputFile out(output, EC, sys::fs::F_None);
+    if(EC) {
+        reportError(input, "cannot open " + output + ": " + EC.message());
+        return false;
+    }
+    ObfuscationRandom::setVariant(variant);
+    legacy::PassManager PM;
+    addPasses(PM, TM.get(), passes);
+    if(TM->addPassesToEmitFile(PM, out.os(), TargetMachine::CGFT_ObjectFile)) {
+        reportError(input, "cannot emit object files for " + (*M)->getTargetTriple());
+        return false;
+    }
+    PM.run(**M);
+    out.keep();
+    return true;
+}
+
+// Options of the passes which write one file per run, the
+// files would be written by all the threads
+bool hasPerRunOutput() {
+    StringMap<cl::Option*> &options = cl::getRegisteredOptions();
+    for(const char *name : {"obf-site-map-file", "obf-dry-run"}) {
+        auto it = options.find(name);
+        if(it != options.end() && it->second->getNumOccurrences() > 0)
+            return true;
+    }
+    return false;
+}
+
+} /* namespace */
+
+int main(int argc, char **argv) {
+    sys::PrintStackTraceOnErrorSignal(argv[0]);
+    PrettyStackTraceProgram X(argc, argv);
+    llvm_shutdown_obj Y;
+
+    InitializeAllTargets();
+    InitializeAllTargetMCs();
+    InitializeAllAsmPrinters();
+    PassRegistry &registry = *PassRegistry::getPassRegistry();
+    initializeCore(registry);
+    initializeAnalysis(registry);
+    initializeTransformUtils(registry);
+    initializeScalarOpts(registry);
+    initializeTarget(registry);
+
+    cl::ParseCommandLineOptions(argc, argv, "Obfuscates bitcode files in parallel\n");
+
+    if(passNames.empty()) {
+        errs() << "llvm-obfuscate: no pass given, see -passes\n";
+        return 1;
+    }
+    std::vector<const PassInfo*> passes;
+    for(const std::string &name : passNames) {
+        const PassInfo *info = registry.getPassInfo(name);
+        if(info == nullptr || info->getNormalCtor() == nullptr) {
+            errs() << "llvm-obfuscate: unknown pass " << name << "\n";
+            return 1;
+        }
+        passes.push_back(info);
+    }
+    if(numVariants > 0 && inputFilenames.size() > 1) {
+        errs() << "llvm-obfuscate: -variants takes a single input\n";
+        return 1;
+    }
+    if((inputFilenames.size() > 1 || numVariants > 1) && hasPerRunOutput()) {
+        errs() << "llvm-obfuscate: -obf-site-map-file and -obf-dry-run write one file, "
+            << "give a single input and variant\n";
+        return 1;
+    }
+    if(!outputDirectory.empty()) {
+        if(std::error_code EC = sys::fs::create_directories(outputDirectory)) {
+            errs() << "llvm-obfuscate: cannot create " << outputDirectory << ": " << EC.message() << "\n";
+            return 1;
+        }
+    }
+
+    std::unique_ptr<MemoryBuffer> buffer;
+    if(numVariants > 0) {
+        ErrorOr<std::unique_ptr<MemoryBuffer>> file = MemoryBuffer::getFile(inputFilenames[0]);
+        if(!file) {
+            errs() << "llvm-obfuscate: cannot read " << inputFilenames[0] << ": " << file.getError().message() << "\n";
+            return 1;
+        }
+        buffer = std::move(*file);
+    }
+
+    std::atomic<unsigned int> failed(0);
+    unsigned int numOutputs = numVariants > 0? (unsigned int)numVariants: inputFilenames.size();
+    {
+        ThreadPool pool(numThreads > 0? numThreads: heavyweight_hardware_concurrency());
+        if(numVariants > 0) {
+            for(unsigned int variant=1; variant<=numVariants; variant++) {
+                pool.async([&buffer, variant, &passes, &failed]() {
+                    if(!processVariant(buffer->getMemBufferRef(), variant, passes))
+                        failed++;
+                });
+            }
+        } else {
+            for(const std::string &input : inputFilenames) {
+                pool.async([&input, &passes, &failed]() {
+                    if(!processFile(input, passes))
+                        failed++;
+                });
+            }
+        }
+        pool.wait();
+    }
+
+    if(failed > 0) {
+        errs() << "llvm-obfuscate: " << failed << " of " << numOutputs << " files failed\n";
+        return 1;
+    }
+    return 0;
+}
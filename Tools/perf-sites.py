@@ -0,0 +1,108 @@
+#!/usr/bin/env python3
+# Joins a perf profile of an obfuscated binary with the site map written
+# by -obf-site-map-file, to see which transformation the hot code came from.
+#
+# The binary should be built with -g, so that the samples have a source
+# line. The obfuscated code keeps the location of the instruction it
+# replaced, hence the samples of a line with sites are split between
+# its sites, in proportion to their instructions. This includes the
+# samples of the original code left on the line.
+#
+# usage: perf record -g ./a.out
+#        perf report --stdio --no-children --sort sym,srcline > report.txt
+#        perf-sites.py sites.tsv report.txt
+#
+#        or perf-sites.py --perf-data sites.tsv perf.data, to run perf report here
+
+import argparse
+import collections
+import os
+import re
+import subprocess
+import sys
+
+# "  12.34%  [.] function   file.c:42"
+REPORT_LINE = re.compile(r"^\s*([\d.]+)%\s+(?:\[.\]\s+)?(\S+)\s+(\S+):(\d+)\s*$")
+
+
+def read_sites(path):
+    sites = []
+    with open(path) as f:
+        for line in f:
+            if line.startswith("#") or not line.strip():
+                continue
+            site, pass_name, kind, function, location, instructions, parent = \
+                line.rstrip("\n").split("\t")
+            sites.append({
+                "site": int(site), "pass": pass_name, "kind": kind,
+                "function": function, "location": location,
+                "instructions": int(instructions), "parent": int(parent),
+            })
+    return sites
+
+
+def read_report(args):
+    if args.perf_data:
+        return subprocess.check_output(
+            ["perf", "report", "-i", args.report, "--stdio", "--no-children",
+             "--sort", "sym,srcline"], universal_newlines=True).splitlines()
+    with open(args.report) as f:
+        return f.read().splitlines()
+
+
+def line_key(function, path, line):
+    return (function, os.path.basename(path), int(line))
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("sites", help="file written by -obf-site-map-file")
+    parser.add_argument("report", help="output of perf report --sort sym,srcline")
+    parser.add_argument("--perf-data", action="store_true",
+                        help="report is a perf.data, run perf report on it")
+    parser.add_argument("--top", type=int, default=30, help="sites to print")
+    args = parser.parse_args()
+
+    # sites of every source line, by function, file and line
+    by_line = collections.defaultdict(list)
+    for site in read_sites(args.sites):
+        if site["location"] == "-" or site["instructions"] == 0:
+            continue
+        path, line, _ = site["location"].rsplit(":", 2)
+        by_line[line_key(site["function"], path, line)].append(site)
+
+    overhead = collections.Counter()
+    unmatched = 0.0
+    for text in read_report(args):
+        match = REPORT_LINE.match(text)
+        if match is None:
+            continue
+        percent, function, path, line = match.groups()
+        sites = by_line.get(line_key(function, path, line))
+        if not sites:
+            unmatched += float(percent)
+            continue
+        total = sum(site["instructions"] for site in sites)
+        for site in sites:
+            overhead[site["site"]] += float(percent) * site["instructions"] / total
+
+    sites = {site["site"]: site for line in by_line.values() for site in line}
+    print("%8s %6s %-16s %-16s %-24s %s" % (
+        "overhead", "site", "pass", "kind", "function", "location"))
+    for site_id, percent in overhead.most_common(args.top):
+        site = sites[site_id]
+        print("%7.2f%% %6d %-16s %-16s %-24s %s" % (
+            percent, site_id, site["pass"], site["kind"], site["function"], site["location"]))
+
+    print()
+    by_kind = collections.Counter()
+    for site_id, percent in overhead.items():
+        by_kind[(sites[site_id]["pass"], sites[site_id]["kind"])] += percent
+    for (pass_name, kind), percent in by_kind.most_common():
+        print("%7.2f%% %s %s" % (percent, pass_name, kind))
+    print("%7.2f%% not in a site (original code, or no source line)" % unmatched)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,84 @@
+#!/usr/bin/env python3
+# Dynamic overhead of every obfuscation site, from the counters written
+# at exit by a program built with -obf-instrument (ObfuscationRuntime)
+# and the map written by -obf-site-map-file in the same opt run.
+#
+# The counter of a site is the number of its instructions executed,
+# the table has the sites with the most, and the totals per pass and
+# kind of rewrite.
+#
+# usage: opt -load ... -arith-obfus -obf-instrument -obf-site-map-file=sites.tsv in.bc -o out.bc
+#        clang out.bc ObfuscationRuntime.a -o a.out && ./a.out
+#        site-counters.py sites.tsv obf-counters.tsv
+
+import argparse
+import collections
+import sys
+
+
+def read_sites(path):
+    module, sites = None, {}
+    with open(path) as f:
+        for line in f:
+            if line.startswith("# module "):
+                module = line[len("# module "):].rstrip("\n")
+                continue
+            if line.startswith("#") or not line.strip():
+                continue
+            site, pass_name, kind, function, location, instructions, parent = \
+                line.rstrip("\n").split("\t")
+            sites[int(site)] = {
+                "pass": pass_name, "kind": kind, "function": function,
+                "location": location, "instructions": int(instructions),
+            }
+    return module, sites
+
+
+def read_counters(path, module):
+    # the file is appended by every run, hence the counters are summed
+    counters = collections.Counter()
+    with open(path) as f:
+        for line in f:
+            name, site, count = line.rstrip("\n").split("\t")
+            if module is None or name == module:
+                counters[int(site)] += int(count)
+    return counters
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("sites", help="file written by -obf-site-map-file")
+    parser.add_argument("counters", help="file written by the instrumented program")
+    parser.add_argument("--top", type=int, default=30, help="sites to print")
+    args = parser.parse_args()
+
+    module, sites = read_sites(args.sites)
+    counters = read_counters(args.counters, module)
+    total = sum(counters.values())
+    if total == 0:
+        print("no counters for module %s" % module)
+        return 1
+
+    print("%14s %7s %6s %-16s %-16s %-24s %s" % (
+        "instructions", "share", "site", "pass", "kind", "function", "location"))
+    for site_id, count in counters.most_common(args.top):
+        site = sites.get(site_id)
+        if site is None:
+            print("%14d %6.2f%% %6d (not in the site map)" % (count, 100.0 * count / total, site_id))
+            continue
+        print("%14d %6.2f%% %6d %-16s %-16s %-24s %s" % (
+            count, 100.0 * count / total, site_id, site["pass"], site["kind"],
+            site["function"], site["location"]))
+
+    print()
+    by_kind = collections.Counter()
+    for site_id, count in counters.items():
+        if site_id in sites:
+            by_kind[(sites[site_id]["pass"], sites[site_id]["kind"])] += count
+    for (pass_name, kind), count in by_kind.most_common():
+        print("%14d %6.2f%% %s %s" % (count, 100.0 * count / total, pass_name, kind))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -5,6 +5,9 @@
 #include "llvm/IR/Function.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/IR/IRBuilder.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/Analysis/TargetTransformInfo.h"
+#include "ObfuscationUtils/ObfuscationUtils.h"
 using namespace llvm;
 
 /*
@@ -18,29 +21,47 @@ using namespace llvm;
      *       from the block, but changes all the uses. 
      *       Need to erase it manually.
      * @param Instruction *I, the instruction to obfuscate
+     * @param ObfuscationRandom *random, chooses among the 
+     *        rewrites of I (integer add and sub have several),
+     *        the first one if nullptr
      * @return true if IR is modified, false otherwise
      *_____________________________________________________
-    static bool obfuscate(Instruction *I);
+    static bool obfuscate(Instruction *I, ObfuscationRandom *random);
+
+     *_____________________________________________________
+     *
+     * Estimates the cost of obfuscating given instruction,
+     * for the budget of ObfuscationCostModel
+     * @param Instruction *I, the instruction to obfuscate
+     * @param const TargetTransformInfo *TTI, from analysis pass
+     * @return ObfuscationCost, latency is per execution of I,
+     *         of the costliest rewrite
+     *_____________________________________________________
+    static ObfuscationCost estimate(Instruction *I, const TargetTransformInfo *TTI);
 */
 
 /* Implemented in ArithmeticObfuscation/Add.cpp */
 namespace AddObfuscator {
-    bool obfuscate(Instruction *I);
+    bool obfuscate(Instruction *I, ObfuscationRandom *random = nullptr);
+    ObfuscationCost estimate(Instruction *I, const TargetTransformInfo *TTI);
 }
 
 /* Implemented in ArithmeticObfuscation/Sub.cpp */
 namespace SubObfuscator {
-    bool obfuscate(Instruction *I);
+    bool obfuscate(Instruction *I, ObfuscationRandom *random = nullptr);
+    ObfuscationCost estimate(Instruction *I, const TargetTransformInfo *TTI);
 }
 
 /* Implemented in ArithmeticObfuscation/Mul.cpp */
 namespace MulObfuscator {
-    bool obfuscate(Instruction *I);
+    bool obfuscate(Instruction *I, ObfuscationRandom *random = nullptr);
+    ObfuscationCost estimate(Instruction *I, const TargetTransformInfo *TTI);
 }
 
 /* Implemented in ArithmeticObfuscation/Div.cpp */
 namespace DivObfuscator {
-    bool obfuscate(Instruction *I);
+    bool obfuscate(Instruction *I, ObfuscationRandom *random = nullptr);
+    ObfuscationCost estimate(Instruction *I, const TargetTransformInfo *TTI);
 }
 
 /* Implemented in ArithmeticObfuscation/ArithmeticObfuscationUtils.cpp */
@@ -81,6 +102,23 @@ void floatObfuscator(
     Value* (*ifThenCaller)(IRBuilder<>*, Type*, Value*, Value*, Value*, Value*, Value*, Value*), 
     Value* (*ifElseCaller)(IRBuilder<>*, Value*, Value*));
 
+/*____________________________________________________
+ *
+ * Estimates the cost of floatObfuscator
+ *
+ * @param Instruction *I, the instruction to obfuscate
+ * @param ArrayRef<unsigned int> ifThenOpcodes, opcodes of the 
+ *        instructions built by ifThenCaller
+ * @param const TargetTransformInfo *TTI, from analysis pass
+ * @return ObfuscationCost, latency is per execution of I
+ *____________________________________________________*/
+ObfuscationCost estimateFloat(Instruction *I, 
+    ArrayRef<unsigned int> ifThenOpcodes, const TargetTransformInfo *TTI);
+
+// Cost of the rewrite of most cycles, for the instructions
+// with several rewrites chosen at random
+ObfuscationCost getCostliest(ArrayRef<ObfuscationCost> costs);
+
 } /* namespace ArithmeticObfuscationUtils */
 
 class ArithmeticObfuscation : public FunctionPass {
@@ -98,9 +136,16 @@ public:
      * @param BasicBlock *BB, the basic block to obfuscate
      * @param bool obfuscateFloat, true if floating point 
         operation has to be obfuscated, false otherwise
-     * @return true if IR is modified, false otherwise
+     * @param ObfuscationSiteMap *siteMap, to tag the emitted code
+     * @param const SmallPtrSetImpl<Instruction*> *kept, instructions
+        not to obfuscate (-arith-obfus-keep-scev), or nullptr
+     * @param ObfuscationRandom *random, chooses the rewrites, 
+        see obfuscate(Instruction*), or nullptr
+     * @return unsigned int, number of instructions obfuscated,
+     *         the IR is modified if > 0
      *____________________________________________________*/
-    static bool obfuscate(BasicBlock *BB, bool obfuscateFloat);
+    static unsigned int obfuscate(BasicBlock *BB, bool obfuscateFloat, ObfuscationSiteMap *siteMap, 
+        const SmallPtrSetImpl<Instruction*> *kept = nullptr, ObfuscationRandom *random = nullptr);
 
     /*____________________________________________________
      *
@@ -110,12 +155,57 @@ public:
      *       from the block, but changes all the uses. 
      *       Need to erase it manually.
      * @param Instruction *I, the instruction to obfuscate
+     * @param ObfuscationRandom *random, chooses among the 
+        rewrites of I (integer add and sub have several), 
+        the first one if nullptr
      * @return true if IR is modified, false otherwise
      *____________________________________________________*/
-    static bool obfuscate(Instruction *I);
+    static bool obfuscate(Instruction *I, ObfuscationRandom *random = nullptr);
     
     // Same as 'obfuscate(Instruction *I)' with floats enabled
-    static bool obfuscateWithFloat(Instruction *I);
+    static bool obfuscateWithFloat(Instruction *I, ObfuscationRandom *random = nullptr);
+
+    /*____________________________________________________
+     *
+     * Estimates the cost of obfuscating given instruction
+     * @param Instruction *I, the instruction to obfuscate
+     * @param bool obfuscateFloat, true if floating point 
+        operation has to be obfuscated, false otherwise
+     * @param const TargetTransformInfo *TTI, from analysis pass
+     * @return ObfuscationCost, latency is per execution of I,
+     *         zero cost if I is not obfuscated
+     *____________________________________________________*/
+    static ObfuscationCost estimate(Instruction *I, bool obfuscateFloat, const TargetTransformInfo *TTI);
+
+    void getAnalysisUsage(AnalysisUsage &AU) const override;
+
+};
+
+/*____________________________________________________
+ *
+ * -obf-outline, run after -arith-obfus: outlines the code
+ * emitted for every instruction (with all its iterations)
+ * into internal functions, shared by the sequences of the
+ * same shape, to shrink the code and its footprint in the
+ * instruction cache.
+ *
+ * A sequence is kept inline in a hot block (relative
+ * frequency above -obf-outline-hot-frequency), or when
+ * the call, its arguments and results cost more than
+ * the sequence (TTI). Identical outlined functions are
+ * merged, and a function left with a single call is
+ * inlined back, as it saves nothing.
+ *____________________________________________________*/
+class ObfuscationOutliner : public ModulePass {
+
+public:
+    static char ID;
+
+    ObfuscationOutliner();
+
+    bool runOnModule(Module &M) override;
+
+    void getAnalysisUsage(AnalysisUsage &AU) const override;
 
 };
 
@@ -10,6 +10,8 @@
 #include "llvm/Analysis/ScalarEvolution.h"
 #include "llvm/IR/LLVMContext.h"
 #include "llvm/IR/GlobalVariable.h"
+#include "llvm/Analysis/TargetTransformInfo.h"
+#include "ObfuscationUtils/ObfuscationUtils.h"
 
 using namespace llvm;
 
@@ -27,10 +29,11 @@ const int INVALID = -1;
  *
  * @param GlobalVariabel* globalVar, variable to encode
  * @param int *stringLength, the string length will be stored in this
+ * @param ObfuscationRandom &random, generator of the offset
  * @return int, the offset used to obfuscate
  *              CaesarCipher::INVALID if not encoded
  *___________________________________________________________________*/
-int encode(GlobalVariable* globalVar, int *stringLength);
+int encode(GlobalVariable* globalVar, int *stringLength, ObfuscationRandom &random);
 
 /*___________________________________________________________________
  *
@@ -41,8 +44,21 @@ int encode(GlobalVariable* globalVar, int *stringLength);
  * @param GlobalVariabel* globalVar, variable to decode in IR
  * @param int stringLength, the encoded string length
  * @param int offset, the offset used to encode
+ * @param ObfuscationSiteMap *siteMap, to tag the decode loops
  *___________________________________________________________________*/
-void decode(GlobalVariable* globalVar, int stringLength, int offset);
+void decode(GlobalVariable* globalVar, int stringLength, int offset, ObfuscationSiteMap *siteMap);
+
+/*___________________________________________________________________
+ *
+ * Estimates the cost of the decode added for one use of a string,
+ * for the budget of ObfuscationCostModel
+ *
+ * @param int stringLength, length of the string
+ * @param const TargetTransformInfo *TTI, from analysis pass
+ * @param LLVMContext &context, of the module
+ * @return ObfuscationCost, latency is per execution of the use
+ *___________________________________________________________________*/
+ObfuscationCost estimateDecode(int stringLength, const TargetTransformInfo *TTI, LLVMContext &context);
 
 } /* namespace CaesarCipher */
 
@@ -62,12 +78,14 @@ const int INVALID = -1;
  *                of the new  global variable is stored in this 
  * @param int *stringLength, the string length of encoded string 
  *                will be stored in this
+ * @param ObfuscationRandom &random, generator of nBits and the filler bits
  * @return int, number of bits encoded in each character
  *              BitEncodingAndDecoding::INVALID if not encoded
  *___________________________________________________________________*/
-int encode(GlobalVariable *globalVar, GlobalVariable **newStringGlobalVar, int *stringLength, Module *M);
+int encode(GlobalVariable *globalVar, GlobalVariable **newStringGlobalVar, int *stringLength, Module *M, 
+    ObfuscationRandom &random);
 
-int encodeNumber(GlobalVariable **globalVar, long num, int integerBits, Module *M);
+int encodeNumber(GlobalVariable **globalVar, long num, int integerBits, Module *M, ObfuscationRandom &random);
 /*___________________________________________________________________
  *
  * Adds inline decode function for bit-encoding in IR where ever 
@@ -78,13 +96,44 @@ int encodeNumber(GlobalVariable **globalVar, long num, int integerBits, Module *
  * @param GlobalVariabel** newStringGlobalVar, the encoded variable 
  * @param int stringLength, the encoded string length
  * @param int nBits, number of bits encoded in each character
+ * @param ObfuscationSiteMap *siteMap, to tag the decode loops
  *___________________________________________________________________*/
-void decode(GlobalVariable *globalVar, GlobalVariable *newStringGlobalVar, int stringLength, int nBits);
+void decode(GlobalVariable *globalVar, GlobalVariable *newStringGlobalVar, int stringLength, int nBits, 
+    ObfuscationSiteMap *siteMap);
 
-void decodeNumber(GlobalVariable* globalVar, Value *val, Instruction *I, int integerBits, int nBits, LLVMContext& ctx);
+void decodeNumber(GlobalVariable* globalVar, Value *val, Instruction *I, int integerBits, int nBits, 
+    LLVMContext& ctx, ObfuscationSiteMap *siteMap);
+
+/*___________________________________________________________________
+ *
+ * Estimates the cost of the decode added for one use of a string 
+ * (estimateDecode) or of an integer (estimateDecodeNumber), for 
+ * the budget of ObfuscationCostModel. nBits is random, hence the
+ * average over its values is taken
+ *
+ * @param int stringLength, length of the string (not encoded)
+ * @param int integerBits, width of the integer
+ * @param const TargetTransformInfo *TTI, from analysis pass
+ * @param LLVMContext &context, of the module
+ * @return ObfuscationCost, latency is per execution of the use
+ *___________________________________________________________________*/
+ObfuscationCost estimateDecode(int stringLength, const TargetTransformInfo *TTI, LLVMContext &context);
+ObfuscationCost estimateDecodeNumber(int integerBits, const TargetTransformInfo *TTI, LLVMContext &context);
 
 } /* namespace BitEncodingAndDecoding */
 
+namespace ConstantEncodingUtils {
+
+/*___________________________________________________________________
+ *
+ * @param GlobalVariabel* globalVar, string variable
+ * @return std::vector<Instruction*>, the instructions before which
+ *         the string is decoded, one for every use
+ *___________________________________________________________________*/
+std::vector<Instruction*> getDecodeSites(GlobalVariable* globalVar);
+
+} /* namespace ConstantEncodingUtils */
+
 class ConstantEncoding : public ModulePass {
 
 public:
@@ -94,6 +143,8 @@ public:
 
     bool runOnModule(Module &M);
 
+    void getAnalysisUsage(AnalysisUsage &AU) const override;
+
 };
 
 #endif
@@ -8,6 +8,10 @@
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Analysis/ScalarEvolution.h"
 #include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/Analysis/TargetTransformInfo.h"
+#include "llvm/Analysis/BlockFrequencyInfo.h"
+#include "ObfuscationUtils/ObfuscationUtils.h"
 using namespace llvm;
 
 
@@ -23,10 +27,54 @@ struct LoopSplitInfo {
     // This is that value which is used for iterating in original loop for indirect access.
     Value* tripCountValue;
 
+    // When true, the counters are kept in registers and the array is
+    // indexed with a canonical induction variable so that LoopVectorize
+    // can turn the index loads into contiguous vector loads.
+    // tripCountValue then holds the trip count itself, not an alloca.
+    bool vectorizeFriendly;
+
+    // When true, the indices are kept in a vector register and there 
+    // is no cloned loop (IndirectAccessUtils::updateIndirectAccessInRegister)
+    bool inRegister;
+
+    // Number of lanes of that vector, the trip count rounded up to a 
+    // power of 2, within a vector register (isRegisterTransform)
+    unsigned int lanes;
+
+    // Only every stride-th value of the iterator is stored in the array.
+    // The values in between are got by adding the step of the iterator.
+    unsigned int stride;
+
+    // When true, the loop is a statically scheduled OpenMP worksharing
+    // loop with a runtime trip count, and every thread allocates its own
+    // array for its chunk (IndirectAccessUtils::allocateThreadPrivateArray)
+    bool threadPrivate;
+
+    // Untransformed copy of the loop, run by a thread whose array 
+    // cannot be allocated, only with threadPrivate
+    Loop* fallbackLoop;
+
+    // Estimated cost of the loop and the cost added by the transform,
+    // both per call of the function (IndirectAccessUtils::estimateOverhead)
+    double loopCost;
+    double overhead;
+
+    // Cost added per iteration of the loop (IndirectAccessUtils::estimateOverhead)
+    double iterationOverhead;
+
     LoopSplitInfo(Loop* originalLoop):
         originalLoop(originalLoop), 
         clonedLoop(nullptr), 
-        tripCountValue(nullptr) {}
+        tripCountValue(nullptr),
+        vectorizeFriendly(false),
+        inRegister(false),
+        lanes(0),
+        stride(1),
+        threadPrivate(false),
+        fallbackLoop(nullptr),
+        loopCost(0),
+        overhead(0),
+        iterationOverhead(0) {}
 };
 
 namespace IndirectAccessUtils {
@@ -48,6 +96,7 @@ bool isLegalTransform(Loop *L, ScalarEvolution *SE);
  *
  * Clones the original loop. After the clone, the cloned loop
  * will be entered first which exits into the original loop
+ * LoopInfo and DominatorTree are updated for the cloned loop
  *
  * @param LoopSplitInfo *LSI, which constains orginalLoop
  * @param LoopInfo *LI, Loop info from analysis pass
@@ -65,16 +114,77 @@ void clone(LoopSplitInfo *LSI, LoopInfo *LI, DominatorTree *DT);
  *______________________________________________________________________*/
 void clearClonedLoop(LoopSplitInfo *LSI);
 
+/*______________________________________________________________________
+ *
+ * Removes the dead instructions left in the loop after the transform,
+ * like the phi nodes of the cleared cloned loop and the replaced iterator
+ *
+ * @param Loop *L, the original or the cloned loop
+ *______________________________________________________________________*/
+void removeDeadInstructions(Loop *L);
+
 /*______________________________________________________________________
  *
  * Allocates an array of given size in entry block
  * 
  * @param Function *F, functon in which the loop is present
  * @param int size, size of array to be allocated
+ * @param unsigned int bits, size of integer in the array
+ * @param unsigned int align, alignment of the array (0 for default)
  *
  * @return Value*, the allocated array
  *______________________________________________________________________*/
-Value* allocateArrayInEntryBlock(Function *F, int size);
+Value* allocateArrayInEntryBlock(Function *F, int size, 
+    unsigned int bits = MAX_BITS, unsigned int align = 0);
+
+/*______________________________________________________________________
+ *
+ * Gives the __kmpc_for_static_init_* call with a static schedule 
+ * which dominates the loop, present when the function is a loop
+ * outlined by OpenMP
+ * 
+ * @param Loop *L, the loop to check
+ * @param DominatorTree *DT, from analysis pass
+ *
+ * @return CallInst*, the call, nullptr if there is none
+ *______________________________________________________________________*/
+CallInst* getStaticInitCall(Loop *L, DominatorTree *DT);
+
+/*______________________________________________________________________
+ *
+ * Used to check if the loop is the chunk of a statically scheduled 
+ * OpenMP loop (getStaticInitCall) whose runtime trip count can be 
+ * computed before the loop, which then gets a thread private array
+ * 
+ * @param Loop *L, the loop to check
+ * @param ScalarEvolution *SE, from analysis pass
+ * @param DominatorTree *DT, from analysis pass
+ *
+ * @return true if it can be transformed with a thread private array
+ *______________________________________________________________________*/
+bool isParallelTransform(Loop *L, ScalarEvolution *SE, DominatorTree *DT);
+
+/*______________________________________________________________________
+ *
+ * Allocates an array for the chunk of the calling thread with 
+ * aligned_alloc in the preheader of the cloned loop, sized by the
+ * runtime trip count, and frees it in the exits of the original loop.
+ * If the allocation fails, the thread runs LSI->fallbackLoop instead, 
+ * a copy of the original loop made here, before it is transformed.
+ * NOTE: Should be used after clone and only if isParallelTransform is true
+ * 
+ * @param LoopSplitInfo *LSI, which constains orginal and cloned loop
+ * @param Function *F, functon in which the loop is present
+ * @param ScalarEvolution *SE, from analysis pass
+ * @param LoopInfo *LI, from analysis pass, the copy is added to it
+ * @param DominatorTree *DT, from analysis pass, updated for the copy
+ * @param unsigned int bits, size of integer in the array
+ * @param unsigned int align, alignment of the array, a power of 2
+ *
+ * @return Value*, pointer to the first element of the array
+ *______________________________________________________________________*/
+Value* allocateThreadPrivateArray(LoopSplitInfo *LSI, Function *F, 
+    ScalarEvolution *SE, LoopInfo *LI, DominatorTree *DT, unsigned int bits, unsigned int align);
 
 /*______________________________________________________________________
  *
@@ -91,12 +201,54 @@ void populateArray(LoopSplitInfo *LSI, Function *F, Value *indirectAccessArray,
 /*______________________________________________________________________
  *
  * Updates indirect access in original loop
+ * With LSI->stride > 1, the header is split and the array is loaded 
+ * only in every stride-th iteration, else the iterator is the previous
+ * value + step
  * 
  * @param LoopSplitInfo *LSI, which constains orginal and cloned loop
  * @param Function *F, functon in which the loop is present
  * @param ScalarEvolution *SE, from analysis pass
+ * @param LoopInfo *LI, Loop info from analysis pass
+ * @param DominatorTree *DT, from analysis pass
+ *______________________________________________________________________*/
+void updateIndirectAccess(LoopSplitInfo* LSI, Function* F, Value *indirectAccessArray, 
+    ScalarEvolution *SE, LoopInfo *LI, DominatorTree *DT);
+
+/*______________________________________________________________________
+ *
+ * Used to check if the indices of the loop can be kept in a vector
+ * register instead of the array (updateIndirectAccessInRegister)
+ * 
+ * @param Loop *L, the loop to check, should be a legal transform
+ * @param ScalarEvolution *SE, from analysis pass
+ * @param const TargetTransformInfo *TTI, for the width of the vector
+ *              registers of the target
+ * @param unsigned int maxTripCount, max trip count for this to be done
+ *
+ * @return true if the iterator is affine with constant step, the 
+ *         trip count is <= maxTripCount and a vector of 
+ *         PowerOf2Ceil(trip count) iterators fits in a vector 
+ *         register, else false
+ *______________________________________________________________________*/
+bool isRegisterTransform(Loop *L, ScalarEvolution *SE, 
+    const TargetTransformInfo *TTI, unsigned int maxTripCount);
+
+/*______________________________________________________________________
+ *
+ * Updates indirect access in original loop without the cloned loop 
+ * and the array. The iterator values are kept in a vector register, 
+ * element for iteration k is at lane (k*multiplier)%lanes. The vector 
+ * is rotated by multiplier lanes every iteration and the iterator is 
+ * read from lane 0, hence there is no memory access.
+ * NOTE: Should be used only if isRegisterTransform is true
+ * 
+ * @param LoopSplitInfo *LSI, which constains orginal loop
+ * @param Function *F, functon in which the loop is present
+ * @param ScalarEvolution *SE, from analysis pass
+ * @param bool permute, if true, multiplier is a random odd number,
+ *                      else 1 (the vector holds the iterator in order)
  *______________________________________________________________________*/
-void updateIndirectAccess(LoopSplitInfo* LSI, Function* F, Value *indirectAccessArray, ScalarEvolution *SE);
+void updateIndirectAccessInRegister(LoopSplitInfo* LSI, Function* F, ScalarEvolution *SE, bool permute);
 
 /*______________________________________________________________________
  *
@@ -111,6 +263,85 @@ void updateIndirectAccess(LoopSplitInfo* LSI, Function* F, Value *indirectAccess
  *______________________________________________________________________*/
 Value* getIntegerIterator(Loop *L, ScalarEvolution *SE);
 
+/*______________________________________________________________________
+ *
+ * Estimated cost of a function per call, which is the TTI cost of 
+ * every block weighted by its frequency relative to the entry block
+ * 
+ * @param Function *F, the function
+ * @param const TargetTransformInfo *TTI, from analysis pass
+ * @param BlockFrequencyInfo *BFI, from analysis pass
+ *
+ * @return double, the cost
+ *______________________________________________________________________*/
+double getFunctionCost(Function *F, const TargetTransformInfo *TTI, BlockFrequencyInfo *BFI);
+
+/*______________________________________________________________________
+ *
+ * Estimates the cost of the loop and the cost added by the transform,
+ * per call of the function, and stores them in LSI->loopCost and 
+ * LSI->overhead (and per iteration in LSI->iterationOverhead). LSI->inRegister and LSI->vectorizeFriendly should be 
+ * set before, as they change the cost. If the loop is vectorized, 
+ * every added instruction is counted once per element.
+ * 
+ * @param LoopSplitInfo *LSI, which constains orginal loop
+ * @param ScalarEvolution *SE, from analysis pass
+ * @param const TargetTransformInfo *TTI, from analysis pass
+ * @param BlockFrequencyInfo *BFI, from analysis pass
+ *______________________________________________________________________*/
+void estimateOverhead(LoopSplitInfo *LSI, ScalarEvolution *SE, 
+    const TargetTransformInfo *TTI, BlockFrequencyInfo *BFI);
+
+/*______________________________________________________________________
+ *
+ * Estimates the number of instructions, blocks and memory operations
+ * added by the transform of the loop, for ObfuscationCostModel, from
+ * the opcodes of the instructions the transform emits for it. LSI
+ * should be set up as for estimateOverhead.
+ * 
+ * @param LoopSplitInfo *LSI, which constains orginal loop
+ * @param ScalarEvolution *SE, from analysis pass
+ * @param const TargetTransformInfo *TTI, from analysis pass
+ *
+ * @return ObfuscationCost, without the cycles and the latency
+ *______________________________________________________________________*/
+ObfuscationCost estimateSize(LoopSplitInfo *LSI, ScalarEvolution *SE, 
+    const TargetTransformInfo *TTI);
+
+/*______________________________________________________________________
+ *
+ * Gives the step of the iterator (getIntegerIterator) if it is
+ * a constant
+ * 
+ * @param Loop *L, loop whose iterator step is required
+ * @param ScalarEvolution *SE, from analysis pass
+ *
+ * @return ConstantInt*, the step, nullptr if not a constant
+ *______________________________________________________________________*/
+ConstantInt* getIteratorStep(Loop *L, ScalarEvolution *SE);
+
+/*______________________________________________________________________
+ *
+ * Gives a name for the loop which stays the same with and without
+ * the transformation (debug location if present, else header name)
+ * 
+ * @param Loop *L, the loop to name
+ *
+ * @return std::string, "function:location"
+ *______________________________________________________________________*/
+std::string getLoopOrigin(Loop *L);
+
+/*______________________________________________________________________
+ *
+ * Tags the loop with "indirect.access" loop metadata. The tag survives
+ * LoopVectorize and is read back by IndirectAccessVectorizationReport
+ * 
+ * @param Loop *L, loop to tag
+ * @param StringRef role, "transformed" or "populate"
+ * @param StringRef origin, name of the original loop (getLoopOrigin)
+ *______________________________________________________________________*/
+void tagLoop(Loop *L, StringRef role, StringRef origin);
+
 } /* namespace IndirectAccessUtils */
 
 class IndirectAccess : public FunctionPass {
@@ -118,7 +349,34 @@ class IndirectAccess : public FunctionPass {
 public:
     static char ID;
 
-    IndirectAccess() : FunctionPass(ID) {}
+    IndirectAccess() : FunctionPass(ID), moduleBudget(0), moduleSpent(0) {}
+
+    bool runOnFunction(Function &F);
+    
+    void getAnalysisUsage(AnalysisUsage &AU) const override;
+
+private:
+    // With -indirect-access-budget-scope=module, the budget of all the
+    // functions seen till now and the overhead spent from it
+    double moduleBudget;
+    double moduleSpent;
+
+};
+
+/*______________________________________________________________________
+ *
+ * Reports per innermost loop whether it was vectorized and at what VF.
+ * To be run after LoopVectorize, e.g.
+ *   -loop-rotate -indirect-access -loop-vectorize -indirect-access-vec-report
+ * Loops created by IndirectAccess are reported with their role, other
+ * loops as "original", keyed by the same origin name in both cases.
+ *______________________________________________________________________*/
+class IndirectAccessVectorizationReport : public FunctionPass {
+
+public:
+    static char ID;
+
+    IndirectAccessVectorizationReport() : FunctionPass(ID) {}
 
     bool runOnFunction(Function &F);
     
@@ -0,0 +1,71 @@
+#ifndef __OBFUSCATION_JIT_H__
+#define __OBFUSCATION_JIT_H__
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ExecutionEngine/Orc/IRTransformLayer.h"
+#include "llvm/IR/Module.h"
+#include "llvm/PassInfo.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Target/TargetMachine.h"
+#include <memory>
+#include <string>
+#include <vector>
+using namespace llvm;
+
+/*______________________________________________________________________
+ *
+ * Obfuscation in the ORC JIT, at lazy compile time.
+ *
+ * CompileOnDemandLayer splits every module added into a module with its
+ * globals and one module per function, and emits a function to the layer
+ * below it when the function is first called. With ObfuscationLayer below
+ * it, the function passes (-arith-obfus, -indirect-access) run on a
+ * function at its first call, and the functions never called are never
+ * transformed:
+ *
+ *   ObjectLayer <- IRCompileLayer <- ObfuscationLayer <- CompileOnDemandLayer
+ *
+ * The module passes (-const-encoding) need every use of a string, which
+ * a partition does not have, hence run on the whole module in
+ * prepareModule, before the module is added to CompileOnDemandLayer,
+ * and so before the function passes whatever the order given.
+ *______________________________________________________________________*/
+class ObfuscationTransform {
+
+public:
+    /*__________________________________________________________________
+     *
+     * @param TargetMachine &TM, target of the JIT, for the TTI of the
+     *                      cost estimates, has to outlive the transform
+     * @param ArrayRef<std::string> passNames, the passes by name as
+     *                      given to opt, in the order they are run
+     *
+     * @return the transform, or an error for an unknown pass
+     *__________________________________________________________________*/
+    static Expected<ObfuscationTransform> create(TargetMachine &TM, ArrayRef<std::string> passNames);
+
+    // Runs the module passes, on the module before it is partitioned
+    void prepareModule(Module &M);
+
+    // Runs the function passes, on a partition of CompileOnDemandLayer
+    std::shared_ptr<Module> operator()(std::shared_ptr<Module> M);
+
+    // Runs all the passes in order, when the module is compiled eagerly
+    void runAll(Module &M);
+
+private:
+    ObfuscationTransform(TargetMachine &TM);
+
+    void run(Module &M, ArrayRef<const PassInfo*> passes);
+
+    TargetMachine *TM;
+    std::vector<const PassInfo*> allPasses;
+    std::vector<const PassInfo*> modulePasses;
+    std::vector<const PassInfo*> functionPasses;
+
+};
+
+template <typename BaseLayerT>
+using ObfuscationLayer = orc::IRTransformLayer<BaseLayerT, ObfuscationTransform>;
+
+#endif
@@ -0,0 +1,608 @@
+#ifndef __OBFUSCATION_UTILS_H__
+#define __OBFUSCATION_UTILS_H__
+
+#include "llvm/Pass.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Instruction.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Analysis/TargetTransformInfo.h"
+#include "llvm/Analysis/BlockFrequencyInfo.h"
+#include "llvm/Analysis/BranchProbabilityInfo.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/DebugLoc.h"
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+using namespace llvm;
+
+/*______________________________________________________________________
+ *
+ * Estimated change made by an obfuscation
+ * size, number of IR instructions added
+ * blocks, number of basic blocks added
+ * memoryOps, number of loads and stores added
+ * cycles, TTI cost added per execution of the obfuscated code
+ * latency, TTI cost added per call of the function, i.e. cycles
+ *          weighted by the frequency of the obfuscated code
+ *          relative to the entry block
+ *______________________________________________________________________*/
+struct ObfuscationCost {
+    double size;
+    double blocks;
+    double memoryOps;
+    double cycles;
+    double latency;
+
+    ObfuscationCost():
+        size(0), blocks(0), memoryOps(0), cycles(0), latency(0) {}
+
+    ObfuscationCost& operator+=(const ObfuscationCost &other) {
+        size += other.size;
+        blocks += other.blocks;
+        memoryOps += other.memoryOps;
+        cycles += other.cycles;
+        latency += other.latency;
+        return *this;
+    }
+
+    ObfuscationCost operator*(double times) const {
+        ObfuscationCost cost(*this);
+        cost.size *= times;
+        cost.blocks *= times;
+        cost.memoryOps *= times;
+        cost.cycles *= times;
+        cost.latency *= times;
+        return cost;
+    }
+};
+
+// A transformation which a pass wants to do, with its cost and its value.
+// function is where the cost is added, nullptr if in many functions
+struct ObfuscationCandidate {
+    ObfuscationCost cost;
+    Function *function;
+    double value;
+
+    ObfuscationCandidate(ObfuscationCost cost, Function *function, double value = 1):
+        cost(cost), function(function), value(value) {}
+};
+
+namespace ObfuscationUtils {
+
+// Parses a percentage, "5%" or "5", into a ratio, 0.05
+struct PercentParser : public cl::parser<double> {
+    PercentParser(cl::Option &O) : cl::parser<double>(O) {}
+
+    bool parse(cl::Option &O, StringRef ArgName, StringRef Arg, double &Val) {
+        StringRef number = Arg;
+        number.consume_back("%");
+        if(number.getAsDouble(Val) || Val < 0)
+            return O.error("'" + Arg + "' value invalid for percentage argument!");
+        Val /= 100;
+        return false;
+    }
+};
+
+/*______________________________________________________________________
+ *
+ * TTI cost of one instruction with given opcode and type
+ *
+ * @param unsigned int opcode, Instruction::Add etc.
+ * @param Type *type, type of the result (of the value for store)
+ * @param const TargetTransformInfo *TTI, from analysis pass
+ *
+ * @return double, the cost
+ *______________________________________________________________________*/
+double getOpcodeCost(unsigned int opcode, Type *type, const TargetTransformInfo *TTI);
+
+/*______________________________________________________________________
+ *
+ * Cost of replacing the instructions with opcodes 'removed' by
+ * instructions with opcodes 'added', all of the given type
+ *
+ * @param ArrayRef<unsigned int> added, opcodes of added instructions
+ * @param ArrayRef<unsigned int> removed, opcodes of removed instructions
+ * @param Type *type, type of the instructions
+ * @param const TargetTransformInfo *TTI, from analysis pass
+ *
+ * @return ObfuscationCost, latency is same as cycles, 
+ *         i.e. not weighted by frequency
+ *______________________________________________________________________*/
+ObfuscationCost getReplacementCost(ArrayRef<unsigned int> added,
+    ArrayRef<unsigned int> removed, Type *type, const TargetTransformInfo *TTI);
+
+/*______________________________________________________________________
+ *
+ * Frequency of the block relative to the entry block of its function
+ *
+ * @param BasicBlock *BB, the block
+ * @param BlockFrequencyInfo *BFI, from analysis pass
+ *
+ * @return double, the frequency
+ *______________________________________________________________________*/
+double getRelativeFrequency(BasicBlock *BB, BlockFrequencyInfo *BFI);
+
+/*______________________________________________________________________
+ *
+ * Block frequencies of a function computed without the pass manager,
+ * for passes which change the CFG before they need the frequencies
+ *______________________________________________________________________*/
+struct FunctionFrequency {
+    DominatorTree DT;
+    LoopInfo LI;
+    BranchProbabilityInfo BPI;
+    BlockFrequencyInfo BFI;
+
+    FunctionFrequency(Function &F): DT(F), LI(DT), BPI(F, LI), BFI(F, BPI, LI) {}
+};
+
+/*______________________________________________________________________
+ *
+ * Number of IR instructions in the function
+ *______________________________________________________________________*/
+double getFunctionSize(Function &F);
+
+/*______________________________________________________________________
+ *
+ * TTI cost of the function per call (every block weighted
+ * by its relative frequency)
+ *______________________________________________________________________*/
+double getFunctionLatency(Function &F, const TargetTransformInfo *TTI, BlockFrequencyInfo *BFI);
+
+/*______________________________________________________________________
+ *
+ * Alloca at the start of the entry block of F, for the temporaries
+ * of the code emitted by the passes. An alloca in any other block is
+ * dynamic, the frame grows every time it runs, e.g. in a loop, and
+ * it is not promoted by mem2reg and SROA.
+ *______________________________________________________________________*/
+AllocaInst *createEntryBlockAlloca(Function *F, Type *type, const Twine &name = "");
+
+/*______________________________________________________________________
+ *
+ * Sets the !prof branch weights of a conditional branch emitted by a
+ * pass. Block placement keeps the likely successor on the fall through
+ * path and moves the unlikely one out of the hot code, to the end of
+ * the function, and the block frequencies seen by the later passes
+ * (and by the cost model) follow the weights.
+ *
+ * @param BranchInst *BI, the conditional branch
+ * @param uint32_t trueWeight, weight of the first successor
+ * @param uint32_t falseWeight, weight of the second successor,
+ *        a weight of 0 is taken as 1
+ *______________________________________________________________________*/
+void setBranchWeights(BranchInst *BI, uint32_t trueWeight, uint32_t falseWeight);
+
+// Weights of the guard of a slow path, same as __builtin_expect
+const uint32_t LIKELY_WEIGHT = 2000;
+const uint32_t UNLIKELY_WEIGHT = 1;
+
+/*______________________________________________________________________
+ *
+ * Layers of obfuscation of a function or global, kept in its obf.<pass>
+ * metadata: the number of runs of the pass which have transformed or
+ * produced it. The metadata is kept in the bitcode, hence seen when the
+ * passes run again, at link time (LTO) or when listed twice in a
+ * pipeline, and a pass does not obfuscate its own output again, which
+ * would grow the code geometrically, unless -obf-max-layers=N allows
+ * up to N layers.
+ *______________________________________________________________________*/
+unsigned int getLayers(const GlobalObject *GO, StringRef pass);
+
+void setLayers(GlobalObject *GO, StringRef pass, unsigned int layers);
+
+// true if GO has less than -obf-max-layers layers of the pass
+bool canObfuscate(const GlobalObject *GO, StringRef pass);
+
+// true if -obf-function=NAME is given, the passes then transform only
+// the functions named, the others are skipped without remarks
+bool hasSelectedFunctions();
+
+// true if F is named by -obf-function, or if it is not given
+bool isSelected(const Function *F);
+
+// Group of the NamedRegionTimer sections of the passes, reported
+// with -time-passes
+const char *const TIMER_GROUP = "obfuscation";
+const char *const TIMER_GROUP_DESCRIPTION = "Obfuscation passes";
+
+} /* namespace ObfuscationUtils */
+
+/*______________________________________________________________________
+ *
+ * Budget shared by all the obfuscation passes of a run.
+ *
+ * -obf-size-budget=P% bounds the growth in code size of the module, and
+ * -obf-latency-budget=P% the growth of the latency of the functions.
+ * Every function adds P% of its size and latency to the budget when it
+ * is first seen by a pass, and the budget not spent by the functions
+ * before it can be spent by the later ones.
+ *
+ * A pass estimates the cost of every candidate transformation, and
+ * the model selects greedily by value per unit cost (select). After
+ * transforming a function the measured size is checked (commit), and
+ * the function is restored from its checkpoint if it is over budget.
+ * With no budget given, every candidate is selected.
+ *
+ * With -obf-dry-run the passes only estimate and select the candidates,
+ * the estimates are written as a JSON report to -obf-dry-run-output
+ * at the end of the run, and the IR is not changed.
+ *______________________________________________________________________*/
+class ObfuscationCostModel : public ImmutablePass {
+
+public:
+    static char ID;
+
+    ObfuscationCostModel();
+
+    // true if -obf-size-budget or -obf-latency-budget is given
+    bool hasBudget() const;
+
+    // true if -obf-dry-run is given, the passes should not change the IR
+    bool isDryRun() const;
+
+    // true if the passes should estimate their candidates
+    bool needsEstimates() const { return hasBudget() || isDryRun(); }
+
+    // true if a function can be rolled back by commit (-obf-size-budget
+    // without dry run). Static for getAnalysisUsage: a pass which keeps
+    // analyses up to date cannot preserve them then, as the restored
+    // body is not the one they were updated for
+    static bool canRollBack();
+
+    /*__________________________________________________________________
+     *
+     * Adds the budget of the function, only the first time it is seen
+     *
+     * @param Function &F, function about to be transformed
+     * @param const TargetTransformInfo *TTI, from analysis pass
+     * @param BlockFrequencyInfo *BFI, from analysis pass
+     *__________________________________________________________________*/
+    void addFunction(Function &F, const TargetTransformInfo *TTI, BlockFrequencyInfo *BFI);
+
+    /*__________________________________________________________________
+     *
+     * Selects the candidates which fit in the remaining budget, by value
+     * per unit of cost, and spends the budget for them. With dry run,
+     * the candidates are added to the report.
+     *
+     * @param StringRef pass, name of the pass (its DEBUG_TYPE)
+     * @param ArrayRef<ObfuscationCandidate> candidates, to select from
+     *
+     * @return std::vector<bool>, true for every selected candidate
+     *__________________________________________________________________*/
+    std::vector<bool> select(StringRef pass, ArrayRef<ObfuscationCandidate> candidates);
+
+    /*__________________________________________________________________
+     *
+     * Saves a copy of the function before transforming it. The copy
+     * is not in the module, and has the same debug info metadata as F
+     * (not a copy of its subprogram), hence the restored body is valid
+     * in F.
+     *
+     * @param Function &F, function about to be transformed
+     *
+     * @return Function*, the copy to be given to commit,
+     *         nullptr if there is no size budget
+     *__________________________________________________________________*/
+    Function* checkpoint(Function &F);
+
+    /*__________________________________________________________________
+     *
+     * Measures the size of the transformed function. If the module is
+     * over the size budget with it, the function is restored from the
+     * copy and the size and latency spent by its candidates are given
+     * back, else the estimated size is replaced by the measured one.
+     * The copy is deleted in both cases.
+     *
+     * @param Function &F, the transformed function
+     * @param Function *backup, from checkpoint
+     *
+     * @return true if the changes are kept, false if rolled back
+     *__________________________________________________________________*/
+    bool commit(Function &F, Function *backup);
+
+    // Writes the dry run report
+    bool doFinalization(Module &M) override;
+
+    void print(raw_ostream &OS, const Module *M) const override;
+
+private:
+    // Greedy selection of select when there is a budget
+    void selectInBudget(ArrayRef<ObfuscationCandidate> candidates, std::vector<bool> &selected);
+
+    // Total budget of the functions seen till now, and spent from it
+    double sizeBudget, sizeSpent;
+    double latencyBudget, latencySpent;
+
+    // Size of the function at checkpoint, and estimated size
+    // and latency spent by select after it
+    DenseMap<const Function*, double> checkpointSize;
+    DenseMap<const Function*, double> pendingSize;
+    DenseMap<const Function*, double> pendingLatency;
+
+    DenseMap<const Function*, bool> seen;
+
+    // Dry run report, per function (in order of name) and per pass
+    struct ReportEntry {
+        ObfuscationCost total;
+        ObfuscationCost selected;
+        int candidates;
+        int selectedCandidates;
+
+        ReportEntry(): candidates(0), selectedCandidates(0) {}
+    };
+    struct FunctionReport {
+        double size;
+        double latency;
+        std::map<std::string, ReportEntry> passes;
+
+        FunctionReport(): size(0), latency(0) {}
+    };
+    std::map<std::string, FunctionReport> report;
+
+    int rolledBack;
+
+};
+
+/*______________________________________________________________________
+ *
+ * Map of the code emitted by the obfuscation passes, for profilers.
+ *
+ * Every transformation is a site, with an id, the pass, the kind of
+ * rewrite and the location of the original instruction. The emitted
+ * instructions get the DebugLoc of the original instruction (if they
+ * have none), so that a profile of a binary built with -g points to
+ * the original source line.
+ *
+ * With -obf-site-map-file=FILE the emitted instructions are also tagged
+ * with !obf.site metadata, and at the end of the run the sites are
+ * written to FILE, one per line, tab separated:
+ *     site pass kind function location instructions parent
+ * location is file:line:col (or -), instructions is the number of
+ * instructions of the site in the final IR, and parent is the site
+ * which emitted the original instruction (0 if none), e.g. for the
+ * later iterations of -arith-obfus.
+ *
+ * The sites are also recorded (without FILE) when a pass of the pipeline
+ * requires ObfuscationSiteRequest, e.g. ObfuscationInstrument.
+ *______________________________________________________________________*/
+class ObfuscationSiteMap : public ImmutablePass {
+
+public:
+    static char ID;
+
+    // Position of an instruction before it is transformed, see tagSince
+    struct Marker {
+        Instruction *original;
+        // instruction before and after the original in its block,
+        // previous is nullptr if original is the first one
+        Instruction *previous;
+        Instruction *next;
+        BasicBlock *block;
+        // last block of the function, the new blocks are added after it
+        BasicBlock *lastBlock;
+    };
+
+    ObfuscationSiteMap();
+
+    // true if -obf-site-map-file is given, or the sites are required
+    bool isEnabled() const;
+
+    // Checks for ObfuscationSiteRequest, before the passes run
+    bool doInitialization(Module &M) override;
+
+    // Number of sites, the ids are 1 to getNumSites()
+    unsigned int getNumSites() const { return sites.size(); }
+
+    // Marks the position of I, to be given to tagSince after transforming it
+    static Marker mark(Instruction *I);
+
+    /*__________________________________________________________________
+     *
+     * Tags the instructions emitted for the transform of marker.original:
+     * the ones inserted before it in its block, and the ones in the blocks
+     * added to the function, till the original instruction or the ones
+     * after it (moved by the transform) are found.
+     *
+     * @param const Marker &marker, from mark, before the transform
+     * @param StringRef pass, name of the pass (its DEBUG_TYPE)
+     * @param StringRef kind, the rewrite, e.g. "add"
+     *
+     * @return unsigned int, the site id, 0 if the map is not enabled
+     *__________________________________________________________________*/
+    unsigned int tagSince(const Marker &marker, StringRef pass, StringRef kind);
+
+    /*__________________________________________________________________
+     *
+     * Adds a site for code which is tagged by the pass with tag
+     *
+     * @param StringRef pass, name of the pass (its DEBUG_TYPE)
+     * @param StringRef kind, the rewrite, e.g. "index-load"
+     * @param Function &F, function of the site
+     * @param const DebugLoc &location, of the original code
+     *
+     * @return unsigned int, the site id, 0 if the map is not enabled
+     *__________________________________________________________________*/
+    unsigned int addSite(StringRef pass, StringRef kind, Function &F, const DebugLoc &location);
+
+    // Tags I with the site, and the location of the site if I has none
+    void tag(unsigned int site, Instruction *I);
+
+    // Site of the instruction, 0 if not emitted by a site
+    static unsigned int getSite(const Instruction *I);
+
+    // Pass and parent of a site, the parent is the site which emitted
+    // the original instruction of the site, 0 if none
+    StringRef getPass(unsigned int site) const { return sites[site-1].pass; }
+    StringRef getKind(unsigned int site) const { return sites[site-1].kind; }
+    unsigned int getParent(unsigned int site) const { return sites[site-1].parent; }
+
+    // Writes the map
+    bool doFinalization(Module &M) override;
+
+private:
+    struct Site {
+        std::string pass;
+        std::string kind;
+        std::string function;
+        std::string location;
+        DebugLoc debugLoc;
+        unsigned int parent;
+    };
+    // sites[id-1]
+    std::vector<Site> sites;
+    // ObfuscationSiteRequest is in the pipeline
+    bool sitesRequired;
+
+};
+
+/*______________________________________________________________________
+ *
+ * Required (getAnalysisUsage) by the passes which read the sites after
+ * the obfuscation passes, e.g. ObfuscationInstrument. Being scheduled
+ * before any pass runs, it makes ObfuscationSiteMap record the sites
+ * without -obf-site-map-file. Holds nothing.
+ *______________________________________________________________________*/
+class ObfuscationSiteRequest : public ImmutablePass {
+
+public:
+    static char ID;
+
+    ObfuscationSiteRequest();
+
+};
+
+/*______________________________________________________________________
+ *
+ * -obf-instrument, counts at runtime the instructions executed by every
+ * site of ObfuscationSiteMap. Should run after the obfuscation passes.
+ *
+ * Every block with instructions of a site adds their number to the
+ * counter of the site, in an array of i64 counters indexed by site id
+ * (__obf_site_counters, not atomic). A constructor registers the array
+ * with the ObfuscationRuntime library, which has to be linked, and the
+ * counters are written to a file at exit.
+ *______________________________________________________________________*/
+class ObfuscationInstrument : public ModulePass {
+
+public:
+    static char ID;
+
+    ObfuscationInstrument();
+
+    bool runOnModule(Module &M) override;
+
+    void getAnalysisUsage(AnalysisUsage &AU) const override;
+
+};
+
+/*______________________________________________________________________
+ *
+ * Random numbers of the passes. The generator of every function (or
+ * global) is seeded from -obf-seed=N, the pass and the name of the
+ * function, hence with N given the result of a function is the same
+ * in every run, whatever the other functions and their order.
+ * Without -obf-seed, N is random for every run.
+ *
+ * A variant (llvm-obfuscate -variants) is also part of the seed, so
+ * that every variant of a module differs with the same N. It is set
+ * per thread, the variants are obfuscated in parallel.
+ *______________________________________________________________________*/
+class ObfuscationRandom {
+
+public:
+    ObfuscationRandom(StringRef pass, StringRef name);
+
+    // Uniform in [0, 2^30), the same on every platform
+    unsigned int next();
+
+    // true if -obf-seed is given, else the seed changes every run
+    static bool isReproducible();
+
+    static uint64_t getSeed();
+
+    // For the passes run by the calling thread, 0 by default
+    static void setVariant(unsigned int variant);
+
+    static unsigned int getVariant();
+
+private:
+    std::mt19937 engine;
+
+};
+
+/*______________________________________________________________________
+ *
+ * On disk cache of obfuscated functions, in -obf-cache-dir=DIR.
+ *
+ * The key of a function is a hash of its IR before the pass, the
+ * pass, its configuration and the seed. The entry is a bitcode module
+ * with the function after the pass, and declarations of the globals
+ * it uses. On a hit the cached body replaces the body of the function,
+ * with the globals mapped by name.
+ *
+ * A function is not cached when its result depends on more than its
+ * IR: with a budget of ObfuscationCostModel, with the site map, without
+ * -obf-seed for a pass using ObfuscationRandom, or with debug info,
+ * whose metadata cannot be moved between modules.
+ *______________________________________________________________________*/
+class ObfuscationCache {
+
+public:
+    static bool isEnabled();
+
+    /*__________________________________________________________________
+     *
+     * @param Function &F, the function before the pass
+     * @param StringRef pass, name of the pass
+     * @param StringRef configuration, the options of the pass
+     *
+     * @return std::string, the key, empty if F cannot be cached
+     *__________________________________________________________________*/
+    static std::string getKey(Function &F, StringRef pass, StringRef configuration);
+
+    // Replaces the body of F with the cached one, false on a miss
+    static bool load(Function &F, StringRef key);
+
+    // Stores the body of F after the pass
+    static void store(Function &F, StringRef key);
+
+};
+
+/*______________________________________________________________________
+ *
+ * Placement of the obfuscation passes in the standard pipeline
+ * (PassManagerBuilder, used by clang and opt -O<N>), with
+ * -obf-extension-point:
+ *
+ * optimizer-last, after the whole optimization pipeline, so that the
+ * original code is inlined, vectorized and strength reduced first. The
+ * passes are followed by a cleanup which does not fold the rewrites.
+ * No extension point before it is offered, InstCombine and GVN after
+ * the passes fold part of the rewrites back.
+ *
+ * Every pass library registers its pass when loaded, and the passes
+ * are added in the order below whatever the order of loading.
+ *______________________________________________________________________*/
+namespace ObfuscationPipeline {
+
+// Loops are transformed before their iterators are obfuscated
+enum Order { IndirectAccessOrder, ConstantEncodingOrder, ArithmeticObfuscationOrder };
+
+typedef Pass *(*PassFactory)();
+
+// Registers the pass to be added at -obf-extension-point
+struct Registration {
+    Registration(Order order, PassFactory factory);
+};
+
+} /* namespace ObfuscationPipeline */
+
+#endif